@@ -0,0 +1,171 @@
+#include "Body.h"
+#include "kinematics.h"
+#include "Servo.h"
+
+#include <cmath>
+
+Body::Body(std::vector<Leg>& legs) : legs(legs), use_incremental(false)
+{
+	setPose(BodyPose {0, 0, 0, 0, 0, 0});
+}
+
+// R = Rz(yaw) * Ry(pitch) * Rx(roll), the only trig the pose needs per change
+void Body::setPose(const BodyPose& p)
+{
+	pose = p;
+	posed = p != BodyPose {0, 0, 0, 0, 0, 0};
+
+	float cr = FMath::cos(p.roll), sr = FMath::sin(p.roll);
+	float cp = FMath::cos(p.pitch), sp = FMath::sin(p.pitch);
+	float cy = FMath::cos(p.yaw), sy = FMath::sin(p.yaw);
+	rot[0][0] = cy * cp; rot[0][1] = cy * sp * sr - sy * cr; rot[0][2] = cy * sp * cr + sy * sr;
+	rot[1][0] = sy * cp; rot[1][1] = sy * sp * sr + cy * cr; rot[1][2] = sy * sp * cr - cy * sr;
+	rot[2][0] = -sp;     rot[2][1] = cp * sr;                rot[2][2] = cp * cr;
+}
+
+// the feet stay put and the body moves, so a foot relative to its hip becomes R^T (foot - t) in the moved body.
+// leg positions are relative to the hip, the hip origins put them around the body center
+void Body::toPosed(int leg, float& x, float& y, float& z) const
+{
+	float o[2];
+	LegSwitch<Robot>::origin(leg, o[0], o[1]);
+	float fx = x + o[0] - pose.x, fy = y + o[1] - pose.y, fz = z - pose.z;
+	x = rot[0][0] * fx + rot[1][0] * fy + rot[2][0] * fz - o[0];
+	y = rot[0][1] * fx + rot[1][1] * fy + rot[2][1] * fz - o[1];
+	z = rot[0][2] * fx + rot[1][2] * fy + rot[2][2] * fz;
+}
+
+void Body::fromPosed(int leg, float& x, float& y, float& z) const
+{
+	float o[2];
+	LegSwitch<Robot>::origin(leg, o[0], o[1]);
+	float fx = x + o[0], fy = y + o[1], fz = z;
+	x = rot[0][0] * fx + rot[0][1] * fy + rot[0][2] * fz + pose.x - o[0];
+	y = rot[1][0] * fx + rot[1][1] * fy + rot[1][2] * fz + pose.y - o[1];
+	z = rot[2][0] * fx + rot[2][1] * fy + rot[2][2] * fz + pose.z;
+}
+
+// IK for the first n legs using the incremental solver if it is selected, returns the mask of reachable legs. The IK
+// table isn't used here, one batch pass is faster than a table lookup per leg
+uint32_t Body::solve(const LegTargets& t, LegAngles& a, const int *idx, int n)
+{
+	if(use_incremental) return incremental.solve(t, a, idx, n);
+	return batchInverseKinematics(t, a, n);
+}
+
+// the femur and tibia reach an annulus around the knee pivot, the margin keeps the solve clear of acos(±1) rounding
+bool Body::clampToWorkspace(float& x, float& y, float& z)
+{
+	const float margin = 0.01F;
+	const float max_reach = Robot::FEMUR + Robot::TIBIA - margin;
+	const float min_reach = std::abs(Robot::TIBIA - Robot::FEMUR) + margin;
+
+	float r = FMath::sqrt(x * x + y * y);
+	float f = r - Robot::COXA;
+	float d = FMath::sqrt(f * f + z * z);
+	if(d >= min_reach && d <= max_reach) return false;
+
+	// scale the knee to foot vector onto the boundary, straight out if it is degenerate
+	if(d < 1e-6F) {
+		f = min_reach;
+		z = 0;
+	} else {
+		float s = (d > max_reach ? max_reach : min_reach) / d;
+		f *= s;
+		z *= s;
+	}
+
+	// keep the hip angle
+	float nr = f + Robot::COXA;
+	if(r < 1e-6F) {
+		x = nr;
+		y = 0;
+	} else {
+		x *= nr / r;
+		y *= nr / r;
+	}
+	return true;
+}
+
+MoveResult Body::commit(const MoveSet& moves, float slice, MoveMode mode)
+{
+	return apply(moves, slice, true, mode);
+}
+
+MoveResult Body::place(const MoveSet& targets, MoveMode mode)
+{
+	return apply(targets, 1, false, mode);
+}
+
+MoveResult Body::apply(const MoveSet& moves, float slice, bool relative, MoveMode mode)
+{
+	static_assert(Robot::NLEGS <= KIN_LANES, "one batch must hold every leg");
+
+	LegTargets t = {}; // the unused lanes still go through the solve, keep them finite
+	LegAngles a;
+	float px[KIN_LANES], py[KIN_LANES], pz[KIN_LANES];
+	int idx[KIN_LANES] = {0};
+
+	int n = moves.size();
+	if(n > KIN_LANES) return MoveResult { MoveStatus::INVALID, 0 };
+	if(n == 0) return MoveResult { MoveStatus::OK, 0 };
+
+	// pack the requested positions into leg coordinates
+	uint32_t seen = 0;
+	for (int i = 0; i < n; ++i) {
+		int l;
+		float dx, dy, dz, x, y, z;
+		std::tie(l, dx, dy, dz) = moves[i];
+		// a leg twice would be solved from the same start and only its last move written
+		if(l < 0 || l >= (int)legs.size() || (seen & (1U << l))) return MoveResult { MoveStatus::INVALID, 0 };
+		seen |= 1U << l;
+		if(relative) {
+			std::tie(x, y, z) = legs[l].getPosition();
+			px[i] = x + dx * slice;
+			py[i] = y + dy * slice;
+			pz[i] = z + dz * slice;
+		}else{
+			px[i] = dx; py[i] = dy; pz[i] = dz;
+		}
+
+		x = px[i]; y = py[i]; z = pz[i];
+		if(posed) toPosed(l, x, y, z);
+		legs[l].toLegFrame(x, y);
+		t.x[i] = x; t.y[i] = y; t.z[i] = z;
+		idx[i] = l;
+	}
+
+	MoveResult res { MoveStatus::OK, 0 };
+	uint32_t ok = solve(t, a, idx, n);
+	if(ok != (1U << n) - 1) {
+		for (int i = 0; i < n; ++i) {
+			if(!(ok & (1U << i))) res.legs |= 1U << idx[i];
+		}
+		if(mode == MoveMode::STRICT) {
+			res.status = MoveStatus::OUT_OF_RANGE;
+			return res;
+		}
+
+		// clamp the failed legs and solve again, a NAN target (unknown position) can't be clamped
+		for (int i = 0; i < n; ++i) {
+			if(ok & (1U << i)) continue;
+			clampToWorkspace(t.x[i], t.y[i], t.z[i]);
+			float x = t.x[i], y = t.y[i], z = t.z[i];
+			legs[idx[i]].fromLegFrame(x, y);
+			if(posed) fromPosed(idx[i], x, y, z);
+			px[i] = x; py[i] = y; pz[i] = z;
+		}
+		if(solve(t, a, idx, n) != (1U << n) - 1) {
+			res.status = MoveStatus::OUT_OF_RANGE;
+			return res;
+		}
+		res.status = MoveStatus::CLAMPED;
+	}
+
+	// staged and committed as one frame so every leg reaches the servos at the same time
+	for (int i = 0; i < n; ++i) {
+		legs[idx[i]].setJoints(px[i], py[i], pz[i], a.hip[i], a.knee[i], a.ankle[i], true);
+	}
+	legs[idx[0]].getServo().commit();
+	return res;
+}
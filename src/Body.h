@@ -0,0 +1,77 @@
+/**
+	Body level operations on all the legs at once, so the IK for every leg is solved in one batch pass
+*/
+
+#pragma once
+
+#include "Leg.h"
+#include "kinematics.h"
+#include "IncrementalIK.h"
+#include "FixedVector.h"
+
+#include <vector>
+#include <tuple>
+#include <atomic>
+
+using Pos3 = std::tuple<int, float, float, float>;
+using Pos2 = std::tuple<int, float, float>;
+// the moves of one step, at most one per leg, held inline so building one doesn't allocate
+using MoveSet = FixedVector<Pos3, Robot::NLEGS>;
+
+// STRICT writes nothing if any leg can't reach, CLAMP pulls those legs back onto the edge of their workspace
+enum class MoveMode { STRICT, CLAMP };
+enum class MoveStatus { OK, CLAMPED, OUT_OF_RANGE, INVALID };
+
+struct MoveResult {
+	MoveStatus status;
+	uint32_t legs; // bit per leg number that could not reach its target (and was clamped in CLAMP mode)
+
+	bool ok() const { return status == MoveStatus::OK || status == MoveStatus::CLAMPED; }
+};
+
+// where the body is relative to the feet, rotations in radians about x, y, z then translation in mm
+struct BodyPose {
+	float roll, pitch, yaw;
+	float x, y, z;
+
+	bool operator==(const BodyPose& o) const { return roll == o.roll && pitch == o.pitch && yaw == o.yaw && x == o.x && y == o.y && z == o.z; }
+	bool operator!=(const BodyPose& o) const { return !(*this == o); }
+};
+
+class Body
+{
+public:
+	Body(std::vector<Leg>& legs);
+
+	// move each leg in moves by its delta * slice. the IK for every leg is solved before any servo is written,
+	// so either all the legs move or (in STRICT mode) none do. moves has at most one entry per leg, INVALID if not
+	MoveResult commit(const MoveSet& moves, float slice, MoveMode mode= MoveMode::STRICT);
+	// as commit but each entry is where the leg goes, for legs with no known position to move from
+	MoveResult place(const MoveSet& targets, MoveMode mode= MoveMode::STRICT);
+
+	// lean and shift the body over the feet, every following commit maps the feet through it.
+	// leg positions stay in the unposed frame so the gaits are unaffected by the pose
+	void setPose(const BodyPose& p);
+	const BodyPose& getPose() const { return pose; }
+
+	// step each leg from its previous solution instead of a full IK solve, see IncrementalIK
+	void setIncremental(bool on) { use_incremental= on; }
+	bool isIncremental() const { return use_incremental; }
+	const IncrementalIK::Stats& incrementalStats() const { return incremental.getStats(); }
+
+	// pull a leg coordinate target onto the nearest point the leg can reach, returns false if it was already reachable
+	static bool clampToWorkspace(float& x, float& y, float& z);
+
+private:
+	MoveResult apply(const MoveSet& moves, float slice, bool relative, MoveMode mode);
+	uint32_t solve(const LegTargets& t, LegAngles& a, const int *idx, int n);
+	void toPosed(int leg, float& x, float& y, float& z) const;
+	void fromPosed(int leg, float& x, float& y, float& z) const;
+
+	std::vector<Leg>& legs;
+	BodyPose pose;
+	float rot[3][3]; // pose rotation, built once in setPose
+	bool posed; // false for the identity pose so commit can skip it
+	IncrementalIK incremental;
+	std::atomic<bool> use_incremental;
+};
@@ -0,0 +1,31 @@
+/**
+	I2C traffic counters for the servo boards
+*/
+
+#pragma once
+
+#include <cstdint>
+
+struct BusStats {
+	uint32_t frames; // flushes that wrote something
+	uint32_t transactions;
+	uint32_t bytes; // register and data bytes, not counting the address byte and start/stop
+	// channel writes that went out and ones dropped for being the same PWM count as the chip has
+	uint32_t issued;
+	uint32_t suppressed;
+	// of the last flush
+	uint32_t last_transactions;
+	uint32_t last_bytes;
+
+	BusStats& operator+=(const BusStats& o)
+	{
+		frames += o.frames;
+		transactions += o.transactions;
+		bytes += o.bytes;
+		issued += o.issued;
+		suppressed += o.suppressed;
+		last_transactions += o.last_transactions;
+		last_bytes += o.last_bytes;
+		return *this;
+	}
+};
@@ -0,0 +1,98 @@
+#include "Calibration.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+
+constexpr float Calibration::LO;
+constexpr float Calibration::INV_STEP;
+constexpr float Calibration::LAST;
+
+Calibration::Calibration()
+{
+	memset(table, 0, sizeof(table));
+	calibrated= 0;
+}
+
+void Calibration::addPoint(uint8_t channel, float degrees, float us)
+{
+	if(channel >= MAX_CHANNELS) return;
+
+	auto& p= points[channel];
+	auto i= std::lower_bound(p.begin(), p.end(), std::make_pair(degrees, -1e9F));
+	if(i != p.end() && i->first == degrees) i->second= us;
+	else p.insert(i, std::make_pair(degrees, us));
+}
+
+float Calibration::pulseAt(uint8_t channel, float degrees) const
+{
+	const auto& p= points[channel];
+	if(p.empty()) return NAN;
+	if(p.size() == 1) return p[0].second;
+
+	// the segment degrees is in, or the end one nearest to it
+	size_t i= 1;
+	while(i < p.size() - 1 && p[i].first < degrees) ++i;
+	float f= (degrees - p[i-1].first) / (p[i].first - p[i-1].first);
+	return p[i-1].second + f * (p[i].second - p[i-1].second);
+}
+
+void Calibration::compile(float ticks_per_ms)
+{
+	calibrated= 0;
+	for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+		if(points[ch].size() < 2) continue;
+		for (int i = 0; i < NODES; ++i) {
+			float t= pulseAt(ch, i - (NODES - 1) / 2) * ticks_per_ms / 1000;
+			// the PCA9685 has 12 bits
+			t= std::min(std::max(t, 0.0F), 4095.0F);
+			table[ch][i]= lrintf(t * 65536);
+		}
+		calibrated |= 1UL << ch;
+	}
+}
+
+bool Calibration::load(const char *fn)
+{
+	FILE *fp= fopen(fn, "r");
+	if(fp == nullptr) {
+		fprintf(stderr, "Calibration: unable to open %s\n", fn);
+		return false;
+	}
+
+	char line[128];
+	int n= 0;
+	bool ok= true;
+	while(fgets(line, sizeof(line), fp) != nullptr) {
+		++n;
+		char *c= strchr(line, '#');
+		if(c != nullptr) *c= '\0';
+		int ch;
+		float deg, us;
+		int r= sscanf(line, "%d %f %f", &ch, &deg, &us);
+		if(r <= 0) continue; // blank or comment
+		if(r != 3 || ch < 0 || ch >= MAX_CHANNELS) {
+			fprintf(stderr, "Calibration: bad line %d in %s\n", n, fn);
+			ok= false;
+			break;
+		}
+		addPoint(ch, deg, us);
+	}
+	fclose(fp);
+	return ok;
+}
+
+bool Calibration::save(const char *fn) const
+{
+	FILE *fp= fopen(fn, "w");
+	if(fp == nullptr) {
+		fprintf(stderr, "Calibration: unable to write %s\n", fn);
+		return false;
+	}
+
+	fprintf(fp, "# channel joint_degrees pulse_us\n");
+	for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+		for(auto& p : points[ch]) fprintf(fp, "%d %g %g\n", ch, p.first, p.second);
+	}
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,59 @@
+/**
+	Per channel servo calibration, piecewise linear from joint angle to pulse width as measured on the robot.
+	The points are loaded from a text file (written by the -U capture tool) and compiled into a table of PCA9685
+	PWM ticks on a 1° grid, so turning a joint angle into ticks is a fixed point table lookup with no servo type,
+	trim or reverse in it.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+class Calibration
+{
+public:
+	static const int MAX_CHANNELS = 32;
+
+	Calibration();
+
+	// lines of "channel joint_degrees pulse_us", # starts a comment. joint degrees are the joint angle Leg uses
+	// (0 is the servo centered) in degrees
+	bool load(const char *fn);
+	bool save(const char *fn) const;
+
+	// add a measured point, replacing one at the same angle
+	void addPoint(uint8_t channel, float degrees, float us);
+	void clear(uint8_t channel) { points[channel].clear(); }
+	int numPoints(uint8_t channel) const { return points[channel].size(); }
+	// pulse width in us the points give for a joint angle, extrapolated from the end segments
+	float pulseAt(uint8_t channel, float degrees) const;
+
+	// build the tick tables for a PWM running at ticks_per_ms, channels with at least two points are calibrated
+	void compile(float ticks_per_ms);
+	bool isCalibrated(uint8_t channel) const { return calibrated & (1UL << channel); }
+	uint32_t calibratedMask() const { return calibrated; }
+
+	// PWM ticks for a joint angle in radians on a calibrated channel
+	uint16_t ticks(uint8_t channel, float rads) const
+	{
+		// grid position in 16.16 fixed point, the only float to int conversion. NAN clamps to the first node
+		float u = std::min(LAST, std::max(0.0F, (rads - LO) * INV_STEP));
+		int32_t q = u * 65536.0F;
+		const int32_t *n = &table[channel][q >> 16];
+		int32_t t = n[0] + (int32_t)(((int64_t)(n[1] - n[0]) * (q & 0xFFFF)) >> 16);
+		return (t + 0x8000) >> 16;
+	}
+
+private:
+	static const int NODES = 241; // -120° to 120° a degree apart
+	static constexpr float LO = -120 * 0.017453292519943295F;
+	static constexpr float INV_STEP = 57.295779513082323F;
+	static constexpr float LAST = NODES - 1 - 1.0F / 1024; // keeps the last node pair in the table
+
+	std::vector<std::pair<float, float>> points[MAX_CHANNELS]; // degrees, us sorted by degrees
+	int32_t table[MAX_CHANNELS][NODES]; // ticks in 16.16 fixed point
+	uint32_t calibrated;
+};
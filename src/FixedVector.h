@@ -0,0 +1,48 @@
+/**
+	A vector with its capacity fixed at compile time and the elements held inline, so one on the stack or inside a
+	lambda's captures never touches the heap. Used for the per leg move sets of the gaits, which have at most one
+	entry per leg.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+
+template <typename T, size_t N>
+class FixedVector
+{
+public:
+	FixedVector() : n(0) {}
+	FixedVector(std::initializer_list<T> l) : n(0)
+	{
+		for(const T& v : l) push_back(v);
+	}
+
+	void push_back(const T& v)
+	{
+		if(n >= N) throw std::length_error("FixedVector is full");
+		items[n++]= v;
+	}
+	void clear() { n= 0; }
+
+	size_t size() const { return n; }
+	bool empty() const { return n == 0; }
+	bool full() const { return n == N; }
+	static constexpr size_t capacity() { return N; }
+
+	T& operator[](size_t i) { return items[i]; }
+	const T& operator[](size_t i) const { return items[i]; }
+	T& back() { return items[n - 1]; }
+	const T& back() const { return items[n - 1]; }
+
+	T *begin() { return items; }
+	T *end() { return items + n; }
+	const T *begin() const { return items; }
+	const T *end() const { return items + n; }
+
+private:
+	T items[N];
+	size_t n;
+};
@@ -0,0 +1,204 @@
+#include "I2C.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include <mraa/i2c.h>
+
+// the hardware, the address is set before each transaction as the boards on the bus share the context
+class MraaI2C : public I2C
+{
+public:
+	MraaI2C(int bus) : I2C(bus) { context= mraa_i2c_init(bus); }
+	~MraaI2C() { if(context != nullptr) mraa_i2c_stop(context); }
+
+	bool write(uint8_t address, const uint8_t *data, int n)
+	{
+		mraa_i2c_address(context, address);
+		return mraa_i2c_write(context, data, n) == MRAA_SUCCESS;
+	}
+
+	int readByte(uint8_t address, uint8_t reg)
+	{
+		mraa_i2c_address(context, address);
+		return mraa_i2c_read_byte_data(context, reg);
+	}
+
+private:
+	mraa_i2c_context context;
+};
+
+uint32_t I2C::sim_hz= 0;
+bool SimI2C::realtime= true;
+bool SimI2C::recording= false;
+static int64_t sim_start= 0; // the records of every bus are timed from here
+
+static int64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// every backend opened, they live as long as the program
+static std::vector<I2C*>& opened()
+{
+	static std::vector<I2C*> v;
+	return v;
+}
+
+static std::vector<SimI2C*>& sims()
+{
+	static std::vector<SimI2C*> v;
+	return v;
+}
+
+const std::vector<SimI2C*>& SimI2C::all()
+{
+	return sims();
+}
+
+I2C *I2C::open(int bus)
+{
+	static std::mutex m;
+	std::lock_guard<std::mutex> l(m);
+	for(auto i : opened()) {
+		SimI2C *s= dynamic_cast<SimI2C*>(i);
+		if(i->getBus() == bus && (s != nullptr ? s->getHz() : 0) == sim_hz) return i;
+	}
+
+	I2C *i= nullptr;
+	if(sim_hz != 0) {
+		SimI2C *s= new SimI2C(bus, sim_hz);
+		sims().push_back(s);
+		i= s;
+	}else{
+		static bool init= false;
+		if(!init) {
+			mraa_init();
+			init= true;
+		}
+		i= new MraaI2C(bus);
+	}
+	opened().push_back(i);
+	return i;
+}
+
+void I2C::simulate(uint32_t hz)
+{
+	sim_hz= hz;
+	if(sim_start == 0) sim_start= nowNs();
+}
+
+void I2C::tick()
+{
+	if(sim_hz == 0) return;
+	for(auto s : SimI2C::all()) s->endTick();
+}
+
+SimI2C::SimI2C(int bus, uint32_t hz) : I2C(bus), record(recording), hz(hz)
+{
+	// a gait of a few minutes without growing
+	if(record) records.reserve(1 << 16);
+	memset(regs, 0, sizeof(regs));
+	busy_until= last_tick= 0;
+	tick_busy_ns= 0;
+	clearStats();
+}
+
+// the bus is busy for bits after it was last free, which is how long the caller is kept waiting
+int64_t SimI2C::transaction(uint8_t address, uint8_t reg, int bits, int bytes)
+{
+	int64_t now= nowNs();
+	int64_t wire= (int64_t)bits * 1000000000 / hz;
+	int64_t t= std::max(now, busy_until);
+	busy_until= t + wire;
+	tick_busy_ns += wire;
+
+	++stats.transactions;
+	stats.bytes += bytes;
+	if(record) records.push_back(Record { (uint64_t)((t - sim_start) / 1000), address, reg, (uint8_t)bytes, (uint16_t)(wire / 1000) });
+	return busy_until;
+}
+
+bool SimI2C::write(uint8_t address, const uint8_t *data, int n)
+{
+	if(n < 1 || address > 127) return false;
+
+	int64_t done;
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		// the register pointer only moves on through a write when the AI bit of the PCA9685's MODE1 is set,
+		// without it every byte lands in the first register
+		bool ai= (regs[address][0] & 0x20) != 0;
+		for (int i = 1; i < n; ++i) regs[address][(uint8_t)(data[0] + (ai ? i - 1 : 0))]= data[i];
+		done= transaction(address, data[0], writeBits(n), n);
+	}
+	if(realtime) std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(done)));
+	return true;
+}
+
+int SimI2C::readByte(uint8_t address, uint8_t reg)
+{
+	if(address > 127) return -1;
+
+	int64_t done;
+	int v;
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		v= regs[address][reg];
+		done= transaction(address, reg, readBits(), 0);
+	}
+	if(realtime) std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(done)));
+	return v;
+}
+
+void SimI2C::endTick()
+{
+	std::lock_guard<std::mutex> l(mutex);
+	int64_t now= nowNs();
+	if(last_tick != 0 && now > last_tick) {
+		float busy= tick_busy_ns / 1000.0F;
+		float occupancy= (float)tick_busy_ns / (now - last_tick);
+		++stats.ticks;
+		busy_sum += busy;
+		occupancy_sum += occupancy;
+		if(busy > stats.busy_max_us) stats.busy_max_us= busy;
+		if(occupancy > stats.occupancy_max) stats.occupancy_max= occupancy;
+		stats.busy_mean_us= busy_sum / stats.ticks;
+		stats.occupancy_mean= occupancy_sum / stats.ticks;
+	}
+	// setting up the boards before the first tick is not counted
+	tick_busy_ns= 0;
+	last_tick= now;
+}
+
+SimI2C::Stats SimI2C::getStats() const
+{
+	std::lock_guard<std::mutex> l(mutex);
+	return stats;
+}
+
+void SimI2C::clearStats()
+{
+	std::lock_guard<std::mutex> l(mutex);
+	stats= Stats();
+	busy_sum= occupancy_sum= 0;
+}
+
+bool SimI2C::save(const char *fn)
+{
+	FILE *fp= fopen(fn, "w");
+	if(fp == nullptr) {
+		fprintf(stderr, "SimI2C: unable to write %s\n", fn);
+		return false;
+	}
+
+	fprintf(fp, "# t_us bus address register bytes wire_us, bytes is 0 for a read\n");
+	for(auto s : sims()) {
+		std::lock_guard<std::mutex> l(s->mutex);
+		for(auto& r : s->records) fprintf(fp, "%llu %d 0x%02X 0x%02X %u %u\n", (unsigned long long)r.t_us, s->getBus(), r.address, r.reg, r.bytes, r.wire_us);
+	}
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,100 @@
+/**
+	I2C bus backends for the servo boards.
+	Every board on a bus shares one backend, which is either the hardware through mraa or a simulation that keeps
+	the registers of the devices on it, can record every transaction and takes as long as the transaction would on
+	the wire at the bus speed. The simulation is how the bus load of a gait is found without the robot, the bus
+	time of each control tick (marked with tick()) gives its occupancy and the fastest rate it could keep up.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+class I2C
+{
+public:
+	I2C(int bus) : bus(bus) {}
+	virtual ~I2C() {}
+
+	I2C(const I2C&) = delete;
+	I2C& operator=(const I2C&) = delete;
+
+	// a write of n bytes to the device at address, the first is the register
+	virtual bool write(uint8_t address, const uint8_t *data, int n) = 0;
+	// read a register, negative on failure
+	virtual int readByte(uint8_t address, uint8_t reg) = 0;
+	int getBus() const { return bus; }
+
+	// the backend for bus, shared by every board on it. the hardware unless simulate() was called first
+	static I2C *open(int bus);
+	// simulate the buses opened from now on at hz, 0 goes back to the hardware
+	static void simulate(uint32_t hz);
+	static uint32_t simulating() { return sim_hz; }
+	// the end of a control tick, for the simulated per tick bus time
+	static void tick();
+
+private:
+	int bus;
+	static uint32_t sim_hz;
+};
+
+class SimI2C : public I2C
+{
+public:
+	SimI2C(int bus, uint32_t hz);
+
+	bool write(uint8_t address, const uint8_t *data, int n);
+	int readByte(uint8_t address, uint8_t reg);
+
+	// the time on the wire of a transaction, in bits at the bus speed
+	static int writeBits(int n) { return 1 + 9 * (n + 1) + 1; } // start, address, data, stop
+	static int readBits() { return 1 + 9 * 2 + 1 + 9 * 2 + 1; } // register then a repeated start to read it
+	uint32_t getHz() const { return hz; }
+	// without realtime the transactions don't wait for the wire, for working out bus loads faster than real time
+	static void setRealtime(bool on) { realtime= on; }
+
+	struct Record {
+		uint64_t t_us; // from the first transaction
+		uint8_t address;
+		uint8_t reg;
+		uint8_t bytes; // 0 for a read
+		uint16_t wire_us;
+	};
+	// keep a Record of every transaction of the buses opened from now on, off unless they are to be saved as
+	// the list grows for as long as the program runs
+	static void setRecording(bool on) { recording= on; }
+	const std::vector<Record>& getRecords() const { return records; }
+	// the records of every simulated bus as lines of "t_us bus address register bytes wire_us"
+	static bool save(const char *fn);
+
+	struct Stats {
+		uint32_t transactions;
+		uint64_t bytes;
+		uint32_t ticks;
+		float busy_mean_us, busy_max_us; // bus time per tick
+		float occupancy_mean, occupancy_max; // of the time between ticks
+	};
+	Stats getStats() const;
+	void clearStats();
+
+	// every simulated bus opened so far
+	static const std::vector<SimI2C*>& all();
+	void endTick();
+
+private:
+	int64_t transaction(uint8_t address, uint8_t reg, int bits, int bytes);
+
+	static bool realtime;
+	static bool recording;
+	bool record;
+	mutable std::mutex mutex;
+	uint32_t hz;
+	uint8_t regs[128][256]; // per 7 bit address
+	int64_t busy_until, last_tick;
+	int64_t tick_busy_ns;
+	double busy_sum, occupancy_sum;
+	std::vector<Record> records;
+	Stats stats;
+};
@@ -0,0 +1,208 @@
+#include "IKTable.h"
+#include "Leg.h"
+#include "fastmath.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+
+// written at the start of the cache file, the table is only reused if all of it matches
+struct IKTableHeader {
+	char magic[4];
+	uint32_t version;
+	float coxa, femur, tibia;
+	float spacing, max_error;
+	int32_t dim[3];
+	int32_t math_tier; // the scalar IK the nodes were solved with
+};
+
+IKTable::IKTable()
+{
+	spacing= inv_spacing= max_error= 0;
+	lo[0]= lo[1]= lo[2]= 0;
+	dim[0]= dim[1]= dim[2]= 0;
+}
+
+// the grid covers the front half of the legs reach, which is everything the leg can get to without the hip flipping
+void IKTable::setBounds(float spacing, float max_error)
+{
+	const float reach= Robot::COXA + Robot::FEMUR + Robot::TIBIA;
+	this->spacing= spacing;
+	this->inv_spacing= 1.0F / spacing;
+	this->max_error= max_error;
+	lo[0]= 0;
+	lo[1]= -reach;
+	lo[2]= -(Robot::FEMUR + Robot::TIBIA);
+	dim[0]= ceilf(reach / spacing) + 1;
+	dim[1]= ceilf(2 * reach / spacing) + 1;
+	dim[2]= ceilf(2 * (Robot::FEMUR + Robot::TIBIA) / spacing) + 1;
+}
+
+void IKTable::interpolate(int ix, int iy, int iz, float fx, float fy, float fz, Node& r) const
+{
+	const Node *n[8]= {
+		&nodes[nodeIndex(ix,   iy,   iz)], &nodes[nodeIndex(ix,   iy,   iz+1)],
+		&nodes[nodeIndex(ix,   iy+1, iz)], &nodes[nodeIndex(ix,   iy+1, iz+1)],
+		&nodes[nodeIndex(ix+1, iy,   iz)], &nodes[nodeIndex(ix+1, iy,   iz+1)],
+		&nodes[nodeIndex(ix+1, iy+1, iz)], &nodes[nodeIndex(ix+1, iy+1, iz+1)]
+	};
+	float w[8]= {
+		(1-fx)*(1-fy)*(1-fz), (1-fx)*(1-fy)*fz, (1-fx)*fy*(1-fz), (1-fx)*fy*fz,
+		fx*(1-fy)*(1-fz),     fx*(1-fy)*fz,     fx*fy*(1-fz),     fx*fy*fz
+	};
+	r.hip= r.knee= r.ankle= 0;
+	for (int i = 0; i < 8; ++i) {
+		r.hip += n[i]->hip * w[i];
+		r.knee += n[i]->knee * w[i];
+		r.ankle += n[i]->ankle * w[i];
+	}
+}
+
+void IKTable::build(float spacing, float max_error)
+{
+	setBounds(spacing, max_error);
+
+	nodes.resize(dim[0] * dim[1] * dim[2]);
+	for (int ix = 0; ix < dim[0]; ++ix) {
+		for (int iy = 0; iy < dim[1]; ++iy) {
+			for (int iz = 0; iz < dim[2]; ++iz) {
+				Node& n= nodes[nodeIndex(ix, iy, iz)];
+				std::tie(n.hip, n.knee, n.ankle)= Leg::inverseKinematics(lo[0] + ix * spacing, lo[1] + iy * spacing, lo[2] + iz * spacing);
+			}
+		}
+	}
+
+	// a cell is usable if all its corners are reachable and the interpolation is within max_error at the center, the
+	// center of each face and each edge, and halfway from the center to each corner. The corners themselves are nodes
+	// so they are exact, the error peaks between them
+	float probes[27][3];
+	int nprobes= 0;
+	for (int i = 0; i < 27; ++i) {
+		int px= i % 3, py= i / 3 % 3, pz= i / 9;
+		if(px != 1 && py != 1 && pz != 1) continue;
+		probes[nprobes][0]= px * 0.5F;
+		probes[nprobes][1]= py * 0.5F;
+		probes[nprobes][2]= pz * 0.5F;
+		++nprobes;
+	}
+	for (int i = 0; i < 8; ++i) {
+		probes[nprobes][0]= i & 1 ? 0.75F : 0.25F;
+		probes[nprobes][1]= i & 2 ? 0.75F : 0.25F;
+		probes[nprobes][2]= i & 4 ? 0.75F : 0.25F;
+		++nprobes;
+	}
+	int ncells= (dim[0] - 1) * (dim[1] - 1) * (dim[2] - 1);
+	valid.assign((ncells + 7) / 8, 0);
+	for (int ix = 0; ix < dim[0] - 1; ++ix) {
+		for (int iy = 0; iy < dim[1] - 1; ++iy) {
+			for (int iz = 0; iz < dim[2] - 1; ++iz) {
+				bool ok= true;
+				for (int p = 0; p < nprobes && ok; ++p) {
+					Node r;
+					interpolate(ix, iy, iz, probes[p][0], probes[p][1], probes[p][2], r);
+					float h, k, a;
+					std::tie(h, k, a)= Leg::inverseKinematics(lo[0] + (ix + probes[p][0]) * spacing, lo[1] + (iy + probes[p][1]) * spacing, lo[2] + (iz + probes[p][2]) * spacing);
+					// NAN anywhere fails the compare so unreachable cells are never valid
+					ok= std::abs(h - r.hip) <= max_error && std::abs(k - r.knee) <= max_error && std::abs(a - r.ankle) <= max_error;
+				}
+				if(ok) {
+					int c= cellIndex(ix, iy, iz);
+					valid[c >> 3] |= 1 << (c & 7);
+				}
+			}
+		}
+	}
+}
+
+bool IKTable::solve(float x, float y, float z, float& hip, float& knee, float& ankle) const
+{
+	float gx= (x - lo[0]) * inv_spacing;
+	float gy= (y - lo[1]) * inv_spacing;
+	float gz= (z - lo[2]) * inv_spacing;
+	// written so a NAN (a leg with no known position) or infinity fails too, before it is converted to an index
+	if(!(gx >= 0 && gx < dim[0] - 1 && gy >= 0 && gy < dim[1] - 1 && gz >= 0 && gz < dim[2] - 1)) return false;
+
+	int ix= gx, iy= gy, iz= gz;
+	if(!cellValid(cellIndex(ix, iy, iz))) return false;
+
+	Node r;
+	interpolate(ix, iy, iz, gx - ix, gy - iy, gz - iz, r);
+	hip= r.hip;
+	knee= r.knee;
+	ankle= r.ankle;
+	return true;
+}
+
+float IKTable::coverage() const
+{
+	int ncells= (dim[0] - 1) * (dim[1] - 1) * (dim[2] - 1);
+	if(ncells <= 0) return 0;
+	int n= 0;
+	for(uint8_t b : valid) n += __builtin_popcount(b);
+	return (float)n / ncells;
+}
+
+static void makeHeader(IKTableHeader& h, float spacing, float max_error, const int dim[3])
+{
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "HXIK", 4);
+	h.version= 2;
+	h.coxa= Robot::COXA;
+	h.femur= Robot::FEMUR;
+	h.tibia= Robot::TIBIA;
+	h.spacing= spacing;
+	h.max_error= max_error;
+	for (int i = 0; i < 3; ++i) h.dim[i]= dim[i];
+	h.math_tier= MATH_TIER;
+}
+
+bool IKTable::save(const char *fn) const
+{
+	FILE *fp= fopen(fn, "wb");
+	if(fp == nullptr) {
+		fprintf(stderr, "IKTable: unable to write %s\n", fn);
+		return false;
+	}
+
+	IKTableHeader h;
+	makeHeader(h, spacing, max_error, dim);
+	bool ok= fwrite(&h, sizeof(h), 1, fp) == 1 &&
+		fwrite(nodes.data(), sizeof(Node), nodes.size(), fp) == nodes.size() &&
+		fwrite(valid.data(), 1, valid.size(), fp) == valid.size();
+	fclose(fp);
+	return ok;
+}
+
+bool IKTable::load(const char *fn, float spacing, float max_error)
+{
+	FILE *fp= fopen(fn, "rb");
+	if(fp == nullptr) return false;
+
+	setBounds(spacing, max_error);
+	IKTableHeader expected, h;
+	makeHeader(expected, spacing, max_error, dim);
+	if(fread(&h, sizeof(h), 1, fp) != 1 || memcmp(&h, &expected, sizeof(h)) != 0) {
+		// stale cache, different geometry, settings or math tier
+		fclose(fp);
+		return false;
+	}
+
+	int ncells= (dim[0] - 1) * (dim[1] - 1) * (dim[2] - 1);
+	nodes.resize(dim[0] * dim[1] * dim[2]);
+	valid.resize((ncells + 7) / 8);
+	bool ok= fread(nodes.data(), sizeof(Node), nodes.size(), fp) == nodes.size() &&
+		fread(valid.data(), 1, valid.size(), fp) == valid.size();
+	fclose(fp);
+
+	if(!ok) nodes.clear();
+	return ok;
+}
+
+bool IKTable::init(const char *cache, float spacing, float max_error)
+{
+	if(cache != nullptr && load(cache, spacing, max_error)) return true;
+
+	build(spacing, max_error);
+	if(cache != nullptr) save(cache);
+	return true;
+}
@@ -0,0 +1,53 @@
+/**
+	IK lookup table, a dense 3D grid of joint angles over the legs workspace in leg coordinates
+	solved with trilinear interpolation instead of acos/atan2.
+	A cell is only used if its interpolation error is within max_error, otherwise solve() returns false
+	and the caller falls back to the analytic Leg::inverseKinematics.
+	It only stands in for the scalar IK of single leg moves, Body::commit solves all the legs in one batch pass, which
+	is faster than a lookup per leg. Whether it beats the scalar IK depends on the CPU, see -K iktable.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class IKTable
+{
+public:
+	IKTable();
+
+	// build the table with nodes every spacing mm, cells whose interpolation error exceeds max_error radians are not used
+	void build(float spacing, float max_error);
+	// load from the cache file if it was built with the same geometry and settings, otherwise build and save it
+	bool init(const char *cache, float spacing, float max_error);
+	bool load(const char *fn, float spacing, float max_error);
+	bool save(const char *fn) const;
+
+	// interpolated IK for leg coordinates, returns false if x, y, z is not in a usable cell
+	bool solve(float x, float y, float z, float& hip, float& knee, float& ankle) const;
+
+	bool isBuilt() const { return !nodes.empty(); }
+	// fraction of the cells that are usable
+	float coverage() const;
+	float maxError() const { return max_error; }
+	float getSpacing() const { return spacing; }
+
+private:
+	struct Node {
+		float hip, knee, ankle;
+	};
+
+	int nodeIndex(int ix, int iy, int iz) const { return (ix * dim[1] + iy) * dim[2] + iz; }
+	int cellIndex(int ix, int iy, int iz) const { return (ix * (dim[1] - 1) + iy) * (dim[2] - 1) + iz; }
+	bool cellValid(int c) const { return valid[c >> 3] & (1 << (c & 7)); }
+	void interpolate(int ix, int iy, int iz, float fx, float fy, float fz, Node& r) const;
+	void setBounds(float spacing, float max_error);
+
+	std::vector<Node> nodes;
+	std::vector<uint8_t> valid; // one bit per cell
+	float lo[3];
+	float spacing, inv_spacing;
+	float max_error;
+	int dim[3];
+};
@@ -0,0 +1,204 @@
+#include "IncrementalIK.h"
+#include "fastmath.h"
+#include "simd.h"
+
+#include <cmath>
+#include <string.h>
+
+IncrementalIK::IncrementalIK(float max_step, float tolerance, int max_ticks) : max_step(max_step), tolerance(tolerance), max_ticks(max_ticks)
+{
+	reset();
+	clearStats();
+}
+
+void IncrementalIK::reset()
+{
+	// zeroed rather than just invalid so the unused lanes are stepped with finite numbers
+	memset(&lanes, 0, sizeof(lanes));
+	memset(ticks, 0, sizeof(ticks));
+	valid= 0;
+}
+
+void IncrementalIK::seed(int leg, float x, float y, float z, float h, float k, float a)
+{
+	valid |= 1U << leg;
+	ticks[leg]= 0;
+	lanes.h[leg]= h; lanes.k[leg]= k; lanes.a[leg]= a;
+	lanes.ch[leg]= FMath::cos(h); lanes.sh[leg]= FMath::sin(h);
+	lanes.ck[leg]= FMath::cos(k); lanes.sk[leg]= FMath::sin(k);
+	lanes.cka[leg]= FMath::cos(k + a); lanes.ska[leg]= FMath::sin(k + a);
+	lanes.tx[leg]= x; lanes.ty[leg]= y; lanes.tz[leg]= z;
+}
+
+void IncrementalIK::copyLane(Lanes& to, int i, const Lanes& from, int j)
+{
+	to.h[i]= from.h[j]; to.k[i]= from.k[j]; to.a[i]= from.a[j];
+	to.ch[i]= from.ch[j]; to.sh[i]= from.sh[j]; to.ck[i]= from.ck[j]; to.sk[i]= from.sk[j];
+	to.cka[i]= from.cka[j]; to.ska[i]= from.ska[j];
+	to.tx[i]= from.tx[j]; to.ty[i]= from.ty[j]; to.tz[i]= from.tz[j];
+}
+
+// rotate a cached sin/cos by a small angle, the series is good to a few 1e-6 for the longest steps max_step allows,
+// and max_ticks has the leg solved exactly again before that adds up
+static inline void rotate(vfloat& c, vfloat& s, vfloat d, vmask m)
+{
+	vfloat d2= d * d;
+	vfloat cd= vset1(1) - d2 * (vset1(0.5F) - d2 * vset1(1.0F / 24));
+	vfloat sd= d * (vset1(1) - d2 * vset1(1.0F / 6));
+	vfloat nc= c * cd - s * sd;
+	vfloat ns= s * cd + c * sd;
+	c= vselect(m, nc, c);
+	s= vselect(m, ns, s);
+}
+
+// a newton step from the previous solutions for the lanes where use is non zero, other lanes are left as they are.
+// the FK of the previous solution is what the step starts from, and it also tells how far that solution was from the
+// target it was stepped to, so every output is checked one tick later. a step too long for one newton step to land
+// within tolerance gets a second from where the first ended up.
+// returns the mask of lanes that were stepped, far, reach and drift get the lanes that fell back and why
+uint32_t IncrementalIK::step(Lanes& l, const LegTargets& t, const float *use, int n, uint32_t& far, uint32_t& reach, uint32_t& drift) const
+{
+	const vfloat zero= vset1(0);
+	const vfloat femur= vset1(Robot::FEMUR), tibia= vset1(Robot::TIBIA), coxa= vset1(Robot::COXA);
+	const vfloat tol2= vset1(tolerance * tolerance), max2= vset1(max_step * max_step);
+	const vfloat max_reach2= vset1((Robot::FEMUR + Robot::TIBIA) * (Robot::FEMUR + Robot::TIBIA));
+	const vfloat min_reach2= vset1((Robot::TIBIA - Robot::FEMUR) * (Robot::TIBIA - Robot::FEMUR));
+	const vfloat min_det= vset1(1.0F);
+	const vfloat once2= vset1(tolerance * 2 * Robot::FEMUR);
+
+	uint32_t ok= 0;
+	far= reach= drift= 0;
+	for (int i = 0; i < n; i += SIMD_WIDTH) {
+		vfloat x= vload(&t.x[i]), y= vload(&t.y[i]), z= vload(&t.z[i]);
+		vfloat h= vload(&l.h[i]), k= vload(&l.k[i]), a= vload(&l.a[i]);
+		vfloat ch= vload(&l.ch[i]), sh= vload(&l.sh[i]), ck= vload(&l.ck[i]), sk= vload(&l.sk[i]);
+		vfloat cka= vload(&l.cka[i]), ska= vload(&l.ska[i]);
+		vmask used= vgt(vload(&use[i]), zero);
+
+		// the same FK as Leg::forwardKinematics but from the cached sin/cos
+		vfloat r= femur * ck + tibia * ska + coxa;
+		vfloat fx= r * ch, fy= r * sh, fz= femur * sk - tibia * cka;
+		vfloat px= vload(&l.tx[i]) - fx, py= vload(&l.ty[i]) - fy, pz= vload(&l.tz[i]) - fz;
+		vfloat ex= x - fx, ey= y - fy, ez= z - fz;
+		vfloat e2= ex * ex + ey * ey + ez * ez, p2= px * px + py * py + pz * pz;
+		vmask near= vle(e2, max2);
+		vmask settled= vle(p2, tol2);
+
+		// the same reach test as batchInverseKinematics, newton would just end up with the leg straight
+		vfloat f= vsqrt(x * x + y * y) - coxa;
+		vfloat d2= f * f + z * z;
+		vmask reachable= vand(vle(d2, max_reach2), vge(d2, min_reach2));
+
+		vmask m= vand(vand(used, near), vand(settled, reachable));
+		for (int it = 0; ; ++it) {
+			// the knee and ankle move the foot in the plane of the leg, det is -femur * tibia * cos(ankle)
+			vfloat drk= tibia * cka - femur * sk, dra= tibia * cka;
+			vfloat dzk= femur * ck + tibia * ska, dza= tibia * ska;
+			vfloat det= drk * dza - dra * dzk;
+			m= vand(m, vge(vabs(det), min_det));
+
+			// the hip turns the foot about z
+			vfloat dh= (ch * ey - sh * ex) / r;
+			vfloat dr= ch * ex + sh * ey;
+			vfloat idet= vset1(1) / det;
+			vfloat dk= (dr * dza - dra * ez) * idet;
+			vfloat da= (drk * ez - dr * dzk) * idet;
+			h= vselect(m, h + dh, h);
+			k= vselect(m, k + dk, k);
+			a= vselect(m, a + da, a);
+			rotate(ch, sh, dh, m);
+			rotate(ck, sk, dk, m);
+			rotate(cka, ska, dk + da, m);
+
+			// a step of e mm leaves about e * e / (2 * femur) mm, the second step is only needed for the longer ones
+			if(it > 0 || vmovemask(vand(m, vgt(e2, once2))) == 0) break;
+			r= femur * ck + tibia * ska + coxa;
+			ex= x - r * ch;
+			ey= y - r * sh;
+			ez= z - (femur * sk - tibia * cka);
+		}
+
+		ok |= vmovemask(m) << i;
+		far |= vmovemask(vgt(e2, max2)) << i;
+		reach |= (vmovemask(reachable) ^ ((1U << SIMD_WIDTH) - 1)) << i;
+		drift |= vmovemask(vgt(p2, tol2)) << i;
+		vstore(&l.h[i], h); vstore(&l.k[i], k); vstore(&l.a[i], a);
+		vstore(&l.ch[i], ch); vstore(&l.sh[i], sh); vstore(&l.ck[i], ck); vstore(&l.sk[i], sk);
+		vstore(&l.cka[i], cka); vstore(&l.ska[i], ska);
+		vstore(&l.tx[i], vselect(m, x, vload(&l.tx[i])));
+		vstore(&l.ty[i], vselect(m, y, vload(&l.ty[i])));
+		vstore(&l.tz[i], vselect(m, z, vload(&l.tz[i])));
+	}
+	return ok;
+}
+
+uint32_t IncrementalIK::solve(const LegTargets& t, LegAngles& a, const int *idx, int n)
+{
+	// legs with a recent enough solution are stepped, the rest go straight to the analytic IK
+	float use[KIN_LANES]= {0};
+	uint32_t usable= 0;
+	bool in_place= true;
+	for (int i = 0; i < n; ++i) {
+		int leg= idx[i];
+		in_place= in_place && leg == i;
+		++stats.solves;
+		if(!(valid & (1U << leg))) {
+			++stats.cold;
+		} else if(++ticks[leg] > max_ticks) {
+			// the cached sin/cos slowly drift from the angles, start again from an exact solve
+			++stats.aged;
+			valid &= ~(1U << leg);
+		} else {
+			usable |= 1U << i;
+			use[i]= 1;
+		}
+	}
+
+	uint32_t ok= 0, far= 0, reach= 0, drift= 0;
+	if(usable) {
+		if(in_place) {
+			ok= step(lanes, t, use, n, far, reach, drift);
+		} else {
+			// a subset of the legs or out of order, gather them into lanes and back
+			Lanes l;
+			memset(&l, 0, sizeof(l));
+			for (int i = 0; i < n; ++i) copyLane(l, i, lanes, idx[i]);
+			ok= step(l, t, use, n, far, reach, drift);
+			for (int i = 0; i < n; ++i) {
+				if(ok & (1U << i)) copyLane(lanes, idx[i], l, i);
+			}
+		}
+	}
+
+	for (int i = 0; i < n; ++i) {
+		int leg= idx[i];
+		if(ok & (1U << i)) {
+			a.hip[i]= lanes.h[leg];
+			a.knee[i]= lanes.k[leg];
+			a.ankle[i]= lanes.a[leg];
+			++stats.incremental;
+		} else if(usable & (1U << i)) {
+			if(far & (1U << i)) ++stats.step;
+			else if(reach & (1U << i)) ++stats.reach;
+			else if(drift & (1U << i)) ++stats.drift;
+			else ++stats.singular;
+			valid &= ~(1U << leg);
+		}
+	}
+
+	if(ok != (1U << n) - 1) {
+		LegAngles b;
+		uint32_t bok= batchInverseKinematics(t, b, n);
+		for (int i = 0; i < n; ++i) {
+			if(ok & (1U << i)) continue;
+			a.hip[i]= b.hip[i];
+			a.knee[i]= b.knee[i];
+			a.ankle[i]= b.ankle[i];
+			if(bok & (1U << i)) {
+				seed(idx[i], t.x[i], t.y[i], t.z[i], b.hip[i], b.knee[i], b.ankle[i]);
+				ok |= 1U << i;
+			}
+		}
+	}
+	return ok;
+}
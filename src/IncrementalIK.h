@@ -0,0 +1,67 @@
+/**
+	Incremental IK for the small per tick steps of interpolated moves.
+	Each leg keeps its last solution and the sin/cos of its joints, a new target is reached with one or two
+	Jacobian (Newton) steps from there instead of the acos/atan2 of the analytic IK, all legs at once with SIMD.
+	Each step starts from the FK of the previous solution, so error does not build up over a move, and that FK
+	also checks the previous step landed within tolerance of its target. A leg falls back to the analytic IK when
+	its target jumps further than max_step, is out of its reach or the previous step missed.
+*/
+
+#pragma once
+
+#include "kinematics.h"
+#include "Robot.h"
+
+#include <cstdint>
+
+class IncrementalIK
+{
+public:
+	// how often the incremental step was used and why it fell back
+	struct Stats {
+		uint32_t solves;
+		uint32_t incremental;
+		uint32_t cold; // no previous solution for the leg
+		uint32_t step; // target too far from the previous solution
+		uint32_t reach; // target out of reach of the leg
+		uint32_t drift; // the previous solution ended up further than tolerance from its target
+		uint32_t singular; // leg nearly straight
+		uint32_t aged; // too many ticks since the last exact solve
+
+		uint32_t fallbacks() const { return cold + step + reach + drift + singular + aged; }
+	};
+
+	// max_step mm from the previous solution, tolerance mm of foot position, max_ticks between exact solves
+	IncrementalIK(float max_step= 8, float tolerance= 0.02F, int max_ticks= 250);
+
+	// solve the first n legs, idx is the leg number of each lane. legs the step can't do are solved with
+	// batchInverseKinematics and become the new starting point. returns the mask of reachable lanes
+	uint32_t solve(const LegTargets& t, LegAngles& a, const int *idx, int n);
+
+	// forget the previous solutions, eg when the legs were moved some other way
+	void reset();
+
+	const Stats& getStats() const { return stats; }
+	void clearStats() { stats= Stats(); }
+
+private:
+	// previous solutions, lane i is leg i so a move of all the legs is stepped in place
+	struct Lanes {
+		float h[KIN_LANES], k[KIN_LANES], a[KIN_LANES];
+		// sin/cos of hip, knee and knee + ankle, rotated along with the angles
+		float ch[KIN_LANES], sh[KIN_LANES], ck[KIN_LANES], sk[KIN_LANES], cka[KIN_LANES], ska[KIN_LANES];
+		// the target each solution was stepped to
+		float tx[KIN_LANES], ty[KIN_LANES], tz[KIN_LANES];
+	};
+
+	uint32_t step(Lanes& l, const LegTargets& t, const float *use, int n, uint32_t& far, uint32_t& reach, uint32_t& drift) const;
+	void seed(int leg, float x, float y, float z, float h, float k, float a);
+	static void copyLane(Lanes& to, int i, const Lanes& from, int j);
+
+	Lanes lanes;
+	uint32_t valid; // bit per leg with a solution in lanes
+	int ticks[Robot::NLEGS]; // since the last exact solve
+	Stats stats;
+	float max_step, tolerance;
+	int max_ticks;
+};
@@ -30,9 +30,11 @@
 
 #include "Leg.h"
 #include "Servo.h"
+#include "IKTable.h"
+#include "kinematics.h"
 
 #include <cmath>
-#include <exception>
+#include <stdexcept>
 
 const static float PI2 = M_PI_2;
 const static float PI4 = M_PI_4;
@@ -40,77 +42,71 @@ const static float PI4 = M_PI_4;
 #define RADIANS(a) ((a) * M_PI / 180.0F)
 #define DEGREES(r) ((r) * 180.0F / M_PI)
 
-Leg::Leg(const char *name, float pos_angle, float home_angle, uint8_t joint1, uint8_t joint2, uint8_t joint3, Servo &servo) : name(name), servo(servo)
-{
-	// which servo
-	this->joint[0] = joint1;
-	this->joint[1] = joint2;
-	this->joint[2] = joint3;
-
-	// leg position on body, 0° is the front left corner
-	// this trnsformation matrix is applied to the move X, Y to generate the correct movements
-	float r= RADIANS(pos_angle);
-	mat[0][0]= cosf(r); mat[0][1]= -sinf(r);
-	mat[1][0]= sinf(r); mat[1][1]= cosf(r);
+template<class RobotT>
+std::atomic<const IKTable*> BasicLeg<RobotT>::ik_table {nullptr};
 
-	r= RADIANS(home_angle);
-	inv_mat[0][0]= cosf(r); inv_mat[0][1]= -sinf(r);
-	inv_mat[1][0]= sinf(r); inv_mat[1][1]= cosf(r);
+template<class RobotT>
+BasicLeg<RobotT>::BasicLeg(int index, BasicServo<RobotT>& servo) : index(index), mount(RobotT::legs[index]), servo(servo)
+{
 	on_ground= true;
 
-	// figure out the origin of the hip joint in robot coordinates, which is -x to right and +y up same as leg coordinates
-	origin[0]= BASE_RADIUS * cosf(RADIANS(pos_angle)); // X
-	origin[1]= BASE_RADIUS * sinf(RADIANS(pos_angle)); // Y
-
-	//home();
+	// we don't know where the leg is until it is moved
+	position= Vec3(NAN, NAN, NAN);
+	angles[0]= angles[1]= angles[2]= NAN;
 }
 
-// transform x, y to match leg position
-void  Leg::transform(const float m[2][2], float& x, float& y) const
+template<class RobotT>
+typename BasicLeg<RobotT>::Vec3 BasicLeg<RobotT>::getCoordinates(float x, float y, float z) const
 {
-	float nx= x * m[0][0] + y * m[1][0];
-	float ny= x * m[0][1] + y * m[1][1];
-	x= nx;
-	y= ny;
-}
-
-Leg::Vec3 Leg::getCoordinates(float x, float y, float z) const
-{
-	transform(inv_mat, x, y);
+	fromLegFrame(x, y);
 	return Vec3(x, y, z);
 }
 
-Leg::Vec3 Leg::getHomeCoordinates() const
+template<class RobotT>
+typename BasicLeg<RobotT>::Vec3 BasicLeg<RobotT>::getHomeCoordinates() const
 {
 	// 69, 0, -65
-	float x= COXA+FEMUR, y= 0, z= -TIBIA;
+	float x= RobotT::COXA+RobotT::FEMUR, y= 0, z= -RobotT::TIBIA;
 	return getCoordinates(x, y, z);
 }
 
 // set raw angle for each joint angle in degrees
-void Leg::setAngle(float hip, float knee, float ankle)
+template<class RobotT>
+void BasicLeg<RobotT>::setAngle(float hip, float knee, float ankle)
 {
 	float a= RADIANS(ankle)-PI2;
 	float k= RADIANS(knee)-PI2;
 	float h= RADIANS(hip)-PI2;
-	servo.move(joint[0], a);
-	servo.move(joint[1], k);
-	servo.move(joint[2], h);
 	float x, y, z;
-	std::tie(x, y, z)= Leg::forwardKinematics(a, k, h);
-	transform(inv_mat, x, y);
+	std::tie(x, y, z)= forwardKinematics(a, k, h);
+	fromLegFrame(x, y);
+	setJoints(x, y, z, h, k, a);
+}
+
+template<class RobotT>
+void BasicLeg<RobotT>::setJoint(int j, float rads)
+{
+	angles[j]= rads;
+	servo.move(mount.joint[j], rads);
+
+	// position is only known once all three joints have been set
+	float x, y, z;
+	std::tie(x, y, z)= forwardKinematics(angles[0], angles[1], angles[2]);
+	fromLegFrame(x, y);
 	position= Vec3(x, y, z);
 }
 
 // all servos will be at 90°
-void Leg::home()
+template<class RobotT>
+void BasicLeg<RobotT>::home()
 {
 	float x, y, z;
 	std::tie(x, y, z) = getHomeCoordinates();
 	move(x, y, z);
 }
 
-float Leg::solveTriangle(float a, float b, float c) const
+template<class RobotT>
+float BasicLeg<RobotT>::solveTriangle(float a, float b, float c)
 {
 	// Calculate the angle between a and b, opposite to c.
 	a = std::abs(a);
@@ -119,38 +115,45 @@ float Leg::solveTriangle(float a, float b, float c) const
 	if (a + b < c || a + c < b || b + c < a) {
 		return NAN;
 	}
-	return acosf((a * a + b * b - c * c) / (2 * a * b));
+	return FMath::acos((a * a + b * b - c * c) / (2 * a * b));
 }
 
-Leg::Vec3 Leg::forwardKinematics(float a, float k, float h) const
+// closed form FK, the inverse of inverseKinematics. takes the ankle, knee and hip angles and returns leg coordinates
+template<class RobotT>
+typename BasicLeg<RobotT>::Vec3 BasicLeg<RobotT>::forwardKinematics(float a, float k, float h)
 {
-	// TODO do FK to set the pos
-
-	return Vec3(NAN,NAN, NAN);
+	// femur is raised by the knee angle, the tibia hangs at the ankle angle relative to the femur
+	float f = RobotT::FEMUR * FMath::cos(k) + RobotT::TIBIA * FMath::sin(k + a);
+	float z = RobotT::FEMUR * FMath::sin(k) - RobotT::TIBIA * FMath::cos(k + a);
+	float r = f + RobotT::COXA;
+	return Vec3(r * FMath::cos(h), r * FMath::sin(h), z);
 }
 
-Leg::Vec3 Leg::inverseKinematics(float x, float y, float z) const
+template<class RobotT>
+typename BasicLeg<RobotT>::Vec3 BasicLeg<RobotT>::inverseKinematics(float x, float y, float z)
 {
 	// Calculate angles for knee and ankle
 	float ankle, knee, hip;
-	float f = norm(x, y) - COXA;
+	float f = norm(x, y) - RobotT::COXA;
 	float d = norm(f, z);
-	if (d > FEMUR + TIBIA) {
+	if (d > RobotT::FEMUR + RobotT::TIBIA) {
 		return std::make_tuple(NAN, NAN, NAN);
 	}
 
-	hip = atan2f(y, x);
-	knee = solveTriangle(FEMUR, d, TIBIA) - atan2f(-z, f);
-	ankle = solveTriangle(FEMUR, TIBIA, d) - PI2;
+	hip = FMath::atan2(y, x);
+	knee = solveTriangle(RobotT::FEMUR, d, RobotT::TIBIA) - FMath::atan2(-z, f);
+	ankle = solveTriangle(RobotT::FEMUR, RobotT::TIBIA, d) - PI2;
 	return Vec3(hip, knee, ankle);
 }
 
-void Leg::move(float x, float y)
+template<class RobotT>
+void BasicLeg<RobotT>::move(float x, float y)
 {
 	move(x, y, std::get<2>(position));
 }
 
-void Leg::move(float px, float py, float pz, bool raw)
+template<class RobotT>
+void BasicLeg<RobotT>::move(float px, float py, float pz, bool raw)
 {
 	// Move the tip of the leg to x, y. Return false when out of range.
 	float ankle = NAN;
@@ -159,30 +162,44 @@ void Leg::move(float px, float py, float pz, bool raw)
 
 	float x= px, y= py, z= pz;
 
-	if(debug_verbose) printf("move %s: x: %f, y: %f, z: %f\n", name.c_str(), x, y, z);
+	if(debug_verbose) printf("move %s: x: %f, y: %f, z: %f\n", mount.name, x, y, z);
 
 	// transform into the leg coordinates from the robot leg coordinates
 	//printf("Move x:%f, y:%f, z:%f\n", x, y, z);
-	if(!raw) transform(mat, x, y);
+	if(!raw) toLegFrame(x, y);
 	//printf("transformed Move x:%f, y:%f, z:%f\n", x, y, z);
 
-	std::tie(hip, knee, ankle) = inverseKinematics(x, y, z);
-	if(debug_verbose) printf("move %s: hip: %f, knee %f, ankle: %f\n", name.c_str(), DEGREES(hip+PI2), DEGREES(knee+PI2), DEGREES(ankle+PI2));
+	const IKTable *t= ik_table;
+	if(t == nullptr || !t->solve(x, y, z, hip, knee, ankle)) {
+		std::tie(hip, knee, ankle) = inverseKinematics(x, y, z);
+	}
+	if(debug_verbose) printf("move %s: hip: %f, knee %f, ankle: %f\n", mount.name, DEGREES(hip+PI2), DEGREES(knee+PI2), DEGREES(ankle+PI2));
 
 	if(std::isnan(hip) || std::isnan(knee) || std::isnan(ankle)) {
-		fprintf(stderr, "move out of range: %s, %f, %f, %f, %f, %f, %f, %f, %f, %f\n", name.c_str(), px, py, pz, x, y, z, hip, knee, ankle);
+		fprintf(stderr, "move out of range: %s, %f, %f, %f, %f, %f, %f, %f, %f, %f\n", mount.name, px, py, pz, x, y, z, hip, knee, ankle);
 		throw std::range_error("move");
 	}
 
 	// only update position if we did not get an error, and set to requested position not transformed position
+	setJoints(px, py, pz, hip, knee, ankle);
+}
+
+template<class RobotT>
+void BasicLeg<RobotT>::setJoints(float px, float py, float pz, float hip, float knee, float ankle, bool staged)
+{
 	position= std::make_tuple(px, py, pz);
+	angles[0]= ankle;
+	angles[1]= knee;
+	angles[2]= hip;
 
-	servo.move(joint[0], ankle);
-	servo.move(joint[1], knee);
-	servo.move(joint[2], hip);
+	for (int j = 0; j < 3; ++j) {
+		if(staged) servo.stage(mount.joint[j], angles[j]);
+		else servo.move(mount.joint[j], angles[j]);
+	}
 }
 
-void Leg::moveBy(float dx, float dy, float dz)
+template<class RobotT>
+void BasicLeg<RobotT>::moveBy(float dx, float dy, float dz)
 {
 	// Move the tip of the leg by dx, dy. Return false when out of range.
 	move( std::get<0>(position) + dx,
@@ -190,7 +207,8 @@ void Leg::moveBy(float dx, float dy, float dz)
 				 std::get<2>(position) + dz);
 }
 
-Leg::Vec3 Leg::calcRotation(float rad, bool abs) const
+template<class RobotT>
+typename BasicLeg<RobotT>::Vec3 BasicLeg<RobotT>::calcRotation(float rad, bool abs) const
 {
 	// Rotate the tip of the leg around the center of robot's body.
 	float x, y, z;
@@ -202,18 +220,30 @@ Leg::Vec3 Leg::calcRotation(float rad, bool abs) const
 		// based on current position
 		std::tie(x, y, z) = position;
 	}
-	x += origin[0];
-	y += origin[1];
-	float nx = x *  cosf(rad) + y * sinf(rad);
-	float ny = x * -sinf(rad) + y * cosf(rad);
-	nx -=  origin[0];
-	ny -=  origin[1];
+	float ox, oy;
+	LegSwitch<RobotT>::origin(index, ox, oy);
+	x += ox;
+	y += oy;
+	float c = FMath::cos(rad), s = FMath::sin(rad);
+	float nx = x *  c + y * s;
+	float ny = x * -s + y * c;
+	nx -=  ox;
+	ny -=  oy;
 	return Vec3(nx, ny, z);
 }
 
-void Leg::rotateBy(float rad)
+template<class RobotT>
+void BasicLeg<RobotT>::rotateBy(float rad)
 {
 	float x, y, z;
 	std::tie(x, y, z)= calcRotation(rad, false);
 	move(x, y, z);
 }
+
+template<class RobotT>
+size_t BasicLeg<RobotT>::evaluate(const float *x, const float *y, const float *z, size_t n, float *hip, float *knee, float *ankle, uint8_t *reachable, int nthreads) const
+{
+	return evaluateInverseKinematics<RobotT>(index, x, y, z, n, hip, knee, ankle, reachable, nthreads);
+}
+
+template class BasicLeg<Robot>;
@@ -1,29 +1,31 @@
 #pragma once
 
+#include "fastmath.h"
+#include "Robot.h"
+
 #include <math.h>
 #include <cstdint>
+#include <cstddef>
 #include <tuple>
-#include <string>
-
-class Servo;
+#include <atomic>
 
-#define	COXA 36.5F
-#define	FEMUR 32.5F
-#define	TIBIA 65.0F
-#define	BASE_RADIUS (134/2+26.5)
+template<class RobotT> class BasicServo;
+class IKTable;
 
-class Leg
+// a leg of the robot described by RobotT, index is which of RobotT::legs it is
+template<class RobotT>
+class BasicLeg
 {
 public:
 	using Vec3 = std::tuple<float, float, float>;
 
-	Leg(const char *name, float pos, float home_angle, uint8_t joint0, uint8_t joint1, uint8_t joint2, Servo& servo);
+	BasicLeg(int index, BasicServo<RobotT>& servo);
 
 	// must not allow copies of this Leg to be used accidently
-	Leg( const Leg& other ) = delete; // non construction-copyable
-    Leg& operator=( const Leg& ) = delete; // non copyable
+	BasicLeg( const BasicLeg& other ) = delete; // non construction-copyable
+    BasicLeg& operator=( const BasicLeg& ) = delete; // non copyable
     // required to use emplace_back for creation
-	Leg(Leg&&) = default;
+	BasicLeg(BasicLeg&&) = default;
 
 	void home();
 	void idle();
@@ -36,26 +38,50 @@ public:
 	Vec3 getCoordinates(float x, float y, float z) const;
 
 	void setAngle(float hip, float knee, float ankle);
+	// set a single joint (0 ankle, 1 knee, 2 hip) in radians and keep the position in step with it
+	void setJoint(int j, float rads);
 
 	bool onGround() const { return on_ground; }
 	void setOnGround(bool flg) { on_ground= flg; }
 
 	Vec3 getPosition() const { return position; }
+	BasicServo<RobotT>& getServo() const { return servo; }
+	// hip, knee, ankle last written in radians
+	Vec3 getAngles() const { return Vec3(angles[2], angles[1], angles[0]); }
+	// false until the leg has been moved or had all its joints set
+	bool positionKnown() const { return !std::isnan(std::get<0>(position)); }
 
-private:
-	float solveTriangle(float a, float b, float c) const;
-	float norm(float a, float b) const { return sqrtf(a * a + b * b); }
-	void transform(const float mat[2][2], float& x, float& y) const;
+	// transform robot x, y into this legs coordinates
+	void toLegFrame(float& x, float& y) const { LegSwitch<RobotT>::toLeg(index, x, y); }
+	// and back again
+	void fromLegFrame(float& x, float& y) const { LegSwitch<RobotT>::fromLeg(index, x, y); }
+	// write already solved joint angles and record the robot position they were solved for,
+	// staged leaves them in the servo frame for the next Servo::commit
+	void setJoints(float px, float py, float pz, float hip, float knee, float ankle, bool staged= false);
+
+	// pure functions, do not move the leg
+	static Vec3 inverseKinematics(float x, float y, float z);
+	static Vec3 forwardKinematics(float a, float k, float h);
+	// IK for n candidate positions of this leg without moving it, see evaluateInverseKinematics
+	size_t evaluate(const float *x, const float *y, const float *z, size_t n, float *hip, float *knee, float *ankle, uint8_t *reachable, int nthreads= 0) const;
 
-	Vec3 inverseKinematics(float x, float y, float z) const;
-	Vec3 forwardKinematics(float a, float k, float h) const;
+	// use the IK lookup table for move() when set, nullptr uses the analytic IK. Body::commit doesn't use it
+	static void setIKTable(const IKTable *t) { ik_table= t; }
+	static const IKTable *getIKTable() { return ik_table; }
 
-	std::string name;
-	Servo& servo;
-	float mat[2][2];
-	float inv_mat[2][2];
+private:
+	static float solveTriangle(float a, float b, float c);
+	static float norm(float a, float b) { return FMath::sqrt(a * a + b * b); }
+
+	int index;
+	// name and servo channels, the transforms come from LegGeometry
+	const LegMount& mount;
+	BasicServo<RobotT>& servo;
 	Vec3 position;
-	float origin[2];
-	uint8_t joint[3];
+	float angles[3]; // current ankle, knee, hip in radians
 	bool on_ground;
+
+	static std::atomic<const IKTable*> ik_table;
 };
+
+using Leg = BasicLeg<Robot>;
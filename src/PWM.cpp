@@ -1,6 +1,3 @@
-#include "Servo.h"
-
-#ifdef USEGPIO
 #include "PWM.h"
 
 #include <cmath>
@@ -83,4 +80,3 @@ float PWM::dutyCycle(float angle)
 
    return duty_cycle;
 }
-#endif
@@ -0,0 +1,163 @@
+#include "PhaseLock.h"
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "mraa.hpp"
+
+PhaseLock::PhaseLock(float hz, int64_t epoch)
+{
+	margin= 300000;
+	duration= 0;
+	sync_pin= nullptr;
+	reset(hz, epoch);
+	clearStats();
+}
+
+PhaseLock::~PhaseLock()
+{
+	if(sync_pin != nullptr) {
+		sync_pin->isrExit();
+		delete sync_pin;
+	}
+}
+
+int64_t PhaseLock::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PhaseLock::reset(float hz, int64_t epoch)
+{
+	std::lock_guard<std::mutex> l(mutex);
+	period= 1e9 / hz;
+	this->epoch= epoch;
+	last_edge= 0;
+	sync_count= 0;
+	lead= duration + margin;
+	tick_start= last_boundary= 0;
+}
+
+// the boundary nearest t
+int64_t PhaseLock::nearestBoundary(int64_t t) const
+{
+	return epoch + (int64_t)(std::round((t - epoch) / period) * period);
+}
+
+void PhaseLock::edge(int64_t t)
+{
+	std::lock_guard<std::mutex> l(mutex);
+	++stats.edges;
+	if(last_edge == 0) {
+		epoch= last_edge= t;
+		return;
+	}
+	double n= std::round((t - last_edge) / period);
+	if(n < 1) {
+		// a glitch inside the cycle
+		++stats.resyncs;
+		return;
+	}
+	double interval= (t - last_edge) / n;
+	if(n > 8 || std::abs(interval - period) > period / 16) {
+		// lost for a while or a late edge, start again from here. the period is only ever filtered so one
+		// bad interval can't throw it off, which means hz has to be within 6% of the real frequency
+		++stats.resyncs;
+		epoch= last_edge= t;
+		sync_count= 0;
+		return;
+	}
+
+	// interrupt latency jitters the edges, so both are filtered, the period quicker while it is locking on
+	period += (interval - period) / std::min(sync_count + 2, 16);
+	int64_t b= nearestBoundary(t);
+	epoch= b + (t - b) / 4;
+	last_edge= t;
+	++sync_count;
+}
+
+bool PhaseLock::synced() const
+{
+	std::lock_guard<std::mutex> l(mutex);
+	return sync_count >= 8;
+}
+
+float PhaseLock::frequency() const
+{
+	std::lock_guard<std::mutex> l(mutex);
+	return 1e9 / period;
+}
+
+int64_t PhaseLock::slot(int64_t t) const
+{
+	std::lock_guard<std::mutex> l(mutex);
+	double n= std::ceil((t + lead - epoch) / period);
+	int64_t b= epoch + (int64_t)(n * period);
+	// never two ticks for the same boundary, even if lead shrank
+	if(last_boundary != 0 && b < last_boundary + period / 2) b= last_boundary + (int64_t)period;
+	return b;
+}
+
+void PhaseLock::record(int64_t start, int64_t done, int64_t boundary)
+{
+	std::lock_guard<std::mutex> l(mutex);
+	// the lead follows the slowest recent tick, up straight away and down over a few seconds
+	int64_t d= done - start;
+	duration= d > duration ? d : duration - (duration - d) / 256;
+	lead= duration + margin;
+
+	if(last_boundary != 0) {
+		int gap= std::round((boundary - last_boundary) / period);
+		if(gap > 1) stats.skipped += gap - 1;
+	}
+	last_boundary= boundary;
+
+	float us= (done - boundary) / 1000.0F;
+	if(stats.ticks == 0 || us < stats.min_us) stats.min_us= us;
+	if(stats.ticks == 0 || us > stats.max_us) stats.max_us= us;
+	sum_us += us;
+	++stats.ticks;
+	stats.mean_us= sum_us / stats.ticks;
+	if(done > boundary) ++stats.late;
+}
+
+int64_t PhaseLock::waitForSlot()
+{
+	int64_t b= slot(now());
+	std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(b - lead)));
+	tick_start= now();
+	return b;
+}
+
+PhaseLock::Stats PhaseLock::getStats() const
+{
+	std::lock_guard<std::mutex> l(mutex);
+	return stats;
+}
+
+void PhaseLock::clearStats()
+{
+	std::lock_guard<std::mutex> l(mutex);
+	stats= Stats();
+	sum_us= 0;
+}
+
+static void onEdge(void *arg)
+{
+	int64_t t= PhaseLock::now();
+	static_cast<PhaseLock*>(arg)->edge(t);
+}
+
+bool PhaseLock::attachSync(int pin)
+{
+	if(sync_pin != nullptr) return true;
+	sync_pin= new mraa::Gpio(pin);
+	if(sync_pin->dir(mraa::DIR_IN) != mraa::SUCCESS || sync_pin->isr(mraa::EDGE_RISING, onEdge, this) != mraa::SUCCESS) {
+		delete sync_pin;
+		sync_pin= nullptr;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,80 @@
+/**
+	Phase lock to the PWM cycle of a PCA9685.
+	The chip only picks up new ON/OFF counts at the end of a cycle, so a frame written just after a cycle starts waits
+	almost a whole period, and a loop running at a slightly different rate beats against the cycle, dropping some
+	frames and delaying others. This predicts the cycle boundaries from the measured period so a loop can start each
+	tick lead ns before the next boundary, with lead following how long its ticks take.
+	The prediction starts from the period and restart time the board reports, rising edges of a servo signal on a
+	GPIO (every output rises at the start of the cycle) keep it in frequency and phase.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+namespace mraa {
+	class Gpio;
+};
+
+class PhaseLock
+{
+public:
+	// hz the PWM frequency, epoch a time in ns a cycle started at
+	PhaseLock(float hz= 60, int64_t epoch= 0);
+	~PhaseLock();
+
+	PhaseLock(const PhaseLock&) = delete;
+	PhaseLock& operator=(const PhaseLock&) = delete;
+
+	// std::chrono::steady_clock in ns, the time base of everything here
+	static int64_t now();
+
+	void reset(float hz, int64_t epoch);
+	// a rising edge of the PWM seen at t, outliers (missed or extra edges) restart the tracking from t
+	void edge(int64_t t);
+	// timestamp the rising edges of mraa GPIO pin with edge(), false if it can't
+	bool attachSync(int pin);
+	bool synced() const;
+
+	float frequency() const;
+	// the first cycle boundary a tick starting at or after t can be written for
+	int64_t slot(int64_t t) const;
+	// the tick written for boundary ran from start to done
+	void record(int64_t start, int64_t done, int64_t boundary);
+	int64_t getLead() const { return lead; }
+	// extra time ahead of the boundary on top of the tick duration
+	void setMargin(int64_t ns) { margin= ns; }
+
+	// sleep until lead before the next boundary, and record the tick when it is done
+	int64_t waitForSlot();
+	void done(int64_t boundary) { record(tick_start, now(), boundary); }
+
+	// phase error is when the tick was done relative to its boundary, negative is ahead of it
+	struct Stats {
+		uint32_t ticks;
+		uint32_t late; // done after the boundary, these wait a whole extra period
+		uint32_t skipped; // boundaries with no tick
+		uint32_t edges;
+		uint32_t resyncs; // edges that did not fit the period
+		float min_us, max_us, mean_us;
+	};
+	Stats getStats() const;
+	void clearStats();
+
+private:
+	int64_t nearestBoundary(int64_t t) const;
+
+	mutable std::mutex mutex; // edge() comes from the GPIO interrupt thread
+	double period; // ns
+	int64_t epoch; // a cycle boundary
+	int64_t last_edge;
+	int sync_count;
+
+	int64_t lead, margin, duration;
+	int64_t tick_start, last_boundary;
+	Stats stats;
+	double sum_us;
+
+	mraa::Gpio *sync_pin;
+};
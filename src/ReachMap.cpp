@@ -0,0 +1,352 @@
+#include "ReachMap.h"
+#include "Leg.h"
+#include "kinematics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const int ReachMap::MAX_ZLEVELS;
+
+// written at the start of the file, the map is only used if all of it matches this robot
+struct ReachMapHeader {
+	char magic[4];
+	uint32_t version;
+	float coxa, femur, tibia;
+	float limits[Robot::NLEGS][3][2]; // ankle, knee, hip min and max radians the map was built with
+	float spacing;
+	float lo[3];
+	int32_t dim[3];
+	int32_t slab_words;
+	int32_t pad;
+};
+// the bits that follow have to stay 8 byte aligned in the mapping
+static_assert(sizeof(ReachMapHeader) % 8 == 0, "ReachMapHeader size");
+
+static void makeHeader(ReachMapHeader& h, float spacing)
+{
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "HXRM", 4);
+	h.version = 1;
+	h.coxa = Robot::COXA;
+	h.femur = Robot::FEMUR;
+	h.tibia = Robot::TIBIA;
+	for (int l = 0; l < Robot::NLEGS; ++l) {
+		for (int j = 0; j < 3; ++j) jointLimits<Robot>(l, j, h.limits[l][j][0], h.limits[l][j][1]);
+	}
+
+	// the hip can turn the foot behind the leg so x is ± reach as well
+	const float reach = Robot::COXA + Robot::FEMUR + Robot::TIBIA;
+	h.spacing = spacing;
+	h.lo[0] = -reach;
+	h.lo[1] = -reach;
+	h.lo[2] = -(Robot::FEMUR + Robot::TIBIA);
+	h.dim[0] = ceilf(2 * reach / spacing);
+	h.dim[1] = ceilf(2 * reach / spacing);
+	h.dim[2] = ceilf(2 * (Robot::FEMUR + Robot::TIBIA) / spacing);
+	// each x slab starts on a word so the generator threads never share one
+	h.slab_words = (h.dim[1] * h.dim[2] + 63) / 64;
+}
+
+// bit per leg of the legs that can reach the grid node
+static uint8_t nodeLegs(const ReachMapHeader& h, int ix, int iy, int iz)
+{
+	float hip, knee, ankle;
+	std::tie(hip, knee, ankle) = Leg::inverseKinematics(h.lo[0] + ix * h.spacing, h.lo[1] + iy * h.spacing, h.lo[2] + iz * h.spacing);
+	if(std::isnan(hip) || std::isnan(knee) || std::isnan(ankle)) return 0;
+
+	const float angle[3] = { ankle, knee, hip };
+	uint8_t m = 0;
+	for (int l = 0; l < Robot::NLEGS; ++l) {
+		bool ok = true;
+		for (int j = 0; j < 3 && ok; ++j) {
+			ok = angle[j] >= h.limits[l][j][0] && angle[j] <= h.limits[l][j][1];
+		}
+		if(ok) m |= 1 << l;
+	}
+	return m;
+}
+
+// a voxel is reachable if all 8 of its corners are, so anywhere inside it is (to within the curvature of the boundary)
+static void generateSlabs(const ReachMapHeader& h, uint64_t *bits, int ix0, int ix1)
+{
+	const int ny = h.dim[1] + 1, nz = h.dim[2] + 1;
+	std::vector<uint8_t> p0(ny * nz), p1(ny * nz);
+	for (int iy = 0; iy < ny; ++iy) {
+		for (int iz = 0; iz < nz; ++iz) p0[iy * nz + iz] = nodeLegs(h, ix0, iy, iz);
+	}
+
+	for (int ix = ix0; ix < ix1; ++ix) {
+		for (int iy = 0; iy < ny; ++iy) {
+			for (int iz = 0; iz < nz; ++iz) p1[iy * nz + iz] = nodeLegs(h, ix + 1, iy, iz);
+		}
+
+		for (int iy = 0; iy < h.dim[1]; ++iy) {
+			for (int iz = 0; iz < h.dim[2]; ++iz) {
+				int n = iy * nz + iz;
+				uint8_t m = p0[n] & p0[n + 1] & p0[n + nz] & p0[n + nz + 1] & p1[n] & p1[n + 1] & p1[n + nz] & p1[n + nz + 1];
+				if(m == 0) continue;
+				int b = iy * h.dim[2] + iz;
+				for (int l = 0; l < Robot::NLEGS; ++l) {
+					if(m & (1 << l)) bits[((size_t)l * h.dim[0] + ix) * h.slab_words + (b >> 6)] |= 1ULL << (b & 63);
+				}
+			}
+		}
+		p0.swap(p1);
+	}
+}
+
+bool ReachMap::generate(const char *fn, float spacing, int nthreads)
+{
+	if(spacing < 1) {
+		fprintf(stderr, "ReachMap: spacing must be at least 1mm\n");
+		return false;
+	}
+
+	ReachMapHeader h;
+	makeHeader(h, spacing);
+	std::vector<uint64_t> bits((size_t)Robot::NLEGS * h.dim[0] * h.slab_words, 0);
+
+	if(nthreads <= 0) nthreads = std::max(1U, std::thread::hardware_concurrency());
+	nthreads = std::min(nthreads, (int)h.dim[0]);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nthreads; ++t) {
+		int ix0 = h.dim[0] * t / nthreads, ix1 = h.dim[0] * (t + 1) / nthreads;
+		threads.emplace_back(generateSlabs, std::cref(h), bits.data(), ix0, ix1);
+	}
+	for(auto& t : threads) t.join();
+
+	FILE *fp = fopen(fn, "wb");
+	if(fp == nullptr) {
+		fprintf(stderr, "ReachMap: unable to write %s\n", fn);
+		return false;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(bits.data(), sizeof(uint64_t), bits.size(), fp) == bits.size();
+	fclose(fp);
+	return ok;
+}
+
+ReachMap::ReachMap()
+{
+	map = nullptr;
+	map_size = 0;
+	bits = nullptr;
+	spacing = 0;
+	lo[0] = lo[1] = lo[2] = 0;
+	dim[0] = dim[1] = dim[2] = 0;
+	slab_words = 0;
+	stand_lo = stand_hi = -1;
+}
+
+ReachMap::~ReachMap()
+{
+	unload();
+}
+
+void ReachMap::unload()
+{
+	if(map != nullptr) munmap(map, map_size);
+	map = nullptr;
+	bits = nullptr;
+}
+
+bool ReachMap::load(const char *fn)
+{
+	unload();
+
+	int fd = open(fn, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "ReachMap: unable to open %s\n", fn);
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ReachMapHeader)) {
+		close(fd);
+		fprintf(stderr, "ReachMap: %s is not a reach map\n", fn);
+		return false;
+	}
+	void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED) {
+		fprintf(stderr, "ReachMap: unable to map %s\n", fn);
+		return false;
+	}
+
+	const ReachMapHeader *h = (const ReachMapHeader *)m;
+	ReachMapHeader expected;
+	makeHeader(expected, h->spacing);
+	size_t nwords = (size_t)Robot::NLEGS * expected.dim[0] * expected.slab_words;
+	if(memcmp(h, &expected, sizeof(expected)) != 0 || (size_t)st.st_size != sizeof(expected) + nwords * sizeof(uint64_t)) {
+		munmap(m, st.st_size);
+		fprintf(stderr, "ReachMap: %s was built for a different robot, regenerate it with -G\n", fn);
+		return false;
+	}
+
+	map = m;
+	map_size = st.st_size;
+	bits = (const uint64_t *)((const char *)m + sizeof(ReachMapHeader));
+	spacing = h->spacing;
+	for (int i = 0; i < 3; ++i) {
+		lo[i] = h->lo[i];
+		dim[i] = h->dim[i];
+	}
+	slab_words = h->slab_words;
+
+	buildTables();
+	return true;
+}
+
+bool ReachMap::voxel(int leg, int ix, int iy, int iz) const
+{
+	if(ix < 0 || iy < 0 || iz < 0 || ix >= dim[0] || iy >= dim[1] || iz >= dim[2]) return false;
+	int b = iy * dim[2] + iz;
+	return (bits[wordIndex(leg, ix, iy, iz)] >> (b & 63)) & 1;
+}
+
+// the voxel index along axis, false if outside the map (or NAN)
+bool ReachMap::cell(float v, int axis, int& i) const
+{
+	float f = (v - lo[axis]) / spacing;
+	if(!(f >= 0 && f < dim[axis])) return false;
+	i = f;
+	return true;
+}
+
+bool ReachMap::reachable(int leg, float x, float y, float z) const
+{
+	int ix, iy, iz;
+	return cell(x, 0, ix) && cell(y, 1, iy) && cell(z, 2, iz) && voxel(leg, ix, iy, iz);
+}
+
+bool ReachMap::inRange(int leg, float hip, float knee, float ankle)
+{
+	const float angle[3] = { ankle, knee, hip };
+	for (int j = 0; j < 3; ++j) {
+		float a, b;
+		jointLimits<Robot>(leg, j, a, b);
+		if(!(angle[j] >= a && angle[j] <= b)) return false;
+	}
+	return true;
+}
+
+// how far the foot can go from x, y along the unit direction dx, dy (leg coordinates) at z level iz
+float ReachMap::reachAlong(int leg, float x, float y, float dx, float dy, int iz) const
+{
+	const float step = spacing / 2;
+	const float reach = dim[0] * spacing;
+	float s = 0;
+	const float z = lo[2] + (iz + 0.5F) * spacing;
+	while(s < reach && reachable(leg, x + (s + step) * dx, y + (s + step) * dy, z)) {
+		s += step;
+	}
+	return s;
+}
+
+// how far leg can turn about the body center from its home position, dir is ±1
+float ReachMap::turnAbout(int leg, float x, float y, float dir, int iz) const
+{
+	const float step = 0.25F * M_PI / 180.0F;
+	const float *o = Robot::legs[leg].origin;
+	x += o[0];
+	y += o[1];
+	float a = 0;
+	while(a < (float)M_PI_2) {
+		// same rotation as Leg::calcRotation
+		float r = (a + step) * dir, c = cosf(r), s = sinf(r);
+		float nx = x * c + y * s - o[0];
+		float ny = -x * s + y * c - o[1];
+		const float (*m)[2] = Robot::legs[leg].mat;
+		float lx = nx * m[0][0] + ny * m[1][0];
+		float ly = nx * m[0][1] + ny * m[1][1];
+		if(!reachable(leg, lx, ly, lo[2] + (iz + 0.5F) * spacing)) break;
+		a += step;
+	}
+	return a;
+}
+
+// reduce the maps to the worst case over the legs for a stance around the home position at every z level
+void ReachMap::buildTables()
+{
+	// home is the same in every legs coordinates, see Leg::getHomeCoordinates
+	const float hx = Robot::COXA + Robot::FEMUR, hy = 0;
+
+	for (int iz = 0; iz < dim[2] && iz < MAX_ZLEVELS; ++iz) {
+		bool stand = true;
+		for (int l = 0; l < Robot::NLEGS; ++l) stand = stand && reachable(l, hx, hy, lo[2] + (iz + 0.5F) * spacing);
+		stand_tab[iz] = stand;
+
+		for (int d = 0; d < NDIRS; ++d) {
+			float dir = 2 * M_PI * d / NDIRS;
+			float stride = stand ? 1e9F : 0;
+			for (int l = 0; l < Robot::NLEGS && stride > 0; ++l) {
+				// the step direction in this legs coordinates
+				const float (*m)[2] = Robot::legs[l].mat;
+				float ux = cosf(dir), uy = sinf(dir);
+				float dx = ux * m[0][0] + uy * m[1][0];
+				float dy = ux * m[0][1] + uy * m[1][1];
+				stride = std::min(stride, 2 * std::min(reachAlong(l, hx, hy, dx, dy, iz), reachAlong(l, hx, hy, -dx, -dy, iz)));
+			}
+			stride_tab[iz][d] = stride;
+		}
+
+		float turn = stand ? 1e9F : 0;
+		for (int l = 0; l < Robot::NLEGS && turn > 0; ++l) {
+			// home in robot coordinates
+			float x = hx, y = hy;
+			const float (*m)[2] = Robot::legs[l].inv_mat;
+			float rx = x * m[0][0] + y * m[1][0];
+			float ry = x * m[0][1] + y * m[1][1];
+			turn = std::min(turn, 2 * std::min(turnAbout(l, rx, ry, 1, iz), turnAbout(l, rx, ry, -1, iz)));
+		}
+		turn_tab[iz] = turn;
+	}
+
+	// the run of standing levels around the nominal stance, the tibia straight down
+	int iz;
+	stand_lo = stand_hi = -1;
+	if(cell(-Robot::TIBIA, 2, iz) && stand_tab[iz]) {
+		stand_lo = stand_hi = iz;
+		while(stand_lo > 0 && stand_tab[stand_lo - 1]) --stand_lo;
+		while(stand_hi < std::min(dim[2], MAX_ZLEVELS) - 1 && stand_tab[stand_hi + 1]) ++stand_hi;
+	}
+}
+
+float ReachMap::maxStride(float dir, float z, float raise) const
+{
+	int iz0, iz1;
+	if(!isLoaded() || !cell(z, 2, iz0) || !cell(z + raise, 2, iz1)) return 0;
+
+	// the two table directions either side of dir, whichever is shorter
+	float f = dir * (NDIRS / (2 * (float)M_PI));
+	int d0 = (int)floorf(f) % NDIRS;
+	if(d0 < 0) d0 += NDIRS;
+	int d1 = (d0 + 1) % NDIRS;
+	return std::min(std::min(stride_tab[iz0][d0], stride_tab[iz0][d1]), std::min(stride_tab[iz1][d0], stride_tab[iz1][d1]));
+}
+
+float ReachMap::maxRotation(float z, float raise) const
+{
+	int iz0, iz1;
+	if(!isLoaded() || !cell(z, 2, iz0) || !cell(z + raise, 2, iz1)) return 0;
+	return std::min(turn_tab[iz0], turn_tab[iz1]);
+}
+
+bool ReachMap::heightRange(float raise, float& zlo, float& zhi) const
+{
+	if(!isLoaded() || stand_lo < 0) return false;
+
+	// the raised foot has to be at a standing height too
+	int r = (int)ceilf(raise / spacing);
+	if(stand_hi - r < stand_lo) return false;
+	zlo = lo[2] + stand_lo * spacing;
+	zhi = lo[2] + (stand_hi - r + 1) * spacing;
+	return true;
+}
@@ -0,0 +1,72 @@
+/**
+	Reachability map, a voxel bitset per leg of the foot positions (in leg coordinates) the leg can get to
+	with every joint inside its servo range after trim, which is why each leg has its own map.
+	It is generated offline (-G) into a file that is memory mapped when used (-g), and on load it is reduced to
+	tables of the largest stride, rotation and body height for a stance so the gaits can look them up in O(1).
+*/
+
+#pragma once
+
+#include "Robot.h"
+
+#include <cstdint>
+#include <cstddef>
+
+class ReachMap
+{
+public:
+	ReachMap();
+	~ReachMap();
+
+	ReachMap(const ReachMap&) = delete;
+	ReachMap& operator=(const ReachMap&) = delete;
+
+	// build the maps with voxels every spacing mm on nthreads threads (0 uses every core) and write them to fn
+	static bool generate(const char *fn, float spacing, int nthreads= 0);
+
+	// map a file written by generate, fails if it was built for a different robot
+	bool load(const char *fn);
+	void unload();
+	bool isLoaded() const { return bits != nullptr; }
+
+	// true if the voxel containing leg coordinate x, y, z is reachable by leg
+	bool reachable(int leg, float x, float y, float z) const;
+
+	// largest full stride in mm for a step in robot direction dir (radians, 0 is +X) with the feet at height z
+	// and raised by raise while swinging, every leg moves ± stride/2 around its home position
+	float maxStride(float dir, float z, float raise) const;
+	// largest full rotation in radians for the rotate gaits, which turn every leg ± angle/2 about the body center
+	float maxRotation(float z, float raise) const;
+	// the range of foot heights where every leg can stand at home and lift by raise
+	bool heightRange(float raise, float& lo, float& hi) const;
+
+	// true if every joint is inside its servo range after trim
+	static bool inRange(int leg, float hip, float knee, float ankle);
+
+	float getSpacing() const { return spacing; }
+
+private:
+	static const int NDIRS = 64; // stride directions in the stride table
+	static const int MAX_ZLEVELS = 256;
+
+	size_t wordIndex(int leg, int ix, int iy, int iz) const { return ((size_t)leg * dim[0] + ix) * slab_words + ((iy * dim[2] + iz) >> 6); }
+	bool voxel(int leg, int ix, int iy, int iz) const;
+	bool cell(float v, int axis, int& i) const;
+	float reachAlong(int leg, float x, float y, float dx, float dy, int iz) const;
+	float turnAbout(int leg, float x, float y, float dir, int iz) const;
+	void buildTables();
+
+	void *map;
+	size_t map_size;
+	const uint64_t *bits;
+	float spacing;
+	float lo[3];
+	int dim[3];
+	int slab_words;
+
+	// per z level, worst case over all the legs
+	float stride_tab[MAX_ZLEVELS][NDIRS];
+	float turn_tab[MAX_ZLEVELS];
+	bool stand_tab[MAX_ZLEVELS];
+	int stand_lo, stand_hi; // z levels
+};
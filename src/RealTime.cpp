@@ -0,0 +1,164 @@
+#include "RealTime.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <new>
+
+int RealTime::priority= 0;
+int RealTime::cpu= -1;
+
+static thread_local uint64_t allocs= 0;
+
+uint64_t RealTime::allocations()
+{
+	return allocs;
+}
+
+// counted for every thread. it does what the library's does otherwise, calling the new handler until it gives
+// up, and the other forms are all defined here so none of them can get round it
+void *operator new(size_t n)
+{
+	++allocs;
+	if(n == 0) n= 1;
+	for (;;) {
+		void *p= malloc(n);
+		if(p != nullptr) return p;
+		std::new_handler h= std::get_new_handler();
+		if(h == nullptr) throw std::bad_alloc();
+		h();
+	}
+}
+
+void *operator new[](size_t n)
+{
+	return operator new(n);
+}
+
+void *operator new(size_t n, const std::nothrow_t&) noexcept
+{
+	try {
+		return operator new(n);
+	}catch(...) {
+		return nullptr;
+	}
+}
+
+void *operator new[](size_t n, const std::nothrow_t&) noexcept
+{
+	return operator new(n, std::nothrow);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+	free(p);
+}
+
+// the sized forms a C++14 compiler calls
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
+
+bool RealTime::enter(int priority, int cpu)
+{
+	if(cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int r= pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(r != 0) {
+			fprintf(stderr, "Real time: unable to pin to cpu %d: %s\n", cpu, strerror(r));
+			return false;
+		}
+	}
+
+	struct sched_param sp;
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority= priority;
+	int r= pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+	if(r != 0) {
+		fprintf(stderr, "Real time: unable to use SCHED_FIFO at %d: %s\n", priority, strerror(r));
+		return false;
+	}
+	RealTime::priority= priority;
+	RealTime::cpu= cpu;
+	return true;
+}
+
+// touch n bytes of stack below this frame, noinline so it is a frame of its own that goes away again
+static void __attribute__((noinline)) prefaultStack(size_t n)
+{
+	char buf[n];
+	memset(buf, 0, n);
+	// keep the writes
+	__asm__ __volatile__("" : : "r"(buf) : "memory");
+}
+
+bool RealTime::lockMemory(size_t stack_bytes, size_t heap_bytes)
+{
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		fprintf(stderr, "Real time: unable to lock memory: %s\n", strerror(errno));
+		return false;
+	}
+
+	// keep what is freed in the heap instead of trimming it or using mmap for the big blocks, so the prefaulted
+	// pages stay in use
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	char *heap= (char*)malloc(heap_bytes);
+	if(heap != nullptr) {
+		for (size_t i = 0; i < heap_bytes; i += 4096) heap[i]= 0;
+		free(heap);
+	}
+	prefaultStack(stack_bytes);
+	return true;
+}
+
+void RealTime::background()
+{
+	if(!enabled()) return;
+
+	struct sched_param sp;
+	memset(&sp, 0, sizeof(sp));
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+	if(cpu >= 0) {
+		// off the control thread's cpu if there is another
+		long n= sysconf(_SC_NPROCESSORS_ONLN);
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (long i = 0; i < n; ++i) {
+			if(i != cpu || n == 1) CPU_SET(i, &set);
+		}
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+}
@@ -0,0 +1,35 @@
+/**
+	Real time mode for the control thread (-q).
+	The thread that runs the ticks goes to SCHED_FIFO, optionally pinned to one CPU, with all the memory locked and
+	the stack and heap prefaulted so a tick never waits on the scheduler or a page fault. Threads it starts after
+	that inherit the policy (the servo output and bus threads, which are on the tick path too), ones that are not
+	on it, like MQTT, call background() to drop back below it.
+	Every operator new is counted per thread, so a tick that allocates shows up in the Timed stats.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+class RealTime
+{
+public:
+	// SCHED_FIFO at priority (1-99) for the calling thread, pinned to cpu unless it is negative. false with a
+	// message if it isn't allowed, usually for want of root or CAP_SYS_NICE
+	static bool enter(int priority, int cpu);
+	// mlockall now and for the future, touching stack_bytes of stack and heap_bytes of heap, which is then kept
+	// by malloc rather than handed back
+	static bool lockMemory(size_t stack_bytes, size_t heap_bytes);
+	// the calling thread back to SCHED_OTHER at nice 10 and off the pinned cpu, if enter() was called
+	static void background();
+	static bool enabled() { return priority > 0; }
+	static int getPriority() { return priority; }
+	static int getCpu() { return cpu; }
+
+	// operator new calls made by the calling thread so far
+	static uint64_t allocations();
+
+private:
+	static int priority, cpu;
+};
@@ -0,0 +1,14 @@
+#include "Robot.h"
+
+// definitions for the constexpr members, needed when they are indexed at runtime or bound to a reference
+constexpr float HexapodRobot::COXA;
+constexpr float HexapodRobot::FEMUR;
+constexpr float HexapodRobot::TIBIA;
+constexpr float HexapodRobot::BASE_RADIUS;
+constexpr int HexapodRobot::NLEGS;
+constexpr int HexapodRobot::NSERVOS;
+constexpr float HexapodRobot::SERVO_MIN;
+constexpr float HexapodRobot::SERVO_MAX;
+constexpr LegMount HexapodRobot::legs[];
+constexpr int8_t HexapodRobot::reverse[];
+constexpr int8_t HexapodRobot::trim[];
@@ -0,0 +1,163 @@
+/**
+	Compile time description of a robot: segment lengths, where each leg is mounted on the body,
+	which servo drives each joint and the per servo reversal and trim.
+	Leg and Servo are templated on one of these so the geometry folds into constants,
+	and the mount matrices are built by the compiler instead of in the Leg constructor.
+	To build for another chassis add a description like HexapodRobot and point Robot at it.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+
+// C++11 constexpr sin/cos, a Taylor series is plenty for angles within ±2pi
+constexpr double constSinTerm(double x, double term, int n)
+{
+	return n > 15 ? 0 : term + constSinTerm(x, -term * x * x / ((2 * n) * (2 * n + 1)), n + 1);
+}
+constexpr double constSin(double x) { return constSinTerm(x, x, 1); }
+constexpr double constCos(double x) { return constSin(x + M_PI_2); }
+constexpr double constRadians(double a) { return a * M_PI / 180.0; }
+
+// where a leg is mounted and the transforms between robot and leg coordinates
+struct LegMount {
+	const char *name;
+	float pos_angle, home_angle;
+	uint8_t joint[3]; // ankle, knee, hip servo channels
+	// transforms robot x, y into leg x, y
+	float mat[2][2];
+	// transforms leg x, y back into robot x, y
+	float inv_mat[2][2];
+	// the hip joint in robot coordinates
+	float origin[2];
+};
+
+// leg position on body, 0° is the front left corner
+constexpr LegMount makeLegMount(const char *name, float pos_angle, float home_angle, uint8_t ankle, uint8_t knee, uint8_t hip, float base_radius)
+{
+	return LegMount {
+		name, pos_angle, home_angle, { ankle, knee, hip },
+		{ { (float)constCos(constRadians(pos_angle)), (float)-constSin(constRadians(pos_angle)) },
+		  { (float)constSin(constRadians(pos_angle)), (float)constCos(constRadians(pos_angle)) } },
+		{ { (float)constCos(constRadians(home_angle)), (float)-constSin(constRadians(home_angle)) },
+		  { (float)constSin(constRadians(home_angle)), (float)constCos(constRadians(home_angle)) } },
+		{ (float)(base_radius * constCos(constRadians(pos_angle))), (float)(base_radius * constSin(constRadians(pos_angle))) }
+	};
+}
+
+struct HexapodRobot
+{
+	static constexpr float COXA = 36.5F;
+	static constexpr float FEMUR = 32.5F;
+	static constexpr float TIBIA = 65.0F;
+	static constexpr float BASE_RADIUS = 134 / 2 + 26.5F;
+
+	static constexpr int NLEGS = 6;
+	static constexpr int NSERVOS = 18;
+
+	// commanded servo angle range in degrees, after trim
+	static constexpr float SERVO_MIN = 0;
+	static constexpr float SERVO_MAX = 180;
+
+	// position angle, home angle, ankle, knee, hip
+	static constexpr LegMount legs[NLEGS] = {
+		makeLegMount("front left",    60,  -60,  0,  1,  2, BASE_RADIUS),
+		makeLegMount("middle left",    0,    0,  3,  4,  5, BASE_RADIUS),
+		makeLegMount("back left",    -60,   60,  6,  7,  8, BASE_RADIUS),
+		makeLegMount("back right",  -120,  120,  9, 10, 11, BASE_RADIUS),
+		makeLegMount("middle right", 180,  180, 12, 13, 14, BASE_RADIUS),
+		makeLegMount("front right",  120, -120, 15, 16, 17, BASE_RADIUS)
+	};
+
+	// defines which servos need to be reversed
+	static constexpr int8_t reverse[NSERVOS] = {
+		// ankle, knee, hip
+		-1,  1, 1,    // front left
+		-1,  1, 1,    // middle left
+		-1,  1, 1,    // back left
+		-1,  1, 1,    // back right
+		-1,  1, 1,    // middle right
+		-1,  1, 1     // front right
+	};
+
+	static constexpr int8_t trim[NSERVOS] = {
+		// ankle, knee, hip
+		 10, 20,   7,    // front left
+		 20, 20,   0,    // middle left
+		  0,  0,   0,    // back left
+		 20, 20,  10,    // back right
+		 20, 30, -10,    // middle right
+		 22, 30,  15     // front right
+	};
+};
+
+// find the leg and joint a servo channel drives, false if no leg uses it
+template<class RobotT>
+bool channelToJoint(int channel, int& leg, int& joint)
+{
+	for (int l = 0; l < RobotT::NLEGS; ++l) {
+		for (int j = 0; j < 3; ++j) {
+			if(RobotT::legs[l].joint[j] == channel) {
+				leg = l;
+				joint = j;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// the transforms of leg I with its matrices and hip origin as compile time constants, instead of loaded through its
+// LegMount at every move
+template<class RobotT, int I>
+struct LegGeometry
+{
+	// robot x, y into leg x, y
+	static void toLeg(float& x, float& y)
+	{
+		constexpr float m00 = RobotT::legs[I].mat[0][0], m01 = RobotT::legs[I].mat[0][1];
+		constexpr float m10 = RobotT::legs[I].mat[1][0], m11 = RobotT::legs[I].mat[1][1];
+		float nx = x * m00 + y * m10;
+		y = x * m01 + y * m11;
+		x = nx;
+	}
+	// and back again
+	static void fromLeg(float& x, float& y)
+	{
+		constexpr float m00 = RobotT::legs[I].inv_mat[0][0], m01 = RobotT::legs[I].inv_mat[0][1];
+		constexpr float m10 = RobotT::legs[I].inv_mat[1][0], m11 = RobotT::legs[I].inv_mat[1][1];
+		float nx = x * m00 + y * m10;
+		y = x * m01 + y * m11;
+		x = nx;
+	}
+	// the hip in robot coordinates
+	static void origin(float& ox, float& oy)
+	{
+		ox = RobotT::legs[I].origin[0];
+		oy = RobotT::legs[I].origin[1];
+	}
+};
+
+// LegGeometry for a leg number only known at run time, a branch per leg each with its own constants
+template<class RobotT, int I = RobotT::NLEGS - 1>
+struct LegSwitch
+{
+	typedef LegGeometry<RobotT, I> G;
+	typedef LegSwitch<RobotT, I - 1> Next;
+
+	static void toLeg(int leg, float& x, float& y) { if(leg == I) G::toLeg(x, y); else Next::toLeg(leg, x, y); }
+	static void fromLeg(int leg, float& x, float& y) { if(leg == I) G::fromLeg(x, y); else Next::fromLeg(leg, x, y); }
+	static void origin(int leg, float& ox, float& oy) { if(leg == I) G::origin(ox, oy); else Next::origin(leg, ox, oy); }
+};
+
+template<class RobotT>
+struct LegSwitch<RobotT, -1>
+{
+	static void toLeg(int, float&, float&) {}
+	static void fromLeg(int, float&, float&) {}
+	static void origin(int, float& ox, float& oy) { ox = oy = 0; }
+};
+
+// the robot this build is for
+using Robot = HexapodRobot;
@@ -1,94 +1,252 @@
 #include "Servo.h"
+#include "PhaseLock.h"
+#include "I2C.h"
 
 #include <cmath>
 #include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
 
-#ifndef DUMMY
 #include "mraa.hpp"
 #include "adafruitss.h"
 #include "PWM.h"
-#endif
 
 const static float TAU = M_PI * 2;
 const static float PI2 = M_PI_2;
 
-Servo::Servo()
+template<class RobotT>
+BasicServo<RobotT>::BasicServo()
 {
-#ifndef DUMMY
-	const int freqhz= 60;
-	servos = new adafruitss(6, 0x40);
-	servos->setPWMFreq(freqhz); // actual 60Hz is 17.39 57.5Hz
+	for (int i = 0; i < NSERVOS; ++i) {
+		board_of[i]= NO_BOARD;
+		port_of[i]= i;
+		current_angle[i]= 9999.9; // set to an angle we would never have set
+	}
+	frame.mask= frame.tick_mask= 0;
+	enabled= false;
+}
+
+template<class RobotT>
+BasicServo<RobotT>::~BasicServo()
+{
+	stopOutput();
+	enableServos(false);
+	clearBoards();
+	delete enable_pin;
+	delete pwm;
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::open(ServoBackend b)
+{
+	if(outputRunning()) throw std::runtime_error("Servo::open while the output thread is running");
+
+	enableServos(false);
+	delete enable_pin;
+	delete pwm;
+	enable_pin= nullptr;
+	pwm= nullptr;
+	backend= b;
+
 	// ss 1.787 90°
 	// PWM 1.51 90°
+	switch(b) {
+		case ServoBackend::PCA9685:
+			// the first 9 channels on the first board
+			setBoards({ {6, 0x40}, {6, 0x41} });
+			for (int i = 0; i < NSERVOS; ++i) {
+				board_of[i]= i <= 8 ? 0 : 1;
+				port_of[i]= i <= 8 ? i : i - 9;
+			}
+			break;
+
+		case ServoBackend::GPIO:
+			setBoards({ {6, 0x40} });
+			for (int i = 0; i < NSERVOS; ++i) {
+				board_of[i]= i <= 15 ? 0 : NO_BOARD;
+				port_of[i]= i;
+			}
+			// GPIO based PWM
+			// 60Hz is actual 16.8ms
+			pwm = new PWM(type);
+			// match the frequency that the adafruitss actually generates
+			// const float freq2hz= 60; // frequency to match above
+			// pwm->setFrequency(0, freq2hz);
+			// pwm->setFrequency(1, freq2hz);
+			break;
+
+		case ServoBackend::DUMMY:
+		case ServoBackend::RECORD:
+			setBoards({ {6, 0x40}, {6, 0x41} });
+			for (int i = 0; i < NSERVOS; ++i) {
+				board_of[i]= i <= 8 ? 0 : 1;
+				port_of[i]= i <= 8 ? i : i - 9;
+			}
+			break;
+	}
 
-	#ifdef USEGPIO
-	// GPIO based PWM
-	// 60Hz is actual 16.8ms
-	pwm = new PWM(type);
-	// match the frequency that the adafruitss actually generates
-	// const float freq2hz= 60; // frequency to match above
-	// pwm->setFrequency(0, freq2hz);
-	// pwm->setFrequency(1, freq2hz);
-	#else
-	servos2 = new adafruitss(6, 0x41);
-	servos2->setPWMFreq(freqhz); // actual 60Hz is 17.39 57.5Hz
-	#endif
-
-	// start with PWM disabled
-	enable_pin= new mraa::Gpio(20); // GP12 GPIO-12 J18-7
-	enable_pin->dir(mraa::DIR_OUT);
+	// the simulated buses have no servos to enable
+	auto t= std::chrono::steady_clock::now();
+	if((b == ServoBackend::PCA9685 || b == ServoBackend::GPIO) && !I2C::simulating()) {
+		// start with PWM disabled
+		enable_pin= new mraa::Gpio(20); // GP12 GPIO-12 J18-7
+		enable_pin->dir(mraa::DIR_OUT);
+	}
 	enableServos(false);
+	startup.enable_ms= std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t).count();
+}
 
-#else
-	servos = new DummyServo();
-#endif
-	for (int i = 0; i < NSERVOS; ++i) {
-		current_angle[i]= 9999.9; // set to an angle we would never have set
+// a board on the bus, returns its index in boards
+template<class RobotT>
+int BasicServo<RobotT>::addBoard(int bus, int address)
+{
+	ServoBoard *b;
+	switch(backend) {
+		case ServoBackend::DUMMY: b= new DummyBoard(); break;
+		case ServoBackend::RECORD: b= new RecordBoard(bus, address); break;
+		default: b= new adafruitss(bus, address, false); break;
 	}
+	boards.push_back(b);
+	board_address.push_back(std::make_pair(bus, address));
+
+	auto i= std::find_if(buses.begin(), buses.end(), [bus](ServoBus *sb) { return sb->getBus() == bus; });
+	if(i == buses.end()) {
+		buses.push_back(new ServoBus(bus));
+		i= buses.end() - 1;
+	}
+	(*i)->add(b);
+	return boards.size() - 1;
 }
 
-Servo::~Servo()
+template<class RobotT>
+void BasicServo<RobotT>::clearBoards()
 {
-	enableServos(false);
-	delete servos;
+	for(auto b : buses) delete b;
+	for(auto b : boards) delete b;
+	buses.clear();
+	boards.clear();
+	board_address.clear();
+}
 
-#ifndef DUMMY
-	delete enable_pin;
+// replace the boards with new ones at these bus and address pairs, the channels keep their board index and port
+template<class RobotT>
+void BasicServo<RobotT>::setBoards(std::vector<std::pair<int, int>> addresses)
+{
+	using clock= std::chrono::steady_clock;
+	auto ms= [](clock::time_point a, clock::time_point b) { return std::chrono::duration<float, std::milli>(b - a).count(); };
+	auto t0= clock::now();
+	clearBoards();
+	for(auto& b : addresses) addBoard(b.first, b.second);
+	auto t1= clock::now();
 
-#ifdef USEGPIO
-	delete pwm;
-#else
-	delete servos2;
-#endif
-#endif
-}
-
-// defines which servos need to be reversed
-static const int8_t SERVO_REVERSE[Servo::NSERVOS] = {
-	// ankle, knee, hip
-	-1,  1, 1,    // front left
-	-1,  1, 1,    // middle left
-	-1,  1, 1,    // back left
-	-1,  1, 1,    // back right
-	-1,  1, 1,    // middle right
-	-1,  1, 1     // front right
-};
-
-#ifndef DUMMY
-static const int8_t SERVO_TRIM[Servo::NSERVOS] = {
-	// ankle, knee, hip
-	 10, 20,   7,    // front left
-	 20, 20,   0,    // middle left
-	  0,  0,   0,    // back left
-	 20, 20,  10,    // back right
-	 20, 30, -10,    // middle right
-	 22, 30,  15     // front right
-};
-#else
-static const int8_t SERVO_TRIM[Servo::NSERVOS]{0,0,0,0,0,0,0,0,0,0,0,0};
-#endif
-
-void Servo::updateServo(uint8_t channel, float angle)
+	// the boards that need programming all wait for their oscillators together
+	int wait_us= 0;
+	startup.reprogrammed= 0;
+	for(auto b : boards) {
+		int us= b->startPWMFreq(pwm_frequency, fast_start); // actual 60Hz is 17.39 57.5Hz
+		if(us > 0) ++startup.reprogrammed;
+		wait_us= std::max(wait_us, us);
+	}
+	auto t2= clock::now();
+	if(wait_us > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+	auto t3= clock::now();
+	for(auto b : boards) b->finishPWMFreq();
+	auto t4= clock::now();
+	startup.boards= boards.size();
+	startup.open_ms= ms(t0, t1);
+	startup.program_ms= ms(t1, t2) + ms(t3, t4);
+	startup.settle_ms= ms(t2, t3);
+
+	// the first bus is flushed from the thread doing the write
+	for (size_t i = 1; i < buses.size(); ++i) buses[i]->startWorker();
+	for (int ch = 0; ch < NSERVOS; ++ch) current_angle[ch]= 9999.9;
+}
+
+template<class RobotT>
+bool BasicServo<RobotT>::loadTopology(const char *fn)
+{
+	if(outputRunning()) {
+		fprintf(stderr, "Topology: can't change the boards while the output thread runs\n");
+		return false;
+	}
+
+	FILE *fp= fopen(fn, "r");
+	if(fp == nullptr) {
+		fprintf(stderr, "Topology: unable to open %s\n", fn);
+		return false;
+	}
+
+	// a board is a bus and address, in the order they first appear
+	std::vector<std::pair<int, int>> found;
+	int board[NSERVOS], port[NSERVOS];
+	for (int i = 0; i < NSERVOS; ++i) board[i]= -1;
+	char line[128];
+	int n= 0;
+	bool ok= true;
+	while(ok && fgets(line, sizeof(line), fp) != nullptr) {
+		++n;
+		char *c= strchr(line, '#');
+		if(c != nullptr) *c= '\0';
+		int ch, bus, address, p;
+		int r= sscanf(line, "%i %i %i %i", &ch, &bus, &address, &p);
+		if(r <= 0) continue; // blank or comment
+		if(r != 4 || ch < 0 || ch >= NSERVOS || p < 0 || p > 15 || board[ch] >= 0) {
+			fprintf(stderr, "Topology: bad line %d in %s\n", n, fn);
+			ok= false;
+			break;
+		}
+		auto i= std::find(found.begin(), found.end(), std::make_pair(bus, address));
+		board[ch]= i - found.begin();
+		if(i == found.end()) found.push_back(std::make_pair(bus, address));
+		port[ch]= p;
+		for (int o = 0; o < NSERVOS; ++o) {
+			if(o != ch && board[o] == board[ch] && port[o] == p) {
+				fprintf(stderr, "Topology: channels %d and %d are both on port %d of the board at 0x%02X\n", o, ch, p, address);
+				ok= false;
+			}
+		}
+	}
+	fclose(fp);
+
+	for (int ch = 0; ok && ch < NSERVOS; ++ch) {
+		if(backend == ServoBackend::GPIO && ch >= 16 && board[ch] < 0) continue; // stays on the GPIO PWM
+		if(board[ch] < 0) {
+			fprintf(stderr, "Topology: channel %d is not on a board in %s\n", ch, fn);
+			ok= false;
+		}
+	}
+	if(!ok) return false;
+
+	setBoards(found);
+	for (int ch = 0; ch < NSERVOS; ++ch) {
+		board_of[ch]= board[ch] < 0 ? NO_BOARD : board[ch];
+		port_of[ch]= board[ch] < 0 ? ch : port[ch];
+	}
+	return true;
+}
+
+// flush the staged writes of every board, the buses at the same time
+template<class RobotT>
+void BasicServo<RobotT>::flush()
+{
+	auto t= std::chrono::steady_clock::now();
+	for (size_t i = 1; i < buses.size(); ++i) buses[i]->kick();
+	buses[0]->flush();
+	for (size_t i = 1; i < buses.size(); ++i) buses[i]->wait();
+	flush_timing.add(std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - t).count());
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::clearTiming()
+{
+	for(auto b : buses) b->clearTiming();
+	flush_timing= ServoBus::Timing();
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::updateServo(uint8_t channel, float angle)
 {
 	if(channel >= NSERVOS) throw std::invalid_argument("channel");
 
@@ -99,38 +257,329 @@ void Servo::updateServo(uint8_t channel, float angle)
 		if(angle < 0 || angle > 180) printf("WARNING: angle is too big for channel %d, %f\n", channel ,angle);
 	}
 
-	// check if any change to avoid unecessary I2C traffic
-	if(angle == current_angle[channel]) return;
+	if(outputRunning()) {
+		// the output thread owns the boards, this goes out with the next frame
+		frame.angle[channel]= angle;
+		frame.mask |= 1UL << channel;
+		frame.tick_mask &= ~(1UL << channel);
+		commit();
+		return;
+	}
+
+	// check if any change to avoid unecessary I2C traffic, the boards do that on the PWM count
+	if(!suppresses(channel) && angle == current_angle[channel]) return;
 
 	current_angle[channel]= angle;
+	write(channel, angle, false);
+}
 
-#ifndef DUMMY
+// true if the channel is on a board that suppresses writes that don't change its PWM count
+template<class RobotT>
+bool BasicServo<RobotT>::suppresses(uint8_t channel) const
+{
+	return backend != ServoBackend::DUMMY && onBoard(channel);
+}
 
-#ifdef USEGPIO
-	if(channel >= 0 && channel <= 15) {
-		servos->servo(channel, type, angle);
-	}else{
+template<class RobotT>
+void BasicServo<RobotT>::setHysteresis(uint8_t channel, uint16_t ticks)
+{
+	if(channel >= NSERVOS) throw std::invalid_argument("channel");
+	if(!onBoard(channel)) return;
+
+	boards[board_of[channel]]->setHysteresis(port_of[channel], ticks);
+}
+
+// the board a channel is on, channel becomes the port on it. only for channels that are onBoard()
+template<class RobotT>
+template<class Out>
+typename Out::Board *BasicServo<RobotT>::boardFor(uint8_t& channel) const
+{
+	auto *b= static_cast<typename Out::Board*>(boards[board_of[channel]]);
+	channel= port_of[channel];
+	return b;
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::write(uint8_t channel, float angle, bool staged)
+{
+	switch(backend) {
+		case ServoBackend::PCA9685: writeAs<PCA9685Output>(channel, angle, staged); break;
+		case ServoBackend::GPIO: writeAs<GpioOutput>(channel, angle, staged); break;
+		case ServoBackend::DUMMY: writeAs<DummyOutput>(channel, angle, staged); break;
+		case ServoBackend::RECORD: writeAs<RecordOutput>(channel, angle, staged); break;
+	}
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::writeTicks(uint8_t channel, uint16_t ticks, bool staged)
+{
+	switch(backend) {
+		case ServoBackend::PCA9685: writeTicksAs<PCA9685Output>(channel, ticks, staged); break;
+		case ServoBackend::GPIO: writeTicksAs<GpioOutput>(channel, ticks, staged); break;
+		case ServoBackend::DUMMY: writeTicksAs<DummyOutput>(channel, ticks, staged); break;
+		case ServoBackend::RECORD: writeTicksAs<RecordOutput>(channel, ticks, staged); break;
+	}
+}
+
+template<class RobotT>
+int BasicServo<RobotT>::writeFrame(const Frame& f, uint32_t mask)
+{
+	switch(backend) {
+		case ServoBackend::GPIO: return writeFrameAs<GpioOutput>(f, mask);
+		case ServoBackend::DUMMY: return writeFrameAs<DummyOutput>(f, mask);
+		case ServoBackend::RECORD: return writeFrameAs<RecordOutput>(f, mask);
+		default: return writeFrameAs<PCA9685Output>(f, mask);
+	}
+}
+
+// to the board for the channel, staged on it for the next flush or written now
+template<class RobotT>
+template<class Out>
+void BasicServo<RobotT>::writeAs(uint8_t channel, float angle, bool staged)
+{
+	if(Out::gpio && !onBoard(channel)) {
 		pwm->setAngle(channel-16, angle);
+		return;
+	}
+	auto *board= boardFor<Out>(channel);
+	if(staged) board->stage(channel, type, angle);
+	else board->servo(channel, type, angle);
+}
+
+// the same for a pulse in PWM ticks, only calibrated channels which are all on a board
+template<class RobotT>
+template<class Out>
+void BasicServo<RobotT>::writeTicksAs(uint8_t channel, uint16_t ticks, bool staged)
+{
+	auto *board= boardFor<Out>(channel);
+	if(staged) board->stageTicks(channel, ticks);
+	else board->setTicks(channel, ticks);
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::stage(uint8_t channel, float rads)
+{
+	if(channel >= NSERVOS) throw std::invalid_argument("channel");
+
+	uint32_t bit= 1UL << channel;
+	if(calibrated & bit) {
+		frame.ticks[channel]= calibration.ticks(channel, rads);
+		frame.tick_mask |= bit;
+	}else{
+		frame.angle[channel]= toAngle(channel, rads);
+		frame.tick_mask &= ~bit;
 	}
-#else
-	if(channel <= 8) {
-		servos->servo(channel, type, angle);
+	frame.mask |= bit;
+}
+
+template<class RobotT>
+int BasicServo<RobotT>::commit()
+{
+	uint32_t staged= frame.mask;
+	if(staged == 0) return 0;
+	if(!enabled) enableServos(true);
+
+	int n;
+	if(outputRunning()) {
+		// channels not staged this time keep what they were last given
+		for (uint8_t ch = 0; ch < NSERVOS; ++ch) {
+			if(staged & (1UL << ch)) {
+				published.angle[ch]= frame.angle[ch];
+				published.ticks[ch]= frame.ticks[ch];
+			}
+		}
+		published.mask |= staged;
+		published.tick_mask= (published.tick_mask & ~staged) | frame.tick_mask;
+		n= __builtin_popcount(staged);
+		frames.writeBuffer()= published;
+		if(frames.publish()) ++out_overwritten;
+		++out_published;
+
 	}else{
-		servos2->servo(channel-9, type, angle);
+		n= writeFrame(frame, staged);
 	}
-#endif
+	frame.mask= frame.tick_mask= 0;
+	return n;
+}
+
+// write the channels in mask that changed since they were last written
+template<class RobotT>
+template<class Out>
+int BasicServo<RobotT>::writeFrameAs(const Frame& f, uint32_t mask)
+{
+	int n= 0;
+	for (uint8_t ch = 0; ch < NSERVOS; ++ch) {
+		if(!(mask & (1UL << ch))) continue;
+		if(f.tick_mask & (1UL << ch)) {
+			writeTicksAs<Out>(ch, f.ticks[ch], frame_writes);
+			++n;
+			continue;
+		}
+		const float *angle= f.angle;
+		if(debug_verbose && (angle[ch] < 0 || angle[ch] > 180)) printf("WARNING: angle is too big for channel %d, %f\n", ch, angle[ch]);
+		if(!(Out::suppresses && onBoard(ch)) && angle[ch] == current_angle[ch]) continue;
+
+		current_angle[ch]= angle[ch];
+		writeAs<Out>(ch, angle[ch], frame_writes);
+		++n;
+	}
+
+	if(frame_writes) flush();
+	// a tick for the simulated buses
+	I2C::tick();
+	return n;
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::startOutput(float hz)
+{
+	if(outputRunning()) return;
+
+	// start from what the servos already have
+	for (uint8_t ch = 0; ch < NSERVOS; ++ch) published.angle[ch]= current_angle[ch];
+	published.mask= published.tick_mask= 0;
+	output_run= true;
+	output= std::thread(&BasicServo<RobotT>::outputLoop, this, hz > 0 ? hz : pwm_frequency);
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::stopOutput()
+{
+	if(!outputRunning()) return;
+
+	output_run= false;
+	output.join();
+	// the last frame may not have gone out yet
+	if(frames.update()) {
+		writeFrame(frames.readBuffer(), frames.readBuffer().mask);
+		++out_written;
+	}
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::outputLoop(float hz)
+{
+	using clock= std::chrono::steady_clock;
+	const auto period= std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / hz));
+	auto next= clock::now();
+	while(output_run) {
+		int64_t boundary= phase_lock != nullptr ? phase_lock->waitForSlot() : 0;
+		if(frames.update()) {
+			writeFrame(frames.readBuffer(), frames.readBuffer().mask);
+			++out_written;
+		}else{
+			++out_idle;
+		}
+		if(phase_lock != nullptr) {
+			// the lock keeps its own stats of late ticks
+			phase_lock->done(boundary);
+			continue;
+		}
+
+		next += period;
+		auto now= clock::now();
+		if(now > next) {
+			// overran the period, don't try to catch up as that would just write the same frame several times
+			++out_late;
+			next= now;
+		}
+		std::this_thread::sleep_until(next);
+	}
+}
 
-#else
-	servos->servo(channel, type, angle);
-#endif
+template<class RobotT>
+typename BasicServo<RobotT>::OutputStats BasicServo<RobotT>::outputStats() const
+{
+	return OutputStats { out_published, out_overwritten, out_written, out_idle, out_late };
+}
+
+template<class RobotT>
+float BasicServo<RobotT>::pwmFrequency() const
+{
+	return boards[0]->cycleFrequency();
+}
+
+template<class RobotT>
+int64_t BasicServo<RobotT>::pwmEpoch() const
+{
+	return boards[0]->restartTime();
+}
+
+template<class RobotT>
+BusStats BasicServo<RobotT>::busStats() const
+{
+	BusStats st {};
+	for(auto b : boards) st += b->getStats();
+	return st;
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::clearBusStats()
+{
+	for(auto b : boards) b->clearStats();
 }
 
 // Move a servo to a position in radians between -PI/2 and PI/2.
-void Servo::move(uint8_t channel, float rads)
+template<class RobotT>
+void BasicServo<RobotT>::move(uint8_t channel, float rads)
 {
 	if(channel >= NSERVOS) throw std::invalid_argument("channel");
 
-	rads = rads * SERVO_REVERSE[channel] + PI2;
+	if(calibrated & (1UL << channel)) {
+		if(!enabled) enableServos(true);
+		if(outputRunning()) {
+			stage(channel, rads);
+			commit();
+		}else{
+			writeTicks(channel, calibration.ticks(channel, rads), false);
+		}
+		return;
+	}
+
+	updateServo(channel, toAngle(channel, rads));
+}
+
+template<class RobotT>
+bool BasicServo<RobotT>::loadCalibration(const char *fn)
+{
+	if(!calibration.load(fn)) return false;
+
+	// every board runs at the same PWM frequency
+	calibration.compile(boards[0]->ticksPerMs());
+	calibrated= 0;
+	for (uint8_t ch = 0; ch < NSERVOS; ++ch) {
+		if(calibration.isCalibrated(ch) && onBoard(ch)) calibrated |= 1UL << ch;
+	}
+	if(calibrated != (calibration.calibratedMask() & ((1UL << NSERVOS) - 1))) {
+		fprintf(stderr, "WARNING: calibration ignored for channels that are not on a PWM board\n");
+	}
+	return true;
+}
+
+template<class RobotT>
+void BasicServo<RobotT>::setPulse(uint8_t channel, float us)
+{
+	if(channel >= NSERVOS || !onBoard(channel)) throw std::invalid_argument("channel");
+	if(outputRunning()) throw std::runtime_error("setPulse while the output thread is running");
+
+	if(!enabled) enableServos(true);
+	float t= roundf(us * boards[0]->ticksPerMs() / 1000);
+	writeTicks(channel, std::min(std::max(t, 0.0F), 4095.0F), false);
+}
+
+template<class RobotT>
+float BasicServo<RobotT>::defaultPulse(uint8_t channel, float rads) const
+{
+	if(channel >= NSERVOS) throw std::invalid_argument("channel");
+
+	return boards[0]->pulse(type, toAngle(channel, rads)) * 1000 / boards[0]->ticksPerMs();
+}
+
+// the raw servo angle in degrees for a joint in radians
+template<class RobotT>
+float BasicServo<RobotT>::toAngle(uint8_t channel, float rads) const
+{
+	rads = rads * RobotT::reverse[channel] + PI2;
 	while (rads > TAU) {
 		rads -= TAU;
 	}
@@ -138,16 +587,24 @@ void Servo::move(uint8_t channel, float rads)
 		rads += TAU;
 	}
 
-	float angle = (rads * 180.0F / M_PI) + SERVO_TRIM[channel];
+	// keep it in float, M_PI would promote this to double
+	return (rads * (180.0F / (float)M_PI)) + RobotT::trim[channel];
+}
 
-	//printf("rads %f, angle %f\n", rads, angle);
-	updateServo(channel, angle);
+template<class RobotT>
+float BasicServo<RobotT>::toRads(uint8_t channel, float angle) const
+{
+	if(channel >= NSERVOS) throw std::invalid_argument("channel");
+
+	float rads = (angle - RobotT::trim[channel]) * M_PI / 180.0F;
+	return (rads - PI2) * RobotT::reverse[channel];
 }
 
-void Servo::enableServos(bool on)
+template<class RobotT>
+void BasicServo<RobotT>::enableServos(bool on)
 {
-#ifndef DUMMY
-	enable_pin->write(on?0:1);
-#endif
+	if(enable_pin != nullptr) enable_pin->write(on?0:1);
 	enabled= on;
 }
+
+template class BasicServo<Robot>;
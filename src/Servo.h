@@ -1,57 +1,166 @@
 #pragma once
 
-#include <cstdint>
+#include "Robot.h"
+#include "BusStats.h"
+#include "TripleBuffer.h"
+#include "Calibration.h"
+#include "ServoBus.h"
 
-//#define DUMMY 1
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 extern bool debug_verbose;
 
-#ifndef DUMMY
-//#define USEGPIO 1
-class adafruitss;
+class PhaseLock;
+
 namespace mraa {
 	class Gpio;
 };
 
-#ifdef USEGPIO
-class PWM;
-#endif
-
-#else
-#include <stdio.h>
-class DummyServo
-{
-public:
-	void servo(uint8_t channel, uint8_t type, float a) { if(debug_verbose) printf("channel: %d, angle: %f\n", channel, a); }
-};
-
-#endif
-
-class Servo
+// servo outputs for the robot described by RobotT, which supplies the reversal and trim of each channel
+template<class RobotT>
+class BasicServo
 {
 public:
-	Servo();
-	~Servo();
+	BasicServo();
+	~BasicServo();
+	// open the boards of a backend (-o) in the default layout, before anything else. pca9685 is two boards on
+	// bus 6 at 0x40 and 0x41 with the enable pin, gpio one board for channels 0-15 and the GPIO PWM for the rest,
+	// dummy and record one board without any hardware
+	void open(ServoBackend b);
+	ServoBackend getBackend() const { return backend; }
+	// boards that already run at the PWM frequency (from a previous run) are left as they are unless this is
+	// off (-r), they start straight away but the PWM phase is unknown until a -p sync
+	void setFastStart(bool on) { fast_start= on; }
+	// how long the last open() or loadTopology() took setting up the boards
+	struct StartupTiming {
+		int boards;
+		int reprogrammed; // the others were already set
+		float open_ms; // opening the buses and creating the boards
+		float program_ms; // reading back and programming the boards
+		float settle_ms; // waiting for their oscillators after a wake up
+		float enable_ms; // the enable pin (open() only)
+	};
+	const StartupTiming& startupTiming() const { return startup; }
 	void move(uint8_t port, float rads);
+	// the radians move() would take to put the servo at this raw angle
+	float toRads(uint8_t channel, float angle) const;
 	void updateServo(uint8_t channel, float angle);
 	void enableServos(bool on);
 	bool isEnabled() const { return enabled; }
 
-	const static uint8_t NSERVOS= 18;
+	// frame API, stage() records a channel for the next frame without writing it and commit() writes every staged
+	// channel, the boards drop the ones that come to the PWM count they already have. returns how many were
+	// passed to the boards (or published)
+	void stage(uint8_t channel, float rads);
+	int commit();
+
+	// output thread, while it runs commits (and single writes) publish the whole frame and the thread writes the
+	// latest published frame to the boards every 1/hz seconds (0 is the PWM frequency). frames published faster
+	// than that are dropped, not queued
+	void startOutput(float hz= 0);
+	void stopOutput();
+	bool outputRunning() const { return output.joinable(); }
+	struct OutputStats {
+		uint32_t published;
+		uint32_t overwritten; // published again before the thread wrote them
+		uint32_t written;
+		uint32_t idle; // periods with no new frame
+		uint32_t late; // periods the writes overran
+	};
+	OutputStats outputStats() const;
+	// with a phase lock (set before startOutput) the thread writes each frame just before a PWM cycle starts
+	void setPhaseLock(PhaseLock *pl) { phase_lock= pl; }
+	// the PWM cycle of the first board and when it was started, in PhaseLock time
+	float pwmFrequency() const;
+	int64_t pwmEpoch() const;
+	// with frame writes on a commit is one auto increment flush per board (-F), otherwise a write per channel
+	void setFrameWrites(bool on) { frame_writes= on; }
+	bool frameWrites() const { return frame_writes; }
+	// calibrated channels go straight from joint angle to PWM ticks through the tables in the file (-u),
+	// without the servo type, trim or reverse
+	bool loadCalibration(const char *fn);
+	const Calibration& getCalibration() const { return calibration; }
+	// write a raw pulse width in us to a board channel, for capturing a calibration
+	void setPulse(uint8_t channel, float us);
+	// the pulse width in us move() gives a joint angle without calibration
+	float defaultPulse(uint8_t channel, float rads) const;
+
+	// writes to a board channel that come within ticks PWM counts of what it already has are suppressed
+	void setHysteresis(uint8_t channel, uint16_t ticks);
+	// I2C traffic of all the boards, the last_ counts are of the last flush
+	BusStats busStats() const;
+	void clearBusStats();
+
+	// board topology, lines of "channel bus address port" (-t) replace the default two boards on bus 6 at 0x40
+	// and 0x41. every channel has to be given, except with the gpio backend the ones from 16 on stay on the GPIO PWM.
+	// with boards on several buses a frame write (-F) flushes the buses at the same time
+	bool loadTopology(const char *fn);
+	int numBuses() const { return buses.size(); }
+	const ServoBus& getBus(int i) const { return *buses[i]; }
+	// how long the frame flushes took over all the buses
+	const ServoBus::Timing& flushTiming() const { return flush_timing; }
+	void clearTiming();
+
+	const static uint8_t NSERVOS= RobotT::NSERVOS;
 
 private:
-#ifndef DUMMY
-	adafruitss* servos;
-	#ifdef USEGPIO
-	PWM *pwm;
-	#else
-	adafruitss* servos2;
-	#endif
-	mraa::Gpio* enable_pin;
-#else
-	DummyServo* servos;
-#endif
+	const static uint8_t NO_BOARD= 0xFF;
+	std::vector<ServoBoard*> boards;
+	std::vector<ServoBus*> buses;
+	std::vector<std::pair<int, int>> board_address; // bus and address of each board
+	uint8_t board_of[NSERVOS]; // index in boards or NO_BOARD
+	uint8_t port_of[NSERVOS];
+	ServoBus::Timing flush_timing {};
+	ServoBackend backend= ServoBackend::PCA9685;
+	bool fast_start= true;
+	StartupTiming startup {};
+	PWM *pwm= nullptr; // gpio backend
+	mraa::Gpio* enable_pin= nullptr; // the hardware backends
 	const uint8_t type= 1;
-	float current_angle[NSERVOS];
+	// a calibrated channel is set in ticks, the others by angle
+	struct Frame {
+		float angle[RobotT::NSERVOS];
+		uint16_t ticks[RobotT::NSERVOS];
+		uint32_t mask; // channels that have been set
+		uint32_t tick_mask; // of those the ones set in ticks
+	};
+
+	float toAngle(uint8_t channel, float rads) const;
+	bool onBoard(uint8_t channel) const { return board_of[channel] != NO_BOARD; }
+	bool suppresses(uint8_t channel) const;
+	int addBoard(int bus, int address);
+	void clearBoards();
+	void setBoards(std::vector<std::pair<int, int>> addresses);
+	void flush();
+	// these switch on the backend once and call the versions for its output policy Out, which go straight to the
+	// board type
+	void write(uint8_t channel, float angle, bool staged);
+	void writeTicks(uint8_t channel, uint16_t ticks, bool staged);
+	int writeFrame(const Frame& f, uint32_t mask);
+	template<class Out> typename Out::Board *boardFor(uint8_t& channel) const;
+	template<class Out> void writeAs(uint8_t channel, float angle, bool staged);
+	template<class Out> void writeTicksAs(uint8_t channel, uint16_t ticks, bool staged);
+	template<class Out> int writeFrameAs(const Frame& f, uint32_t mask);
+	void outputLoop(float hz);
+
+	float current_angle[NSERVOS]; // also the last committed frame
+	Frame frame; // staged, mask is the channels staged since the last commit
+	Calibration calibration;
+	uint32_t calibrated= 0; // calibrated channels on a board
 	bool enabled;
+	bool frame_writes= false;
+	const float pwm_frequency= 60;
+
+	std::thread output;
+	std::atomic<bool> output_run {false};
+	PhaseLock *phase_lock= nullptr;
+	TripleBuffer<Frame> frames;
+	Frame published; // what the output thread is given, all the channels set so far
+	uint32_t out_published= 0, out_overwritten= 0;
+	std::atomic<uint32_t> out_written {0}, out_idle {0}, out_late {0};
 };
+
+using Servo = BasicServo<Robot>;
@@ -0,0 +1,131 @@
+#include "ServoBoard.h"
+#include "PhaseLock.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+const char *backendName(ServoBackend b)
+{
+	switch(b) {
+		case ServoBackend::GPIO: return "gpio";
+		case ServoBackend::DUMMY: return "dummy";
+		case ServoBackend::RECORD: return "record";
+		default: return "pca9685";
+	}
+}
+
+bool parseBackend(const char *name, ServoBackend& b)
+{
+	for(ServoBackend i : { ServoBackend::PCA9685, ServoBackend::GPIO, ServoBackend::DUMMY, ServoBackend::RECORD }) {
+		if(strcmp(name, backendName(i)) == 0) {
+			b= i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// servo type 1, 0.6ms to 2.4ms
+uint16_t DummyBoard::pulse(uint8_t, float a) const
+{
+	return roundf((0.6F + a / 100) * ticksPerMs());
+}
+
+void DummyBoard::printAngle(uint8_t port, float a)
+{
+	printf("channel: %d, angle: %f\n", port, a);
+}
+
+void DummyBoard::printTicks(uint8_t port, uint16_t t)
+{
+	printf("channel: %d, ticks: %d\n", port, t);
+}
+
+bool RecordBoard::recording= false;
+std::mutex RecordBoard::boards_mutex;
+std::vector<RecordBoard*> RecordBoard::boards;
+
+RecordBoard::RecordBoard(int bus, int address) : bus(bus), address(address), keep(recording)
+{
+	memset(written, 0xFF, sizeof(written));
+	memset(hysteresis, 0, sizeof(hysteresis));
+	// a gait of a few minutes without growing
+	if(keep) writes.reserve(1 << 16);
+	std::lock_guard<std::mutex> l(boards_mutex);
+	boards.push_back(this);
+}
+
+RecordBoard::~RecordBoard()
+{
+	std::lock_guard<std::mutex> l(boards_mutex);
+	boards.erase(std::find(boards.begin(), boards.end(), this));
+}
+
+void RecordBoard::record(uint8_t port, uint16_t t)
+{
+	if(keep) writes.push_back(Write { PhaseLock::now(), t, port });
+	written[port]= t;
+	dirty &= ~(1 << port);
+	stats.bytes += 5;
+}
+
+int RecordBoard::flush()
+{
+	stats.last_transactions= stats.last_bytes= 0;
+	stats.issued += __builtin_popcount(dirty);
+	stats.suppressed += __builtin_popcount(touched & ~dirty);
+	touched= 0;
+	if(dirty == 0) return 0;
+
+	// a PCA9685 would take each run of changed ports as one auto increment write
+	stats.last_transactions= __builtin_popcount(dirty & ~(dirty << 1));
+	stats.last_bytes= stats.last_transactions + 4 * __builtin_popcount(dirty);
+	int64_t t= keep ? PhaseLock::now() : 0;
+	for (int p = 0; p < 16; ++p) {
+		if(dirty & (1 << p)) {
+			if(keep) writes.push_back(Write { t, staged[p], (uint8_t)p });
+			written[p]= staged[p];
+		}
+	}
+	dirty= 0;
+
+	++stats.frames;
+	stats.transactions += stats.last_transactions;
+	stats.bytes += stats.last_bytes;
+	return stats.last_transactions;
+}
+
+bool RecordBoard::save(const char *fn)
+{
+	FILE *fp= fopen(fn, "w");
+	if(fp == nullptr) {
+		fprintf(stderr, "RecordBoard: unable to write %s\n", fn);
+		return false;
+	}
+
+	struct Line {
+		int64_t t_ns;
+		int bus, address, port, ticks;
+	};
+	std::vector<Line> lines;
+	int64_t start= INT64_MAX;
+	{
+		std::lock_guard<std::mutex> l(boards_mutex);
+		for(auto b : boards) {
+			for(auto& w : b->writes) {
+				lines.push_back(Line { w.t_ns, b->bus, b->address, w.port, w.ticks });
+				start= std::min(start, w.t_ns);
+			}
+		}
+	}
+	std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.t_ns < b.t_ns; });
+
+	fprintf(fp, "# t_us bus address port ticks\n");
+	for(auto& l : lines) {
+		fprintf(fp, "%lld %d 0x%02X %d %d\n", (long long)(l.t_ns - start) / 1000, l.bus, l.address, l.port, l.ticks);
+	}
+	fclose(fp);
+	return true;
+}
@@ -0,0 +1,159 @@
+/**
+	The PWM boards the servos are driven through, and the output backends that pick one at startup (-o).
+	A backend is a policy naming its board type, so the per channel calls (servo, stage, setTicks, stageTicks) bind
+	to the board statically and inline. Servo switches on the backend once per frame or single write, the virtual
+	calls of ServoBoard are only the per board ones, flushing a frame, stats and the PWM setup.
+*/
+
+#pragma once
+
+#include "BusStats.h"
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+extern bool debug_verbose;
+
+class ServoBoard
+{
+public:
+	virtual ~ServoBoard() {}
+
+	// set the PWM frequency in two steps, returns the us to wait before the finish (0 if there is nothing to
+	// finish), so the boards can all wait together. reuse leaves a board that is already set alone
+	virtual int startPWMFreq(float freq, bool reuse) = 0;
+	virtual void finishPWMFreq() = 0;
+	// the pulse in PWM ticks for an angle of a servo type, see adafruitss::servo
+	virtual uint16_t pulse(uint8_t type, float a) const = 0;
+	virtual float ticksPerMs() const = 0;
+	virtual float cycleFrequency() const = 0;
+	virtual int64_t restartTime() const = 0;
+	virtual void setHysteresis(uint8_t port, uint16_t n) = 0;
+	// write the staged ports
+	virtual int flush() = 0;
+	virtual const BusStats& getStats() const = 0;
+	virtual void clearStats() = 0;
+};
+
+enum class ServoBackend { PCA9685, GPIO, DUMMY, RECORD };
+
+// pca9685, gpio, dummy or record
+const char *backendName(ServoBackend b);
+bool parseBackend(const char *name, ServoBackend& b);
+
+// stands in for a PCA9685 at 60Hz, printing what it is given with -v
+class DummyBoard : public ServoBoard
+{
+public:
+	int startPWMFreq(float, bool) override { return 0; }
+	void finishPWMFreq() override {}
+	uint16_t pulse(uint8_t type, float a) const override;
+	float ticksPerMs() const override { return 4096 * 60 / 1000.0F; }
+	float cycleFrequency() const override { return 60; }
+	int64_t restartTime() const override { return 0; }
+	void setHysteresis(uint8_t, uint16_t) override {}
+	int flush() override { return 0; }
+	const BusStats& getStats() const override { return stats; }
+	void clearStats() override { stats= BusStats(); }
+
+	void servo(uint8_t port, uint8_t, float a) { if(debug_verbose) printAngle(port, a); }
+	void stage(uint8_t port, uint8_t type, float a) { servo(port, type, a); }
+	void setTicks(uint8_t port, uint16_t t) { if(debug_verbose) printTicks(port, t); }
+	void stageTicks(uint8_t port, uint16_t t) { setTicks(port, t); }
+
+protected:
+	BusStats stats {};
+
+private:
+	static void printAngle(uint8_t port, float a);
+	static void printTicks(uint8_t port, uint16_t t);
+};
+
+// counts the pulses it is given, and with recording on keeps each one and when, without any hardware. like a PCA9685 it drops the pulses that don't
+// change the count by more than the hysteresis, and a frame goes out at the flush
+class RecordBoard : public DummyBoard
+{
+public:
+	RecordBoard(int bus, int address);
+	~RecordBoard();
+
+	RecordBoard(const RecordBoard&) = delete;
+	RecordBoard& operator=(const RecordBoard&) = delete;
+
+	void setHysteresis(uint8_t port, uint16_t n) override { hysteresis[port]= n; }
+	int flush() override;
+
+	void servo(uint8_t port, uint8_t type, float a) { setTicks(port, pulse(type, a)); }
+	void stage(uint8_t port, uint8_t type, float a) { stageTicks(port, pulse(type, a)); }
+	void setTicks(uint8_t port, uint16_t t)
+	{
+		if(!changed(port, t)) {
+			++stats.suppressed;
+			return;
+		}
+		record(port, t);
+		++stats.issued;
+		++stats.transactions;
+	}
+	void stageTicks(uint8_t port, uint16_t t)
+	{
+		staged[port]= t;
+		touched |= 1 << port;
+		if(changed(port, t)) dirty |= 1 << port;
+		else dirty &= ~(1 << port);
+	}
+
+	struct Write {
+		int64_t t_ns; // PhaseLock::now()
+		uint16_t ticks;
+		uint8_t port;
+	};
+	// keep the writes of the boards made from now on, off unless they are to be saved as the list grows for as
+	// long as the program runs
+	static void setRecording(bool on) { recording= on; }
+	const std::vector<Write>& getWrites() const { return writes; }
+	// every write of the boards there are now, in time order, as "t_us bus address port ticks" lines
+	static bool save(const char *fn);
+
+private:
+	bool changed(uint8_t port, uint16_t t) const
+	{
+		int diff= (int)t - written[port];
+		return written[port] == 0xFFFF || diff > hysteresis[port] || diff < -hysteresis[port];
+	}
+	void record(uint8_t port, uint16_t t);
+
+	int bus, address;
+	bool keep;
+	uint16_t staged[16], written[16], hysteresis[16];
+	uint16_t dirty= 0, touched= 0;
+	std::vector<Write> writes;
+
+	static bool recording;
+	static std::mutex boards_mutex;
+	static std::vector<RecordBoard*> boards;
+};
+
+class adafruitss;
+class PWM;
+
+// the backends, Board is what the channels on a board are written through
+struct PCA9685Output {
+	using Board= adafruitss;
+	static const bool suppresses= true; // the board drops writes that don't change its count
+	static const bool gpio= false; // channels without a board are on the GPIO PWM
+};
+struct GpioOutput : PCA9685Output {
+	static const bool gpio= true;
+};
+struct DummyOutput {
+	using Board= DummyBoard;
+	static const bool suppresses= false;
+	static const bool gpio= false;
+};
+struct RecordOutput {
+	using Board= RecordBoard;
+	static const bool suppresses= true;
+	static const bool gpio= false;
+};
@@ -0,0 +1,66 @@
+#include "ServoBus.h"
+
+#include <chrono>
+
+void ServoBus::Timing::add(float us)
+{
+	++flushes;
+	last_us= us;
+	if(us > max_us) max_us= us;
+	total_us += us;
+}
+
+void ServoBus::flush()
+{
+	auto t= std::chrono::steady_clock::now();
+	for(auto b : boards) b->flush();
+	timing.add(std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - t).count());
+}
+
+void ServoBus::startWorker()
+{
+	if(hasWorker()) return;
+	quit= false;
+	worker= std::thread(&ServoBus::run, this);
+}
+
+void ServoBus::stopWorker()
+{
+	if(!hasWorker()) return;
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		quit= true;
+	}
+	cv.notify_all();
+	worker.join();
+}
+
+void ServoBus::kick()
+{
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		++requested;
+	}
+	cv.notify_all();
+}
+
+void ServoBus::wait()
+{
+	std::unique_lock<std::mutex> l(mutex);
+	cv.wait(l, [this]() { return completed == requested; });
+}
+
+void ServoBus::run()
+{
+	std::unique_lock<std::mutex> l(mutex);
+	while(true) {
+		cv.wait(l, [this]() { return quit || requested != completed; });
+		if(quit) break;
+		// the boards are only touched here between kick() and wait(), so they don't need the lock
+		l.unlock();
+		flush();
+		l.lock();
+		++completed;
+		cv.notify_all();
+	}
+}
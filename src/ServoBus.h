@@ -0,0 +1,62 @@
+/**
+	The servo boards on one I2C bus.
+	A frame is flushed to each board on the bus in turn. When the servos are spread over several buses each bus
+	after the first gets its own worker thread, so the buses are written at the same time and the tick only takes
+	as long as the slowest bus rather than all of them.
+*/
+
+#pragma once
+
+#include "ServoBoard.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class ServoBus
+{
+public:
+	ServoBus(int bus) : bus(bus) {}
+	~ServoBus() { stopWorker(); }
+
+	ServoBus(const ServoBus&) = delete;
+	ServoBus& operator=(const ServoBus&) = delete;
+
+	int getBus() const { return bus; }
+	void add(ServoBoard *board) { boards.push_back(board); }
+	const std::vector<ServoBoard*>& getBoards() const { return boards; }
+
+	// flush every board on this thread
+	void flush();
+	// or hand the flush to the worker and wait for it later
+	void startWorker();
+	void stopWorker();
+	bool hasWorker() const { return worker.joinable(); }
+	void kick();
+	void wait();
+
+	// how long the flushes of this bus took
+	struct Timing {
+		uint32_t flushes;
+		float last_us, max_us, total_us;
+
+		float mean() const { return flushes ? total_us / flushes : 0; }
+		void add(float us);
+	};
+	const Timing& getTiming() const { return timing; }
+	void clearTiming() { timing= Timing(); }
+
+private:
+	void run();
+
+	int bus;
+	std::vector<ServoBoard*> boards;
+	Timing timing {};
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable cv;
+	uint32_t requested= 0, completed= 0; // flushes asked for and done by the worker
+	bool quit= false;
+};
@@ -0,0 +1,54 @@
+/**
+	Bounded lock free ring for one producer thread and one consumer thread.
+	The producer only writes head and the consumer only writes tail, so neither side ever waits on the other, a push
+	to a full ring or a pop from an empty one just fails. N must be a power of 2.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+template <typename T, size_t N>
+class SpscRing
+{
+	static_assert(N > 0 && (N & (N - 1)) == 0, "the ring size must be a power of 2");
+
+public:
+	// producer side, false if it is full
+	bool push(const T& v)
+	{
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if(h - tail.load(std::memory_order_acquire) == N) return false;
+		buf[h & (N - 1)] = v;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, false if it is empty
+	bool pop(T& v)
+	{
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if(head.load(std::memory_order_acquire) == t) return false;
+		v = buf[t & (N - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// from any thread, what was in it a moment ago
+	size_t size() const
+	{
+		uint32_t t = tail.load(std::memory_order_acquire);
+		uint32_t n = head.load(std::memory_order_acquire) - t;
+		return n < N ? n : N;
+	}
+	bool empty() const { return size() == 0; }
+	static constexpr size_t capacity() { return N; }
+
+private:
+	T buf[N];
+	// apart so the two sides don't share a cache line
+	alignas(64) std::atomic<uint32_t> head {0}; // next to push
+	alignas(64) std::atomic<uint32_t> tail {0}; // next to pop
+};
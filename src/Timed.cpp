@@ -1,109 +1,216 @@
 #include "Timed.h"
+#include "PhaseLock.h"
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <limits.h>
-#include <sys/sysinfo.h>
-#include <memory.h>
+#include <time.h>
+#include <errno.h>
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 
-Timed::Timed(float update_frequency)
+void TickHistogram::add(float us)
 {
-	timeInit();
-	this->usleep_time= round(1000000.0/update_frequency);
+	int b= us < 1 ? 0 : std::min(NBUCKETS - 1, 1 + (int)(4 * log2f(us)));
+	counts[b].fetch_add(1, std::memory_order_relaxed);
 }
 
-Timed::~Timed()
+void TickHistogram::clear()
+{
+	for(auto& c : counts) c.store(0, std::memory_order_relaxed);
+}
+
+uint32_t TickHistogram::total() const
 {
+	uint32_t n= 0;
+	for (int b = 0; b < NBUCKETS; ++b) n += count(b);
+	return n;
 }
 
-static inline uint64_t rdtsc(void)
+float TickHistogram::lower(int b)
 {
-    uint32_t lo, hi;
-    uint64_t returnVal;
-    /* We cannot use "=A", since this would use %rax on x86_64 */
-    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
-    returnVal = hi;
-    returnVal <<= 32;
-    returnVal |= lo;
+	return b == 0 ? 0 : exp2f((b - 1) / 4.0F);
+}
 
-    return returnVal;
+float TickHistogram::percentile(float p) const
+{
+	// one pass over a copy so the buckets add up while it is still ticking
+	uint32_t c[NBUCKETS], n= 0;
+	for (int b = 0; b < NBUCKETS; ++b) n += (c[b]= count(b));
+	if(n == 0) return 0;
+
+	uint32_t want= std::max(1U, (uint32_t)ceilf(p * n)), sum= 0;
+	for (int b = 0; b < NBUCKETS; ++b) {
+		sum += c[b];
+		if(sum >= want) return lower(b + 1);
+	}
+	return lower(NBUCKETS);
+}
+
+Timed::Timed(float update_frequency)
+{
+	start= nanos();
+	setFrequency(update_frequency);
+	clearStats();
 }
 
-/* TSC snapshot */
-bool Timed::timeInit(void)
+Timed::~Timed()
 {
-    int cpufreq_fd, ret;
-    char buf[0x400];
-    char * str = 0, * str2 = 0;
-    const char * mhz_str = "cpu MHz\t\t: ";
+}
 
-    /* Grab initial TSC snapshot */
-    tsc_init = rdtsc();
+void Timed::setFrequency(float update_frequency)
+{
+	this->period_ns= llround(1e9 / update_frequency);
+}
 
-    cpufreq_fd = open("/proc/cpuinfo", O_RDONLY);
-    if( cpufreq_fd < 0){
-        fprintf(stderr, "unable to open /proc/cpuinfo\n");
-        return false;
-    }
-    memset(buf, 0x00, sizeof(buf));
-    ret = read(cpufreq_fd, buf, sizeof(buf));
-    if ( ret < 0 ){
-        fprintf(stderr, "unable to read cpuinfo !\n");
-        close(cpufreq_fd);
-        return false;
-    }
-    close(cpufreq_fd);
-    str = strstr(buf, mhz_str);
-    if (!str){
-        fprintf(stderr, "Buffer %s does not contain CPU frequency info !\n", buf);
-        return false;
-    }
+int64_t Timed::nanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    str += strlen(mhz_str);
-    str2 = str;
+uint64_t Timed::micros( void )
+{
+	return (nanos() - start) / 1000;
+}
 
-    while(str2 < buf  + sizeof(buf)-1 && *str2 != '\n'){
-        str2++;
-    }
-    if(str2 == buf + sizeof(buf-1) && *str2 !='\n'){
-        fprintf(stderr, "malformed cpufreq string %s\n", str);
-        return false;
-    }
-    *str2 = '\0';
-    cpufreq = atof(str);
+void Timed::sleepUntil(int64_t t) const
+{
+	int64_t wake= t - spin_ns;
+	struct timespec ts;
+	ts.tv_sec= wake / 1000000000;
+	ts.tv_nsec= wake % 1000000000;
+	// a signal wakes it early, the deadline is absolute so it just goes back to sleep
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+	if(spin_ns > 0) {
+		while(nanos() < t) {}
+	}
+}
 
+const char *Timed::overrunName(Overrun o)
+{
+	switch(o) {
+		case Overrun::DROP: return "drop";
+		case Overrun::CATCH_UP: return "catchup";
+		default: return "stretch";
+	}
+}
 
-    //printf("cpufrequency is %f mhz\n", cpufreq);
+bool Timed::parseOverrun(const char *name, Overrun& o)
+{
+	for(Overrun i : { Overrun::STRETCH, Overrun::DROP, Overrun::CATCH_UP }) {
+		if(strcmp(name, overrunName(i)) == 0) {
+			o= i;
+			return true;
+		}
+	}
+	return false;
+}
 
-    /* Calculate nanoseconds per clock */
-    clocks_per_ns = 1000/cpufreq;
+int64_t Timed::waitForSlot()
+{
+	return phase_lock->waitForSlot();
+}
 
-    //printf("nanoseconds per clock %f\n", clocks_per_ns);
-    return true;
+void Timed::slotDone(int64_t boundary, int64_t started)
+{
+	exec_hist.add((nanos() - started) / 1000.0F);
+	phase_lock->done(boundary);
 }
 
-uint32_t Timed::micros( void )
+uint32_t Timed::endTick(int64_t started, int64_t& deadline, uint32_t left)
 {
-    uint64_t tsc_cur = rdtsc(), diff = 0, divisor = 0;
+	int64_t now= nanos();
+	exec_hist.add((now - started) / 1000.0F);
+
+	uint32_t steps= 1;
+	deadline += period_ns;
+	if(now > deadline) {
+		++overruns;
+		overrun_hist.add((now - deadline) / 1000.0F);
+		switch(overrun) {
+			case Overrun::STRETCH:
+				// start again from here, the missed time is lost
+				deadline= now;
+				break;
+			case Overrun::DROP: {
+				// the next tick goes now, as the last of the ones due, and makes their steps too
+				int64_t missed= (now - deadline) / period_ns;
+				deadline += missed * period_ns;
+				if(left > 0) {
+					steps= std::min<int64_t>(1 + missed, left);
+					dropped += steps - 1;
+				}
+			} break;
+			case Overrun::CATCH_UP:
+				// the deadline has passed so the next tick goes straight away, as do the ones after it
+				// until one finishes before its deadline
+				break;
+		}
+	}
+	sleepUntil(deadline);
+
+	float us= (nanos() - deadline) / 1000.0F;
+	wake_hist.add(us);
+	if(ticks == 0 || us < min_us) min_us= us;
+	if(ticks == 0 || us > max_us) max_us= us;
+	sum_us += us;
+	sum2_us += us * us;
+	++ticks;
+	return steps;
+}
 
-    divisor = (cpufreq );
-    diff = tsc_cur - tsc_init;
+Timed::Stats Timed::getStats() const
+{
+	Stats st {};
+	st.ticks= ticks;
+	st.overruns= overruns;
+	st.dropped= dropped;
+	st.allocations= allocations;
+	if(ticks == 0) return st;
+
+	st.rate= run_ns > 0 ? ticks * 1e9 / run_ns : 0;
+	st.min_us= min_us;
+	st.max_us= max_us;
+	st.mean_us= sum_us / ticks;
+	st.sd_us= sqrt(std::max(0.0, sum2_us / ticks - st.mean_us * st.mean_us));
+	return st;
+}
 
-    return (uint32_t) (diff / divisor);
+void Timed::clearStats()
+{
+	ticks= overruns= dropped= allocations= 0;
+	run_ns= 0;
+	min_us= max_us= sum_us= sum2_us= 0;
+	exec_hist.clear();
+	wake_hist.clear();
+	overrun_hist.clear();
 }
 
-void Timed::run(uint32_t iterations, std::function<void(void)> fnc)
+void Timed::printHistograms(FILE *fp) const
 {
-	for (uint32_t j = 0; j < iterations; ++j) {
-	    uint32_t t1= micros();
-	    fnc();
-		uint32_t t2= micros();
-		uint32_t t3= (t2>t1)?t2-t1:0;
+	const struct { const char *name; const TickHistogram& h; } all[] {
+		{ "exec", exec_hist }, { "wakeup", wake_hist }, { "overrun", overrun_hist }
+	};
+	fprintf(fp, "Tick histograms (us, %s on overrun, period %1.0f us):", overrunName(overrun), period_ns / 1000.0F);
+	for(auto& a : all) {
+		fprintf(fp, " %s %u: %1.0f/%1.0f/%1.0f/%1.0f", a.name, a.h.total(), a.h.percentile(0.5F), a.h.percentile(0.9F),
+			a.h.percentile(0.99F), a.h.max());
+	}
+	fprintf(fp, " p50/p90/p99/max\n");
+}
 
-		// adjust for length of time it took above
-		if(usleep_time > t3) {
-			usleep(usleep_time - t3);
-		}
+bool Timed::saveHistograms(const char *fn) const
+{
+	FILE *fp= fopen(fn, "w");
+	if(fp == nullptr) {
+		fprintf(stderr, "Unable to write %s: %s\n", fn, strerror(errno));
+		return false;
+	}
+	fprintf(fp, "# lower_us exec wakeup overrun\n");
+	for (int b = 0; b < TickHistogram::NBUCKETS; ++b) {
+		uint32_t e= exec_hist.count(b), w= wake_hist.count(b), o= overrun_hist.count(b);
+		if(e + w + o > 0) fprintf(fp, "%1.2f %u %u %u\n", TickHistogram::lower(b), e, w, o);
 	}
+	fclose(fp);
+	return true;
 }
@@ -1,10 +1,45 @@
 /**
 	Will execute the given function at the frequency specified
+	Ticks are scheduled on absolute CLOCK_MONOTONIC deadlines, each one period after the last, so the time a tick
+	takes and the wakeup latency don't add up into drift. With a spin the last part of the wait is a busy loop, which
+	wakes within a few us of the deadline instead of the tens to hundreds the scheduler gives.
+	A tick that runs past the next deadline is handled by the overrun policy, and every tick is counted into
+	histograms of how long it took, how late it woke and by how much it overran, which can be read from any thread
+	while the loop runs.
 */
 
 #pragma once
 
-#include <functional>
+#include "RealTime.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+
+class PhaseLock;
+
+// counts of a per tick time in buckets a quarter octave wide, from 1us to over 10s. Only the ticking thread adds,
+// any thread can read or clear it without a lock, a read taken while it ticks may be a tick or so behind
+class TickHistogram
+{
+public:
+	static const int NBUCKETS= 96;
+
+	TickHistogram() { clear(); }
+	void add(float us);
+	void clear();
+
+	uint32_t count(int b) const { return counts[b].load(std::memory_order_relaxed); }
+	uint32_t total() const;
+	// the lower edge of bucket b in us, bucket 0 is everything under 1us
+	static float lower(int b);
+	// the upper edge of the bucket the p'th fraction of the counts are in, 0 if there are none
+	float percentile(float p) const;
+	float max() const { return percentile(1); }
+
+private:
+	std::atomic<uint32_t> counts[NBUCKETS];
+};
 
 class Timed
 {
@@ -12,14 +47,105 @@ public:
 	Timed(float update_frequency);
 	~Timed();
 
-	// execute the lambda iterations times at the update frequency
-	void run(uint32_t iterations, std::function<void(void)> fnc);
-	uint32_t micros( void );
+	// what to do when a tick runs past the next deadline
+	enum class Overrun {
+		STRETCH,  // restart the schedule from the late tick, the move takes longer by the overrun
+		DROP,     // stay on the schedule, the next tick runs at once and covers every step that is due
+		CATCH_UP, // stay on the schedule, the missed ticks run back to back until it is caught up
+	};
+	static const char *overrunName(Overrun o);
+	static bool parseOverrun(const char *name, Overrun& o);
+	void setOverrun(Overrun o) { overrun= o; }
+	Overrun getOverrun() const { return overrun; }
+
+	// execute the lambda at the update frequency until it has made iterations steps. A tick makes one step, except
+	// with the drop policy where it is given the number of steps to cover, never more than are left.
+	// The lambda is called directly rather than through a std::function, which can allocate for its captures
+	template <typename F>
+	void run(uint32_t iterations, F fnc)
+	{
+		uint32_t j= 0;
+		if(iterations > 0) runWhile([&](uint32_t steps) { fnc(steps); j += steps; return iterations - j; });
+	}
+	// as run() for as long as the lambda has steps left, it returns how many are left after the ones it was given
+	template <typename F>
+	void runWhile(F fnc)
+	{
+		uint32_t left;
+		if(phase_lock != nullptr) {
+			// the lock has its own late and skipped cycle handling
+			do {
+				int64_t boundary= waitForSlot();
+				int64_t s= nanos();
+				left= fnc(1);
+				slotDone(boundary, s);
+			} while(left > 0);
+			return;
+		}
+
+		int64_t t0= nanos();
+		int64_t deadline= t0;
+		uint32_t steps= 1;
+		do {
+			uint64_t a= RealTime::allocations();
+			int64_t s= nanos();
+			left= fnc(steps);
+			allocations += RealTime::allocations() - a;
+			steps= endTick(s, deadline, left);
+		} while(left > 0);
+		run_ns += nanos() - t0;
+	}
+	void setFrequency(float update_frequency);
+	// run each iteration just before the next PWM cycle of the lock instead of at the update frequency, null to stop
+	void setPhaseLock(PhaseLock *pl) { phase_lock= pl; }
+	PhaseLock *getPhaseLock() const { return phase_lock; }
+	// sleep until ns before each deadline and spin the rest, 0 to only sleep
+	void setSpin(int64_t ns) { spin_ns= ns; }
+
+	// CLOCK_MONOTONIC, the same time base as PhaseLock::now()
+	static int64_t nanos();
+	// since this was created
+	uint64_t micros( void );
+	// sleep (and spin) until t in nanos()
+	void sleepUntil(int64_t t) const;
+
+	// of the ticks run at the update frequency, the wakeup error is how late each tick started after its deadline
+	struct Stats {
+		uint32_t ticks;
+		uint32_t overruns; // ticks that ran past the next deadline, handled by the overrun policy
+		uint32_t dropped; // steps the drop policy folded into later ticks
+		float rate; // achieved ticks per second
+		float min_us, mean_us, max_us, sd_us;
+		uint32_t allocations; // operator new calls made by the ticks, the tick path should make none
+	};
+	Stats getStats() const;
+	void clearStats();
+
+	// in us, how long each tick took, how late it woke after its deadline, and for the ticks that overran, by how
+	// much they did
+	const TickHistogram& execHistogram() const { return exec_hist; }
+	const TickHistogram& wakeHistogram() const { return wake_hist; }
+	const TickHistogram& overrunHistogram() const { return overrun_hist; }
+	// a line of percentiles from each histogram
+	void printHistograms(FILE *fp) const;
+	// every bucket that has a count, one per line of lower_us exec wake overrun
+	bool saveHistograms(const char *fn) const;
 
 private:
-	bool timeInit(void);
-	uint64_t tsc_init;
-	float cpufreq;
-	float clocks_per_ns;
-	uint32_t usleep_time;
+	int64_t waitForSlot();
+	void slotDone(int64_t boundary, int64_t started);
+	// after a tick that started at started, handles an overrun, sleeps until the next deadline and returns the steps
+	// the next tick is to make of the left ones
+	uint32_t endTick(int64_t started, int64_t& deadline, uint32_t left);
+
+	int64_t start;
+	int64_t period_ns;
+	int64_t spin_ns= 0;
+	PhaseLock *phase_lock= nullptr;
+	Overrun overrun= Overrun::STRETCH;
+
+	uint32_t ticks, overruns, dropped, allocations;
+	int64_t run_ns; // time spent in run()
+	double min_us, max_us, sum_us, sum2_us;
+	TickHistogram exec_hist, wake_hist, overrun_hist;
 };
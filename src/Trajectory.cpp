@@ -0,0 +1,234 @@
+#include "Trajectory.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#define RADIANS(a) ((a) * M_PI / 180.0F)
+
+const int Trajectory::CAPACITY;
+
+Trajectory::Trajectory(Body& body, std::vector<Leg>& legs, Timed& timed) : body(body), legs(legs), timed(timed)
+{
+}
+
+Trajectory::~Trajectory()
+{
+	stop();
+}
+
+void Trajectory::start(int depth)
+{
+	max_ahead= std::max(1, std::min(depth, CAPACITY));
+	if(running()) return;
+
+	stopping= false;
+	idle= true;
+	executor= std::thread(&Trajectory::execute, this);
+}
+
+void Trajectory::stop()
+{
+	if(!running()) return;
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		stopping= true;
+	}
+	wake.notify_one();
+	executor.join();
+}
+
+MoveResult Trajectory::drain()
+{
+	if(running()) {
+		std::unique_lock<std::mutex> lk(mutex);
+		idled.wait(lk, [this]() { return idle && ring.empty(); });
+	}
+	return collect();
+}
+
+MoveResult Trajectory::run(const Segment& seg)
+{
+	MoveResult r= collect();
+	if(!running()) {
+		Segment s= seg;
+		begin(s);
+		timed.run(s.ticks, [this, &s](uint32_t steps) { advance(s, steps); });
+		return r.ok() ? s.result : r;
+	}
+
+	// the planner is the only thread that pushes, so once there is room it stays
+	if(ring.size() >= max_ahead) {
+		++stats.waits;
+		std::unique_lock<std::mutex> lk(mutex);
+		room.wait(lk, [this]() { return ring.size() < max_ahead; });
+	}
+	ring.push(seg);
+	stats.max_depth= std::max<uint32_t>(stats.max_depth, ring.size());
+	{
+		// taken so the push can't fall between the executor finding it empty and going to sleep
+		std::lock_guard<std::mutex> lk(mutex);
+	}
+	wake.notify_one();
+	return r;
+}
+
+MoveResult Trajectory::collect()
+{
+	MoveResult r {MoveStatus::OK, 0};
+	if(!failed && !faulted) return r;
+
+	std::exception_ptr e;
+	{
+		std::unique_lock<std::mutex> lk(mutex);
+		if(faulted) {
+			// let the executor drop what was queued after it, so nothing planned before the planner knew runs
+			idled.wait(lk, [this]() { return idle && ring.empty(); });
+			e= fault;
+			fault= nullptr;
+			faulted= false;
+		}
+		r= failure;
+		failure= MoveResult {MoveStatus::OK, 0};
+		failed= false;
+	}
+	if(e) std::rethrow_exception(e);
+	return r;
+}
+
+void Trajectory::begin(Segment& seg)
+{
+	for (int l = 0; l < Robot::NLEGS; ++l) {
+		if(seg.lift & (1 << l)) legs[l].setOnGround(false);
+		if(seg.lower & (1 << l)) legs[l].setOnGround(true);
+	}
+	seg.done= 0;
+	seg.result= MoveResult {MoveStatus::OK, 0};
+	seg.slice= seg.ticks > 0 ? 1.0F / seg.ticks : 0; // the fraction of each move a tick makes
+
+	if(seg.kind == Segment::MOVE && !seg.relative) {
+		// nothing to interpolate from for a leg with no known position, it goes straight there
+		MoveSet jump;
+		for(auto& m : seg.moves) {
+			if(!legs[std::get<0>(m)].positionKnown()) jump.push_back(m);
+		}
+		if(!jump.empty()) {
+			MoveResult r= body.place(jump, mode);
+			if(!r.ok()) fail(seg, r);
+		}
+
+		// the delta for each leg from where it is now, so it can be interpolated
+		for(auto& m : seg.moves) {
+			int leg;
+			float x, y, z;
+			float cx, cy, cz;
+			std::tie(leg, x, y, z) = m;
+			std::tie(cx, cy, cz) = legs[leg].getPosition();
+			m= Pos3(leg, x-cx, y-cy, z-cz);
+		}
+		seg.relative= true;
+	}
+}
+
+uint32_t Trajectory::advance(Segment& seg, uint32_t steps)
+{
+	uint32_t n= std::min(steps, seg.ticks - seg.done);
+	seg.done += n;
+	// once a tick fails the rest of the segment is skipped
+	if(n == 0 || !seg.result.ok()) return steps - n;
+
+	MoveResult r;
+	if(seg.kind == Segment::MOVE) {
+		r= body.commit(seg.moves, seg.slice * n, mode);
+	}else{
+		// the turn of each leg as the delta to where it ends up, so the legs are only written if all of them can reach
+		MoveSet turn;
+		for (int l = 0; l < Robot::NLEGS; ++l) {
+			if(!(seg.rotating & (1 << l))) continue;
+			float x, y, z, nx, ny;
+			std::tie(x, y, z) = legs[l].getPosition();
+			std::tie(nx, ny, std::ignore) = legs[l].calcRotation(RADIANS(seg.rotate[l] * n), false);
+			turn.push_back(Pos3(l, nx - x, ny - y, 0));
+		}
+		r= body.commit(turn, 1, mode);
+	}
+	if(!r.ok()) fail(seg, r);
+	return steps - n;
+}
+
+void Trajectory::fail(Segment& seg, const MoveResult& r)
+{
+	fprintf(stderr, "move out of range: legs 0x%02X\n", r.legs);
+	seg.result= r;
+}
+
+void Trajectory::execute()
+{
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lk(mutex);
+			idle= true;
+			idled.notify_all();
+			wake.wait(lk, [this]() { return stopping || !ring.empty(); });
+			if(ring.empty()) break;
+			idle= false;
+		}
+		if(faulted) {
+			// nothing queued after a fault runs until the planner has it
+			discard();
+			continue;
+		}
+
+		++stats.starts;
+		try {
+			timed.runWhile([this](uint32_t steps) { return tick(steps); });
+		}catch(...) {
+			// it would end the program on this thread, stop the queue and hand it to the planner
+			{
+				std::lock_guard<std::mutex> lk(mutex);
+				fault= std::current_exception();
+				faulted= true;
+			}
+			active= false;
+			discard();
+		}
+	}
+}
+
+void Trajectory::discard()
+{
+	Segment s;
+	while(ring.pop(s)) {}
+	std::lock_guard<std::mutex> lk(mutex);
+	room.notify_one();
+}
+
+uint32_t Trajectory::tick(uint32_t steps)
+{
+	++stats.ticks;
+	// steps the drop policy gives past the end of a segment go to the next one
+	while(steps > 0) {
+		if(!active) {
+			if(!ring.pop(current)) break;
+			{
+				// once a segment, if the planner is waiting for room there is some now
+				std::lock_guard<std::mutex> lk(mutex);
+				room.notify_one();
+			}
+			begin(current);
+			active= true;
+			++stats.segments;
+		}
+		steps= advance(current, steps);
+		if(current.done == current.ticks) {
+			active= false;
+			if(!current.result.ok() && !failed) {
+				std::lock_guard<std::mutex> lk(mutex);
+				failure= current.result;
+				failed= true;
+			}
+		}
+	}
+	// carry on ticking while there is more to do, the next segment starts on the next tick
+	return active || !ring.empty() ? UINT32_MAX : 0;
+}
@@ -0,0 +1,110 @@
+/**
+	Timed motion segments, queued from the gaits to a thread that runs them.
+	With the executor started (-n) a gait pushes each segment into a lock free single producer single consumer ring
+	and goes on to plan the next while the executor ticks the active one at the update frequency. The next segment
+	starts on the tick after one ends, so the legs don't stop between them as long as the planner keeps ahead. The
+	planner only waits when it is the queue depth ahead, the executor only when there is nothing queued.
+	Without the executor a segment runs on the calling thread, the way the moves always have.
+	Every tick goes through Body::commit, so a leg that can't reach skips the rest of its segment rather than
+	throwing. A move that fails on the executor is handed back to the planner by the next run() or drain(), and
+	anything that does throw there stops the queue and is rethrown on the planner.
+*/
+
+#pragma once
+
+#include "Body.h"
+#include "Timed.h"
+#include "SpscRing.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+// one timed move of some of the legs, spread evenly over its ticks
+struct Segment {
+	enum Kind : uint8_t { MOVE, ROTATE };
+
+	Kind kind= MOVE;
+	uint32_t ticks= 0;
+	MoveSet moves; // MOVE: the delta for each leg, or its target if not relative
+	bool relative= true;
+	float rotate[Robot::NLEGS]; // ROTATE: degrees each leg turns about the body center per tick
+	uint8_t rotating= 0; // ROTATE: bit per leg in rotate
+	uint8_t lift= 0, lower= 0; // bit per leg taken off or put on the ground as it starts
+
+	// set as it runs
+	uint32_t done= 0;
+	float slice= 0;
+	MoveResult result {MoveStatus::OK, 0}; // the tick that failed, the rest of the segment is skipped
+};
+
+class Trajectory
+{
+public:
+	static const int CAPACITY= 16;
+
+	Trajectory(Body& body, std::vector<Leg>& legs, Timed& timed);
+	~Trajectory();
+
+	void setMoveMode(MoveMode m) { mode= m; }
+
+	// start the executor thread if it isn't running, the planner then runs up to depth segments ahead
+	void start(int depth);
+	// wait for the queued segments to finish and stop the thread
+	void stop();
+	bool running() const { return executor.joinable(); }
+	// wait for the queued segments to finish, returns the first move of them that failed
+	MoveResult drain();
+
+	// queue seg for the executor, waiting for room, or run it now if the executor isn't running. Returns how seg
+	// went when it runs now, or the first move to fail on the executor since the last run() or drain()
+	MoveResult run(const Segment& seg);
+
+	// segments waiting to run, from any thread
+	size_t depth() const { return ring.size(); }
+
+	struct Stats {
+		uint32_t segments, ticks;
+		uint32_t starts; // times the executor started up from having nothing queued
+		uint32_t max_depth;
+		uint32_t waits; // times the planner waited for room in the queue
+	};
+	// once the executor has stopped
+	const Stats& getStats() const { return stats; }
+
+private:
+	void begin(Segment& seg);
+	// runs up to steps ticks of seg, returns the steps it didn't use
+	uint32_t advance(Segment& seg, uint32_t steps);
+	void fail(Segment& seg, const MoveResult& r);
+	void execute();
+	uint32_t tick(uint32_t steps);
+	// executor side, drops the queued segments
+	void discard();
+	// planner side, the failure the executor handed over, rethrowing what stopped it
+	MoveResult collect();
+
+	Body& body;
+	std::vector<Leg>& legs;
+	Timed& timed;
+	MoveMode mode= MoveMode::STRICT;
+
+	SpscRing<Segment, CAPACITY> ring;
+	size_t max_ahead= CAPACITY;
+	Segment current; // executor side
+	bool active= false;
+
+	std::thread executor;
+	std::mutex mutex;
+	std::condition_variable wake, idled, room;
+	bool idle= true, stopping= false;
+	// set by the executor, under the mutex
+	std::atomic<bool> failed {false}, faulted {false};
+	MoveResult failure {MoveStatus::OK, 0};
+	std::exception_ptr fault;
+
+	Stats stats {};
+};
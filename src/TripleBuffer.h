@@ -0,0 +1,45 @@
+/**
+	Lock free triple buffer for one writer thread and one reader thread.
+	The writer fills the back buffer and publishes it, the reader picks up whatever was published last.
+	Neither side ever waits, a value that is published again before the reader got to it is dropped rather than queued.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : back(0), front(2), middle(1) {}
+
+	// writer side, fill this then publish it
+	T& writeBuffer() { return buf[back]; }
+	// returns true if the previous value was never read and has been dropped
+	bool publish()
+	{
+		uint8_t old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+		back = old & INDEX;
+		return old & FRESH;
+	}
+
+	// reader side, returns true if something newer than readBuffer() was published and makes it readBuffer()
+	bool update()
+	{
+		if(!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+		uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+		front = old & INDEX;
+		return true;
+	}
+	const T& readBuffer() const { return buf[front]; }
+
+private:
+	static const uint8_t INDEX = 3, FRESH = 4;
+
+	T buf[3];
+	uint8_t back; // only used by the writer
+	uint8_t front; // only used by the reader
+	std::atomic<uint8_t> middle; // the buffer between them, FRESH if it has not been read
+};
@@ -22,9 +22,6 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include "Servo.h"
-
-#ifndef DUMMY
 /*
 Changes:
   pass in float angle.
@@ -34,6 +31,8 @@ Changes:
 #include "adafruitss.h"
 #include <unistd.h>
 #include <math.h>
+#include <string.h>
+#include <chrono>
 
 #define PCA9685_SUBADR1 0x2
 #define PCA9685_SUBADR2 0x3
@@ -46,20 +45,31 @@ Changes:
 #define PCA9685_PRESCALE_REG    0xFE
 #define LED0_REG                0x06
 
+// the PCA9685 oscillator runs this much faster than the 25MHz the prescale formula assumes (see issue #11)
+#define OSC_CORRECTION 0.899683334F
+
 //using namespace myupm;
 
-adafruitss::adafruitss(int bus,int i2c_address)
+adafruitss::adafruitss(int bus,int i2c_address,bool setup)
 {
-    mraa_init();
-
-
-    m_i2c = mraa_i2c_init(bus);
+    m_i2c = I2C::open(bus);
 
     pca9685_addr =  i2c_address;
-    mraa_i2c_address(m_i2c, pca9685_addr);
+    memset(written, 0xFF, sizeof(written));
+    memset(hysteresis, 0, sizeof(hysteresis));
+    dirty = 0;
+    touched = 0;
+    max_gap = 2;
+    stats = BusStats();
+    prescale = 0;
+    restart_ns = 0;
+    restart_pending = false;
+    _duration_1ms = (4096*60)/1000.0F;
+    if(!setup) return;
+
     m_rx_tx_buf[0]=PCA9685_MODE1;
     m_rx_tx_buf[1]=0;
-    mraa_i2c_write(m_i2c,m_rx_tx_buf,2);
+    m_i2c->write(pca9685_addr,m_rx_tx_buf,2);
 
     adafruitss::setPWMFreq(60);
 
@@ -67,7 +77,12 @@ adafruitss::adafruitss(int bus,int i2c_address)
 }
 
 void adafruitss::setPWMFreq(float freq) {
-    float afreq= freq * 0.899683334F;  // Correct for overshoot in the frequency setting (see issue #11). (Tested at 60hz with Logic 4)
+    usleep(startPWMFreq(freq, false));
+    finishPWMFreq();
+}
+
+int adafruitss::startPWMFreq(float freq, bool reuse) {
+    float afreq= freq * OSC_CORRECTION;  // Correct for overshoot in the frequency setting (see issue #11). (Tested at 60hz with Logic 4)
     float prescaleval = 25000000;
     prescaleval /= 4096;
     prescaleval /= afreq;
@@ -76,53 +91,63 @@ void adafruitss::setPWMFreq(float freq) {
 
     _duration_1ms = ((4096*pwm_frequency)/1000);  // This is 1ms duration
 
-    uint8_t prescale = roundf(prescaleval);
+    prescale = roundf(prescaleval);
 
 
 
-    mraa_i2c_address(m_i2c, pca9685_addr);
-    mraa_i2c_read_byte_data(m_i2c,PCA9685_MODE1);
+    int mode1 = m_i2c->readByte(pca9685_addr,PCA9685_MODE1);
+    if(reuse && mode1 >= 0 && (mode1 & 0x7F) == 0x21 && m_i2c->readByte(pca9685_addr,PCA9685_PRESCALE) == prescale) {
+        // awake with auto increment and this prescale (RESTART reads back either way), as a previous run left it
+        restart_ns = 0;
+        restart_pending = false;
+        return 0;
+    }
 
 
     m_rx_tx_buf[0]=PCA9685_MODE1;
     m_rx_tx_buf[1]=0x10; // sleep
-    mraa_i2c_address(m_i2c, pca9685_addr);
-    mraa_i2c_write(m_i2c,m_rx_tx_buf,2);
+    m_i2c->write(pca9685_addr,m_rx_tx_buf,2);
 
 
 
     m_rx_tx_buf[0]=PCA9685_PRESCALE;
     m_rx_tx_buf[1]=prescale;
-    mraa_i2c_address(m_i2c, pca9685_addr);
-    mraa_i2c_write(m_i2c,m_rx_tx_buf,2);
+    m_i2c->write(pca9685_addr,m_rx_tx_buf,2);
 
 
 
 
     m_rx_tx_buf[0]=PCA9685_MODE1;
     m_rx_tx_buf[1]=0x00;
-    mraa_i2c_address(m_i2c, pca9685_addr);
-    mraa_i2c_write(m_i2c,m_rx_tx_buf,2);
+    m_i2c->write(pca9685_addr,m_rx_tx_buf,2);
 
     // mraa_i2c_write_byte_data(m_i2c,0x00,PCA9685_MODE1);
 
-    usleep(5000);
+    restart_pending = true;
+    return 5000;
+}
 
+void adafruitss::finishPWMFreq() {
+    if(!restart_pending) return;
+    restart_pending = false;
 
     m_rx_tx_buf[0]=PCA9685_MODE1;
     m_rx_tx_buf[1]=0xa1;
-    mraa_i2c_address(m_i2c, pca9685_addr);
-    mraa_i2c_write(m_i2c,m_rx_tx_buf,2);
+    m_i2c->write(pca9685_addr,m_rx_tx_buf,2);
+    restart_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+float adafruitss::cycleFrequency() const {
+    return 25000000 / OSC_CORRECTION / (4096.0F * (prescale + 1));
 }
 
 int adafruitss::update(void)
 {
-    return MRAA_SUCCESS;
+    return 0;
 }
 
 // JM allow float degrees
-void adafruitss::servo(uint8_t port, uint8_t servo_type, float degrees) {
-    // Set Servo values
+uint16_t adafruitss::pulse(uint8_t servo_type, float degrees) const {
     // Degrees is from 0 to 180
     // servo_type: 0 = standard 1ms to 2ms
     //             1 = extended 0.6ms to 2.4ms
@@ -154,14 +179,105 @@ void adafruitss::servo(uint8_t port, uint8_t servo_type, float degrees) {
          break;
    }
 
-    uint16_t d= roundf(duration);
-    mraa_i2c_address(m_i2c, pca9685_addr);
+    return roundf(duration);
+}
+
+// true if pulse d would change what the chip has for port by more than its hysteresis
+bool adafruitss::changed(uint8_t port, uint16_t d) const {
+    if(written[port] == 0xFFFF) return true;
+    int diff= (int)d - written[port];
+    return diff > hysteresis[port] || diff < -hysteresis[port];
+}
+
+void adafruitss::servo(uint8_t port, uint8_t servo_type, float degrees) {
+    // Set Servo values
+    setTicks(port, pulse(servo_type, degrees));
+}
+
+void adafruitss::setTicks(uint8_t port, uint16_t d) {
+    if(!changed(port, d)) {
+        // same 12 bit count as the chip already has, or within the hysteresis of it
+        ++stats.suppressed;
+        return;
+    }
     m_rx_tx_buf[0]=LED0_REG+4*port;
     m_rx_tx_buf[1]=0;
     m_rx_tx_buf[2]=0;
     m_rx_tx_buf[3]=d;
     m_rx_tx_buf[4]=d>>8;
 
-    mraa_i2c_write(m_i2c,m_rx_tx_buf,5);
+    m_i2c->write(pca9685_addr,m_rx_tx_buf,5);
+
+    // keep the frame writes in step
+    written[port]=d;
+    dirty &= ~(1 << port);
+    ++stats.issued;
+    ++stats.transactions;
+    stats.bytes += 5;
  }
-#endif
+
+void adafruitss::stage(uint8_t port, uint8_t servo_type, float degrees) {
+    stageTicks(port, pulse(servo_type, degrees));
+}
+
+void adafruitss::stageTicks(uint8_t port, uint16_t d) {
+    staged[port]= d;
+    touched |= 1 << port;
+    if(changed(port, staged[port])) dirty |= 1 << port;
+    else dirty &= ~(1 << port);
+}
+
+int adafruitss::planRuns(uint16_t dirty, uint16_t known, int max_gap, uint8_t first[], uint8_t last[]) {
+    int n= 0;
+    for (int p = 0; p < NPORTS; ++p) {
+        if(!(dirty & (1 << p))) continue;
+        // the ports between this and the previous run, only ones that have been written can be bridged
+        uint16_t gap= n > 0 ? ((1 << p) - (2 << last[n-1])) : 0;
+        if(n > 0 && p - last[n-1] - 1 <= max_gap && (gap & ~known) == 0) {
+            // cheaper to rewrite the unchanged ports in between than start another transaction
+            last[n-1]= p;
+        }else{
+            first[n]= last[n]= p;
+            ++n;
+        }
+    }
+    return n;
+}
+
+int adafruitss::flush(void) {
+    stats.last_transactions= stats.last_bytes= 0;
+    stats.issued += __builtin_popcount(dirty);
+    stats.suppressed += __builtin_popcount(touched & ~dirty);
+    touched= 0;
+    if(dirty == 0) return 0;
+
+    uint8_t first[NPORTS], last[NPORTS];
+    uint16_t known= 0;
+    for (int p = 0; p < NPORTS; ++p) {
+        if(written[p] != 0xFFFF) known |= 1 << p;
+    }
+    int n= planRuns(dirty, known, max_gap, first, last);
+    for (int r = 0; r < n; ++r) {
+        // MODE1 has auto increment set so the LEDn registers of the run follow on from the first
+        int len= 1;
+        m_frame_buf[0]=LED0_REG+4*first[r];
+        for (int p = first[r]; p <= last[r]; ++p) {
+            // an unchanged port in a gap is rewritten with what it already has
+            uint16_t d= (dirty & (1 << p)) ? staged[p] : written[p];
+            m_frame_buf[len++]=0;
+            m_frame_buf[len++]=0;
+            m_frame_buf[len++]=d;
+            m_frame_buf[len++]=d>>8;
+            written[p]=d;
+        }
+        m_i2c->write(pca9685_addr,m_frame_buf,len);
+        ++stats.last_transactions;
+        stats.last_bytes += len;
+    }
+    dirty= 0;
+
+    ++stats.frames;
+    stats.transactions += stats.last_transactions;
+    stats.bytes += stats.last_bytes;
+    return n;
+}
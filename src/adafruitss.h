@@ -24,9 +24,13 @@
 
 #pragma once
 
-#include <mraa/i2c.h>
+#include "I2C.h"
+#include "ServoBoard.h"
 
 #define MAX_BUFFER_LENGTH 6
+#define NPORTS 16
+// the register followed by all the LEDn registers
+#define FRAME_BUFFER_LENGTH (1 + NPORTS * 4)
 
 //namespace myupm {
 
@@ -54,15 +58,16 @@
   *
   * @snippet adafruitss.cxx Interesting
   */
-  class adafruitss {
+  class adafruitss : public ServoBoard {
   public:
     /**
      * Creates a adafruitss object
      *
      * @param bus number of used i2c bus
      * @param i2c_address address of servo controller on i2c bus
+     * @param setup false to leave the chip alone until the frequency is set
      */
-    adafruitss(int bus, int i2c_address);
+    adafruitss(int bus, int i2c_address, bool setup = true);
     int update(void);
     /**
      * Sets the frequency for your servos
@@ -70,6 +75,31 @@
      * @param freq the frequency at which the servos operate
      */
     void setPWMFreq(float freq);
+    /**
+     * Sets the frequency in two steps so several boards can share the wait for the oscillator,
+     * startPWMFreq() sleeps the chip, sets the prescale and wakes it and finishPWMFreq() restarts
+     * the PWM once the oscillator has settled. A chip already running at freq with auto increment
+     * on is left alone, its outputs carry on and restartTime() is 0 as the cycle phase is unknown
+     *
+     * @param freq the frequency at which the servos operate
+     * @param reuse false to reprogram the chip even if it is already set
+     * @return us to wait before finishPWMFreq(), 0 if the chip was left alone
+     */
+    int startPWMFreq(float freq, bool reuse) override;
+    void finishPWMFreq() override;
+    /**
+     * The PWM cycle the chip runs, the frequency its prescale gives with the oscillator error setPWMFreq
+     * corrects for
+     *
+     * @return cycles per second
+     */
+    float cycleFrequency() const override;
+    /**
+     * When setPWMFreq last restarted the PWM cycle, a cycle starts then and every 1/cycleFrequency() after
+     *
+     * @return std::chrono::steady_clock time in ns
+     */
+    int64_t restartTime() const override { return restart_ns; }
     /**
      * Moves the one of the servos to the specified angle
      *
@@ -80,12 +110,91 @@
     void servo(uint8_t port, uint8_t servo_type, float degrees);
     void servo(uint8_t port, uint8_t servo_type, uint16_t degrees) { servo(port, servo_type, (float)degrees); }
 
+    /**
+     * Frame writes, stage() records the pulse for a port and flush() writes all the ports that changed
+     * using the MODE1 auto increment, one transaction per run of ports
+     *
+     * @param port port of the servo on the controller (servo number)
+     * @param servo_type same as servo()
+     * @param degrees angle to set the servo to
+     */
+    void stage(uint8_t port, uint8_t servo_type, float degrees);
+    /**
+     * The same as servo() and stage() for a pulse already in PWM ticks, eg from a Calibration
+     *
+     * @param port port of the servo on the controller (servo number)
+     * @param d pulse width in ticks of the 4096 in a PWM period
+     */
+    void setTicks(uint8_t port, uint16_t d);
+    void stageTicks(uint8_t port, uint16_t d);
+    /**
+     * The pulse servo() would write
+     *
+     * @param servo_type same as servo()
+     * @param degrees angle of the servo
+     * @return pulse width in PWM ticks
+     */
+    uint16_t pulse(uint8_t servo_type, float degrees) const override;
+    /**
+     * PWM ticks in 1ms at the frequency set by setPWMFreq
+     */
+    float ticksPerMs() const override { return _duration_1ms; }
+    /**
+     * Writes the staged ports that changed since they were last written
+     *
+     * @return number of transactions written
+     */
+    int flush(void) override;
+    /**
+     * Runs separated by up to n unchanged ports are written as one, rewriting the
+     * unchanged ports costs 4 bytes each against the overhead of another transaction
+     *
+     * @param n number of unchanged ports to bridge
+     */
+    void setMaxGap(int n) { max_gap = n; }
+    /**
+     * Writes that come within n counts of what the chip already has for the port are
+     * suppressed, 0 only suppresses writes of the same count
+     *
+     * @param port port of the servo on the controller (servo number)
+     * @param n counts either side of the last written count
+     */
+    void setHysteresis(uint8_t port, uint16_t n) override { hysteresis[port] = n; }
+    /**
+     * Splits the changed ports into the runs flush() writes
+     *
+     * @param dirty bit per changed port
+     * @param known bit per port that has been written, only those can be rewritten in a gap
+     * @param max_gap unchanged ports to bridge
+     * @param first first port of each run
+     * @param last last port of each run
+     * @return number of runs
+     */
+    static int planRuns(uint16_t dirty, uint16_t known, int max_gap, uint8_t first[], uint8_t last[]);
+
+    const BusStats& getStats() const override { return stats; }
+    void clearStats() override { stats = BusStats(); }
+
   private:
 
+    bool changed(uint8_t port, uint16_t d) const;
+
     int pca9685_addr;
-    mraa_i2c_context m_i2c;
+    I2C *m_i2c; // shared with the other boards on the bus
     uint8_t m_rx_tx_buf[MAX_BUFFER_LENGTH];
+    uint8_t m_frame_buf[FRAME_BUFFER_LENGTH];
     float _duration_1ms;
+    uint8_t prescale;
+    int64_t restart_ns;
+    bool restart_pending;
+
+    uint16_t staged[NPORTS];
+    uint16_t written[NPORTS]; // 0xFFFF until the port is first written
+    uint16_t hysteresis[NPORTS];
+    uint16_t dirty;
+    uint16_t touched; // staged since the last flush
+    int max_gap;
+    BusStats stats;
 };
 
 //}
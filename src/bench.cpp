@@ -0,0 +1,1318 @@
+/**
+	Benchmarks and self checks, run with -K name or -K all, exits non zero if a check fails
+*/
+
+#include "Leg.h"
+#include "Body.h"
+#include "kinematics.h"
+#include "IKTable.h"
+#include "IncrementalIK.h"
+#include "ReachMap.h"
+#include "Servo.h"
+#include "TripleBuffer.h"
+#include "SpscRing.h"
+#include "Trajectory.h"
+#include "Calibration.h"
+#include "PhaseLock.h"
+#include "I2C.h"
+#include "adafruitss.h"
+#include "simd.h"
+#include "fastmath.h"
+#include "Timed.h"
+#include "RealTime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <new>
+
+#define DEGREES(r) ((r) * 180.0F / M_PI)
+
+// defined in main.cpp
+extern std::vector<Leg> legs;
+extern float MAX_RAISE;
+
+// the scalar kinematics go through FMath, so the fast tier is checked against looser limits
+static const float ik_tolerance = MATH_TIER == MATH_FAST ? 0.05F : 0.01F; // degrees
+static const float fk_tolerance = MATH_TIER == MATH_FAST ? 0.05F : 0.01F; // mm
+
+// legs on a servo of their own with the record backend, like checkHotPath in main.cpp, so the benches that move
+// legs never drive the robot's servos
+struct DryLegs
+{
+	Servo servo;
+	std::vector<Leg> legs;
+
+	DryLegs()
+	{
+		servo.open(ServoBackend::RECORD);
+		legs.reserve(Robot::NLEGS);
+		for (int i = 0; i < Robot::NLEGS; ++i) legs.emplace_back(i, servo);
+	}
+};
+
+static double nowNs()
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static float frand(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// fill n sets of six foot targets in leg coordinates that the scalar IK can reach
+static void reachableTargets(std::vector<LegTargets>& sets, int n)
+{
+	sets.resize(n);
+	for (int s = 0; s < n; ++s) {
+		for (int l = 0; l < KIN_LANES; ++l) {
+			float x, y, z, k;
+			do {
+				x = frand(0, Robot::COXA + Robot::FEMUR + Robot::TIBIA);
+				y = frand(-80, 80);
+				z = frand(-Robot::TIBIA - 20, 40);
+				std::tie(std::ignore, k, std::ignore) = Leg::inverseKinematics(x, y, z);
+			} while(std::isnan(k));
+			sets[s].x[l] = x;
+			sets[s].y[l] = y;
+			sets[s].z[l] = z;
+		}
+	}
+}
+
+static bool benchIK()
+{
+	const int nsets = 1000, reps = 200;
+	std::vector<LegTargets> sets;
+	reachableTargets(sets, nsets);
+
+	// accuracy of the batch against the scalar IK
+	float maxerr = 0;
+	LegAngles a;
+	for (auto& t : sets) {
+		batchInverseKinematics(t, a, 6);
+		for (int l = 0; l < 6; ++l) {
+			float h, k, an;
+			std::tie(h, k, an) = Leg::inverseKinematics(t.x[l], t.y[l], t.z[l]);
+			maxerr = std::max(maxerr, std::abs(h - a.hip[l]));
+			maxerr = std::max(maxerr, std::abs(k - a.knee[l]));
+			maxerr = std::max(maxerr, std::abs(an - a.ankle[l]));
+		}
+	}
+
+	float sum = 0;
+	double t1 = nowNs();
+	for (int r = 0; r < reps; ++r) {
+		for (auto& t : sets) {
+			for (int l = 0; l < 6; ++l) {
+				float h, k, an;
+				std::tie(h, k, an) = Leg::inverseKinematics(t.x[l], t.y[l], t.z[l]);
+				sum += h + k + an;
+			}
+		}
+	}
+	double t2 = nowNs();
+	for (int r = 0; r < reps; ++r) {
+		for (auto& t : sets) {
+			batchInverseKinematics(t, a, 6);
+			sum += a.hip[0] + a.knee[5] + a.ankle[3];
+		}
+	}
+	double t3 = nowNs();
+
+	double scalar = (t2 - t1) / (nsets * reps);
+	double batch = (t3 - t2) / (nsets * reps);
+	printf("ik: scalar %.1f ns/6 legs, batch %.1f ns/6 legs (SIMD width %d), speedup %.2fx, max error %g° (%g)\n",
+		scalar, batch, SIMD_WIDTH, scalar / batch, DEGREES(maxerr), sum);
+	return DEGREES(maxerr) < ik_tolerance;
+}
+
+// IK -> FK round trip over a grid covering the whole reachable workspace, for both the scalar and batch kinematics
+static bool benchFK()
+{
+	const float reach = Robot::COXA + Robot::FEMUR + Robot::TIBIA;
+	const float step = 2;
+	float maxerr = 0, maxbatcherr = 0;
+	int npoints = 0;
+
+	LegTargets t, fk;
+	LegAngles a;
+	int n = 0;
+	auto check_batch = [&]() {
+		batchInverseKinematics(t, a, n);
+		batchForwardKinematics(a, fk, n);
+		for (int i = 0; i < n; ++i) {
+			float e = sqrtf(powf(fk.x[i] - t.x[i], 2) + powf(fk.y[i] - t.y[i], 2) + powf(fk.z[i] - t.z[i], 2));
+			maxbatcherr = std::max(maxbatcherr, e);
+		}
+		n = 0;
+	};
+
+	for (float x = -reach; x <= reach; x += step) {
+		for (float y = -reach; y <= reach; y += step) {
+			for (float z = -Robot::FEMUR - Robot::TIBIA; z <= Robot::FEMUR + Robot::TIBIA; z += step) {
+				float h, k, an;
+				std::tie(h, k, an) = Leg::inverseKinematics(x, y, z);
+				if(std::isnan(k)) continue;
+
+				float fx, fy, fz;
+				std::tie(fx, fy, fz) = Leg::forwardKinematics(an, k, h);
+				float e = sqrtf(powf(fx - x, 2) + powf(fy - y, 2) + powf(fz - z, 2));
+				maxerr = std::max(maxerr, e);
+				++npoints;
+
+				t.x[n] = x; t.y[n] = y; t.z[n] = z;
+				if(++n == KIN_LANES) check_batch();
+			}
+		}
+	}
+	if(n > 0) check_batch();
+
+	// throughput of FK for six legs
+	const int reps = 200000;
+	for (int l = 0; l < KIN_LANES; ++l) {
+		a.hip[l] = 0.1F * l; a.knee[l] = 0.3F; a.ankle[l] = -0.2F;
+	}
+	float sum = 0;
+	double t1 = nowNs();
+	for (int r = 0; r < reps; ++r) {
+		for (int l = 0; l < 6; ++l) {
+			float x, y, z;
+			std::tie(x, y, z) = Leg::forwardKinematics(a.ankle[l], a.knee[l], a.hip[l] + r * 1e-7F);
+			sum += x + y + z;
+		}
+	}
+	double t2 = nowNs();
+	for (int r = 0; r < reps; ++r) {
+		a.hip[0] += 1e-7F;
+		batchForwardKinematics(a, fk, 6);
+		sum += fk.x[0] + fk.y[3] + fk.z[5];
+	}
+	double t3 = nowNs();
+
+	printf("fk: %d reachable points, round trip max error scalar %g mm, batch %g mm, scalar %.1f ns/6 legs, batch %.1f ns/6 legs (%g)\n",
+		npoints, maxerr, maxbatcherr, (t2 - t1) / reps, (t3 - t2) / reps, sum);
+	return maxerr < fk_tolerance && maxbatcherr < fk_tolerance;
+}
+
+// IK lookup table against the analytic IK
+static bool benchIKTable()
+{
+	const float spacing = 2, max_error = 0.1F * M_PI / 180.0F;
+	IKTable table;
+	double t1 = nowNs();
+	table.build(spacing, max_error);
+	double t2 = nowNs();
+
+	// random points the table covers
+	const int npoints = 100000;
+	std::vector<float> px, py, pz;
+	const float reach = Robot::COXA + Robot::FEMUR + Robot::TIBIA;
+	while((int)px.size() < npoints) {
+		float x = frand(0, reach), y = frand(-reach, reach), z = frand(-Robot::FEMUR - Robot::TIBIA, Robot::FEMUR + Robot::TIBIA);
+		float h, k, a;
+		if(!table.solve(x, y, z, h, k, a)) continue;
+		px.push_back(x); py.push_back(y); pz.push_back(z);
+	}
+
+	float maxerr = 0;
+	for (int i = 0; i < npoints; ++i) {
+		float h, k, a, th, tk, ta;
+		std::tie(h, k, a) = Leg::inverseKinematics(px[i], py[i], pz[i]);
+		table.solve(px[i], py[i], pz[i], th, tk, ta);
+		maxerr = std::max(maxerr, std::max(std::abs(h - th), std::max(std::abs(k - tk), std::abs(a - ta))));
+	}
+
+	float sum = 0;
+	double t3 = nowNs();
+	for (int i = 0; i < npoints; ++i) {
+		float h, k, a;
+		std::tie(h, k, a) = Leg::inverseKinematics(px[i], py[i], pz[i]);
+		sum += h + k + a;
+	}
+	double t4 = nowNs();
+	for (int i = 0; i < npoints; ++i) {
+		float h, k, a;
+		table.solve(px[i], py[i], pz[i], h, k, a);
+		sum += h + k + a;
+	}
+	double t5 = nowNs();
+	// six legs a pass, the way Body::commit solves them
+	const int nbatch = npoints / Robot::NLEGS;
+	for (int i = 0; i < nbatch; ++i) {
+		LegTargets t;
+		LegAngles la;
+		for (int l = 0; l < KIN_LANES; ++l) {
+			int p = i * Robot::NLEGS + std::min(l, Robot::NLEGS - 1);
+			t.x[l] = px[p]; t.y[l] = py[p]; t.z[l] = pz[p];
+		}
+		batchInverseKinematics(t, la, Robot::NLEGS);
+		sum += la.hip[0] + la.knee[Robot::NLEGS - 1];
+	}
+	double t6 = nowNs();
+
+	// the cache file must give back the same table
+	const char *fn = "/tmp/hexapod-iktable.bin";
+	IKTable loaded;
+	bool cache_ok = table.save(fn) && loaded.load(fn, spacing, max_error);
+	for (int i = 0; i < 1000 && cache_ok; ++i) {
+		float h, k, a, lh, lk, la;
+		table.solve(px[i], py[i], pz[i], h, k, a);
+		cache_ok = loaded.solve(px[i], py[i], pz[i], lh, lk, la) && h == lh && k == lk && a == la;
+	}
+	remove(fn);
+
+	// a leg with no known position gives NAN targets, they must miss the table rather than index it
+	float h, k, a;
+	bool nan_ok = !table.solve(NAN, 0, 0, h, k, a) && !table.solve(100, NAN, 0, h, k, a) && !table.solve(100, 0, NAN, h, k, a) &&
+		!table.solve(INFINITY, 0, 0, h, k, a);
+
+	printf("iktable: %gmm grid built in %.0f ms, %.1f%% coverage, analytic %.1f ns/solve, table %.1f ns/solve, batch %.1f ns/leg, worst error %g° (limit %g°), cache %s (%g)\n",
+		spacing, (t2 - t1) / 1e6, table.coverage() * 100, (t4 - t3) / npoints, (t5 - t4) / npoints, (t6 - t5) / (nbatch * Robot::NLEGS),
+		DEGREES(maxerr), DEGREES(max_error), cache_ok ? "ok" : "bad", sum);
+	if(!nan_ok) printf("iktable: a non finite target was looked up\n");
+	return cache_ok && nan_ok && maxerr <= max_error * 1.5F;
+}
+
+// the pure batch IK on one thread and on all of them, against the scalar IK and servo limits
+static bool benchEvaluate()
+{
+	const size_t n = 1 << 18;
+	const int leg = 1;
+	const float reach = Robot::COXA + Robot::FEMUR + Robot::TIBIA;
+	std::vector<float> x(n), y(n), z(n);
+	for (size_t i = 0; i < n; ++i) {
+		x[i] = frand(-reach, reach);
+		y[i] = frand(-reach, reach);
+		z[i] = frand(-Robot::FEMUR - Robot::TIBIA, Robot::FEMUR);
+	}
+
+	// asking must not move the leg
+	float before[6], after[6];
+	std::tie(before[0], before[1], before[2]) = legs[leg].getPosition();
+	std::tie(before[3], before[4], before[5]) = legs[leg].getAngles();
+
+	std::vector<float> h1(n), k1(n), a1(n), h(n), k(n), a(n);
+	std::vector<uint8_t> r1(n), r(n);
+	double t1 = nowNs();
+	size_t c1 = legs[leg].evaluate(x.data(), y.data(), z.data(), n, h1.data(), k1.data(), a1.data(), r1.data(), 1);
+	double t2 = nowNs();
+	// at least two so the split is checked on a single core too
+	int nthreads = std::max(2U, std::thread::hardware_concurrency());
+	size_t c = legs[leg].evaluate(x.data(), y.data(), z.data(), n, h.data(), k.data(), a.data(), r.data(), nthreads);
+	double t3 = nowNs();
+
+	std::tie(after[0], after[1], after[2]) = legs[leg].getPosition();
+	std::tie(after[3], after[4], after[5]) = legs[leg].getAngles();
+	bool pure = memcmp(before, after, sizeof(before)) == 0;
+	bool same = c == c1 && memcmp(r.data(), r1.data(), n) == 0 &&
+		memcmp(h.data(), h1.data(), n * sizeof(float)) == 0 && memcmp(k.data(), k1.data(), n * sizeof(float)) == 0 && memcmp(a.data(), a1.data(), n * sizeof(float)) == 0;
+
+	// the scalar way, one point at a time
+	size_t disagree = 0;
+	const float (*m)[2] = Robot::legs[leg].mat;
+	double t4 = nowNs();
+	for (size_t i = 0; i < n; ++i) {
+		float sh, sk, sa;
+		std::tie(sh, sk, sa) = Leg::inverseKinematics(x[i] * m[0][0] + y[i] * m[1][0], x[i] * m[0][1] + y[i] * m[1][1], z[i]);
+		if(ReachMap::inRange(leg, sh, sk, sa) != (r[i] != 0)) ++disagree;
+	}
+	double t5 = nowNs();
+
+	// the angles have to put the foot on the point, checked with FK as the IK is ill conditioned at the edge of reach
+	float maxerr = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if(!r[i]) continue;
+		float fx, fy, fz;
+		std::tie(fx, fy, fz) = Leg::forwardKinematics(a[i], k[i], h[i]);
+		fx -= x[i] * m[0][0] + y[i] * m[1][0];
+		fy -= x[i] * m[0][1] + y[i] * m[1][1];
+		fz -= z[i];
+		maxerr = std::max(maxerr, sqrtf(fx * fx + fy * fy + fz * fz));
+	}
+
+	printf("evaluate: %zu points, %.1f%% reachable, scalar %.1f ns/point, batch %.1f ns/point on 1 thread, %.1f ns/point on %d, %zu disagree on the boundary, max foot error %g mm, threads %s, leg %s\n",
+		n, 100.0F * c / n, (t5 - t4) / n, (t2 - t1) / n, (t3 - t2) / n, nthreads, disagree, maxerr,
+		same ? "match" : "differ", pure ? "untouched" : "moved");
+	return pure && same && disagree <= n / 10000 && maxerr < fk_tolerance;
+}
+
+// Body::commit on the success, rejected and clamped paths, against what the old throw and catch cost
+static bool benchCommit()
+{
+	DryLegs dry;
+	Body body(dry.legs);
+	for(auto& l : dry.legs) l.home();
+	std::vector<Leg::Vec3> start;
+	for(auto& l : dry.legs) start.push_back(l.getPosition());
+
+	const int n = 20000;
+	MoveSet fwd, back, bad;
+	for (int i = 0; i < (int)dry.legs.size(); ++i) {
+		fwd.push_back(Pos3(i, 0.5F, 0.25F, 0.1F));
+		back.push_back(Pos3(i, -0.5F, -0.25F, -0.1F));
+		bad.push_back(Pos3(i, 0, 0, i == 2 ? -500.0F : 0));
+	}
+
+	bool ok = true;
+	double t1 = nowNs();
+	for (int i = 0; i < n; ++i) {
+		ok = ok && body.commit(i & 1 ? back : fwd, 1.0F).status == MoveStatus::OK;
+	}
+	double t2 = nowNs();
+
+	// a rejected move must not write any leg
+	for (int i = 0; i < n; ++i) {
+		MoveResult r = body.commit(bad, 1.0F);
+		ok = ok && r.status == MoveStatus::OUT_OF_RANGE && r.legs == (1U << 2);
+	}
+	double t3 = nowNs();
+	// as is one with a leg in it twice
+	ok = ok && body.commit(MoveSet { Pos3(1, 10, 0, 0), Pos3(1, -10, 0, 0) }, 1.0F).status == MoveStatus::INVALID;
+	bool untouched = true;
+	for (size_t i = 0; i < dry.legs.size(); ++i) {
+		float x, y, z, sx, sy, sz;
+		std::tie(x, y, z) = dry.legs[i].getPosition();
+		std::tie(sx, sy, sz) = start[i];
+		untouched = untouched && std::abs(x - sx) < 1e-3F && std::abs(y - sy) < 1e-3F && std::abs(z - sz) < 1e-3F;
+	}
+
+	int caught = 0;
+	double t4 = nowNs();
+	for (int i = 0; i < n; ++i) {
+		try {
+			throw std::range_error("move");
+		} catch(std::range_error& e) {
+			++caught;
+		}
+	}
+	double t5 = nowNs();
+
+	// the clamped leg has to end up on the edge of its reach
+	for (int i = 0; i < n; ++i) {
+		MoveResult r = body.commit(bad, 1.0F, MoveMode::CLAMP);
+		ok = ok && r.status == MoveStatus::CLAMPED && r.legs == (1U << 2);
+	}
+	double t6 = nowNs();
+	float x, y, z;
+	std::tie(x, y, z) = dry.legs[2].getPosition();
+	dry.legs[2].toLegFrame(x, y);
+	float f = sqrtf(x * x + y * y) - Robot::COXA;
+	float edge = std::abs(sqrtf(f * f + z * z) - (Robot::FEMUR + Robot::TIBIA));
+
+	printf("commit: ok %.1f ns, rejected %.1f ns, clamped %.1f ns, throw/catch %.1f ns, rejected move untouched %s, clamped %.3f mm from edge (%d)\n",
+		(t2 - t1) / n, (t3 - t2) / n, (t6 - t5) / n, (t5 - t4) / n, untouched ? "yes" : "no", edge, caught);
+	return ok && untouched && edge < 0.05F;
+}
+
+// the posed feet solved by commit must land back on the unposed feet once the pose is undone
+static bool benchPose()
+{
+	DryLegs dry;
+	Body body(dry.legs);
+	for(auto& l : dry.legs) l.home();
+
+	MoveSet still;
+	for (int i = 0; i < (int)dry.legs.size(); ++i) still.push_back(Pos3(i, 0, 0, 0));
+
+	const int n = 20000;
+	double t1 = nowNs();
+	for (int i = 0; i < n; ++i) body.commit(still, 0);
+	double t2 = nowNs();
+	// a new pose every tick, which is the worst case
+	bool ok = true;
+	for (int i = 0; i < n; ++i) {
+		float f = (i % 100) / 100.0F;
+		body.setPose(BodyPose {0.05F * f, -0.05F * f, 0.1F * f, 5 * f, -4 * f, 8 * f});
+		ok = ok && body.commit(still, 0).status == MoveStatus::OK;
+	}
+	double t3 = nowNs();
+
+	const BodyPose poses[] = {
+		{0, 0, 0, 0, 0, 10},
+		{0.15F, 0, 0, 0, 0, 0},
+		{0, -0.15F, 0, 0, 0, 0},
+		{0, 0, 0.25F, 0, 0, 0},
+		{0.05F, -0.05F, 0.1F, 5, -4, 8},
+	};
+	float maxerr = 0;
+	for(auto& p : poses) {
+		body.setPose(p);
+		ok = ok && body.commit(still, 0).status == MoveStatus::OK;
+
+		// rebuild the same rotation in double and take each solved foot back to the unposed frame
+		double cr = cos(p.roll), sr = sin(p.roll), cp = cos(p.pitch), sp = sin(p.pitch), cy = cos(p.yaw), sy = sin(p.yaw);
+		double r[3][3] = {
+			{cy * cp, cy * sp * sr - sy * cr, cy * sp * cr + sy * sr},
+			{sy * cp, sy * sp * sr + cy * cr, sy * sp * cr - cy * sr},
+			{-sp, cp * sr, cp * cr}
+		};
+		for (size_t i = 0; i < dry.legs.size(); ++i) {
+			float h, k, a, x, y, z, ex, ey, ez;
+			std::tie(h, k, a) = dry.legs[i].getAngles();
+			std::tie(x, y, z) = Leg::forwardKinematics(a, k, h);
+			dry.legs[i].fromLegFrame(x, y);
+			double bx = x + Robot::legs[i].origin[0], by = y + Robot::legs[i].origin[1], bz = z;
+			double wx = r[0][0] * bx + r[0][1] * by + r[0][2] * bz + p.x - Robot::legs[i].origin[0];
+			double wy = r[1][0] * bx + r[1][1] * by + r[1][2] * bz + p.y - Robot::legs[i].origin[1];
+			double wz = r[2][0] * bx + r[2][1] * by + r[2][2] * bz + p.z;
+			std::tie(ex, ey, ez) = dry.legs[i].getPosition();
+			maxerr = std::max(maxerr, (float)std::max(std::abs(wx - ex), std::max(std::abs(wy - ey), std::abs(wz - ez))));
+		}
+	}
+
+	printf("pose: commit %.1f ns unposed, %.1f ns with a new pose each tick, feet max error %g mm\n", (t2 - t1) / n, (t3 - t2) / n, maxerr);
+	return ok && maxerr <= fk_tolerance * 2;
+}
+
+// per tick cost of the incremental IK against the batch analytic IK, following a walking foot path at different control rates
+static bool benchIncremental()
+{
+	const float period = 0.5F; // one step cycle, 50mm stride at 200mm/s
+	const float seconds = 10;
+	bool ok = true;
+
+	for(float rate : {60.0F, 200.0F, 500.0F}) {
+		// every leg on the same path half a cycle apart, forwards on the ground and back in the air
+		int nticks = rate * seconds;
+		std::vector<LegTargets> path(nticks);
+		for (int i = 0; i < nticks; ++i) {
+			for (int l = 0; l < Robot::NLEGS; ++l) {
+				float ph = 2 * M_PI * (i / rate / period + (l & 1) * 0.5F);
+				path[i].x[l] = 80;
+				path[i].y[l] = 25 * cosf(ph);
+				path[i].z[l] = -60 + 20 * std::max(0.0F, sinf(ph));
+			}
+			for (int l = Robot::NLEGS; l < KIN_LANES; ++l) {
+				path[i].x[l] = path[i].y[l] = path[i].z[l] = 0;
+			}
+		}
+
+		int idx[KIN_LANES];
+		for (int l = 0; l < KIN_LANES; ++l) idx[l] = l;
+		IncrementalIK inc;
+		LegAngles a;
+		const int reps = std::max(1, 100000 / nticks);
+		float sum = 0;
+
+		double t1 = nowNs();
+		for (int r = 0; r < reps; ++r) {
+			for(auto& t : path) {
+				batchInverseKinematics(t, a, Robot::NLEGS);
+				sum += a.hip[0];
+			}
+		}
+		double t2 = nowNs();
+		for (int r = 0; r < reps; ++r) {
+			for(auto& t : path) {
+				inc.solve(t, a, idx, Robot::NLEGS);
+				sum += a.hip[0];
+			}
+		}
+		double t3 = nowNs();
+
+		// each incremental solution has to put the foot on its target
+		float maxerr = 0;
+		for(auto& t : path) {
+			if(inc.solve(t, a, idx, Robot::NLEGS) != (1U << Robot::NLEGS) - 1) ok = false;
+			for (int l = 0; l < Robot::NLEGS; ++l) {
+				float x, y, z;
+				std::tie(x, y, z) = Leg::forwardKinematics(a.ankle[l], a.knee[l], a.hip[l]);
+				maxerr = std::max(maxerr, std::max(std::abs(x - t.x[l]), std::max(std::abs(y - t.y[l]), std::abs(z - t.z[l]))));
+			}
+		}
+
+		// a target a short step inside the leg's least reach is left to the analytic IK, which says so
+		LegTargets folded = path.back();
+		folded.x[0] = Robot::COXA;
+		folded.y[0] = 0;
+		folded.z[0] = -(Robot::TIBIA - Robot::FEMUR) - 1;
+		inc.solve(folded, a, idx, Robot::NLEGS);
+		folded.z[0] += 2;
+		uint32_t reach = inc.getStats().reach;
+		if(inc.solve(folded, a, idx, Robot::NLEGS) & 1 || inc.getStats().reach != reach + 1) ok = false;
+
+		const IncrementalIK::Stats& st = inc.getStats();
+		printf("incremental %3.0fHz: analytic %.1f ns/tick, incremental %.1f ns/tick, %.2f%% fell back (cold %u, step %u, reach %u, drift %u, singular %u, aged %u), max foot error %.4f mm (%g)\n",
+			rate, (t2 - t1) / (reps * nticks), (t3 - t2) / (reps * nticks), 100.0F * st.fallbacks() / st.solves,
+			st.cold, st.step, st.reach, st.drift, st.singular, st.aged, maxerr, sum);
+		// a step can miss by more than tolerance for the one tick it takes to notice
+		ok = ok && maxerr <= 0.05F + fk_tolerance;
+	}
+	return ok;
+}
+
+// the runs the PCA9685 frame writes would make for random sets of changed ports, against a write per port
+static bool benchFrame()
+{
+	const int nframes = 100000;
+	bool ok = true;
+	for (float p : { 0.25F, 0.5F, 0.75F, 1.0F }) {
+		// the 9 ports a board drives
+		std::vector<uint16_t> dirty(nframes), known(nframes);
+		for (int f = 0; f < nframes; ++f) {
+			for (int b = 0; b < 9; ++b) {
+				if(frand(0, 1) < p) dirty[f] |= 1 << b;
+			}
+			known[f] = frand(0, 1) < 0.1F ? rand() & 0x1FF : 0x1FF;
+		}
+
+		long changed = 0;
+		for (int f = 0; f < nframes; ++f) changed += __builtin_popcount(dirty[f]);
+		printf("frame: %3.0f%% of ports changed, per port %.2f transactions/%.1f bytes", p * 100, (float)changed / nframes, 5.0F * changed / nframes);
+
+		for (int gap = 0; gap <= 3; ++gap) {
+			long tx = 0, bytes = 0;
+			for (int f = 0; f < nframes; ++f) {
+				uint8_t first[NPORTS], last[NPORTS];
+				int n = adafruitss::planRuns(dirty[f], known[f], gap, first, last);
+				uint16_t covered = 0;
+				for (int r = 0; r < n; ++r) {
+					// in order, not overlapping, starting and ending on a changed port
+					if(first[r] > last[r] || (r > 0 && first[r] <= last[r - 1]) || !(dirty[f] & (1 << first[r])) || !(dirty[f] & (1 << last[r]))) ok = false;
+					uint16_t m = (2 << last[r]) - (1 << first[r]);
+					// only ports that have been written may be rewritten
+					if(m & ~dirty[f] & ~known[f]) ok = false;
+					covered |= m;
+					bytes += 1 + 4 * (last[r] - first[r] + 1);
+				}
+				if((covered & dirty[f]) != dirty[f]) ok = false;
+				tx += n;
+			}
+			printf(", gap %d %.2f/%.1f", gap, (float)tx / nframes, (float)bytes / nframes);
+		}
+		printf("\n");
+	}
+	return ok;
+}
+
+// the bus time per tick of two boards of 9 servos on a simulated bus, for each bus speed and write strategy,
+// with every servo swinging 25° at 1Hz and the ticks at 60Hz
+static bool benchI2C()
+{
+	const int nticks = 600;
+	const char *names[] = { "write per port", "frame, no gaps", "frame, gaps of 2", "frame, hysteresis 1" };
+	uint32_t prev = I2C::simulating();
+	SimI2C::setRealtime(false);
+	bool ok = true;
+	int bus = 100;
+	for (uint32_t hz : { 100000, 400000, 1000000 }) {
+		float per_port = 0;
+		for (int strategy = 0; strategy < 4; ++strategy, ++bus) {
+			I2C::simulate(hz);
+			adafruitss a(bus, 0x40), b(bus, 0x41);
+			adafruitss *boards[2] = { &a, &b };
+			for(auto x : boards) {
+				x->setMaxGap(strategy == 1 ? 0 : 2);
+				for (int p = 0; p < 9; ++p) x->setHysteresis(p, strategy == 3 ? 1 : 0);
+			}
+			I2C::tick();
+			for (int t = 0; t < nticks; ++t) {
+				for (int ch = 0; ch < 18; ++ch) {
+					float angle = 90 + 25 * sinf(2 * M_PI * (t / 60.0F + ch / 18.0F));
+					if(strategy == 0) boards[ch / 9]->servo(ch % 9, 1, angle);
+					else boards[ch / 9]->stage(ch % 9, 1, angle);
+				}
+				if(strategy != 0) {
+					a.flush();
+					b.flush();
+				}
+				I2C::tick();
+			}
+
+			SimI2C::Stats st {};
+			for(auto s : SimI2C::all()) {
+				if(s->getBus() == bus) st = s->getStats();
+			}
+			printf("i2c: %4u kHz %-20s %5.0f/%5.0f us mean/max bus time per tick, keeps up to %5.0f Hz (%5.0f Hz on the worst tick)\n",
+				hz / 1000, names[strategy], st.busy_mean_us, st.busy_max_us, 1e6F / st.busy_mean_us, 1e6F / st.busy_max_us);
+			// every port written on its own is the most there can be
+			float most = 18 * SimI2C::writeBits(5) * 1e6F / hz;
+			if(st.ticks != (uint32_t)nticks || st.busy_max_us > most * 1.001F) ok = false;
+			if(strategy == 0) per_port = st.busy_mean_us;
+			else if(st.busy_mean_us >= per_port) ok = false;
+		}
+	}
+	I2C::simulate(prev);
+
+	// a write runs on through the registers only once MODE1 has auto increment set, as on the PCA9685
+	SimI2C sim(bus, 1000000);
+	const uint8_t off[] = { 0x00, 0x00 }, on[] = { 0x00, 0x20 }, led[] = { 0x06, 1, 2, 3, 4 };
+	sim.write(0x40, off, 2);
+	sim.write(0x40, led, 5);
+	if(sim.readByte(0x40, 0x06) != 4 || sim.readByte(0x40, 0x07) != 0) ok = false;
+	sim.write(0x40, on, 2);
+	sim.write(0x40, led, 5);
+	if(sim.readByte(0x40, 0x06) != 1 || sim.readByte(0x40, 0x09) != 4) ok = false;
+
+	SimI2C::setRealtime(true);
+	return ok;
+}
+
+// the cost per channel of writing through Servo with each backend that runs without hardware, the PCA9685 on a
+// simulated bus, as single writes and as frames. every frame moves every channel, so each one is a write
+static bool benchBackend()
+{
+	const int nframes = 20000;
+	uint32_t prev = I2C::simulating();
+	I2C::simulate(1000000);
+	SimI2C::setRealtime(false);
+	bool ok = true;
+	for (ServoBackend b : { ServoBackend::DUMMY, ServoBackend::RECORD, ServoBackend::PCA9685 }) {
+		printf("backend: %-8s", backendName(b));
+		for (bool frames : { false, true }) {
+			Servo servo;
+			servo.open(b);
+			servo.setFrameWrites(frames);
+			double t1 = nowNs();
+			for (int f = 0; f < nframes; ++f) {
+				for (uint8_t ch = 0; ch < Robot::NSERVOS; ++ch) {
+					float rads = (f & 1 ? 0.2F : -0.2F) + ch * 0.01F;
+					if(frames) servo.stage(ch, rads);
+					else servo.move(ch, rads);
+				}
+				if(frames) servo.commit();
+			}
+			double t2 = nowNs();
+			BusStats st = servo.busStats();
+			printf("%s %s %6.1f ns/channel", frames ? "," : "", frames ? "frames" : "single writes", (t2 - t1) / (nframes * Robot::NSERVOS));
+			// the dummy board keeps no counts
+			if(b != ServoBackend::DUMMY && (st.issued != (uint32_t)nframes * Robot::NSERVOS || st.suppressed != 0)) ok = false;
+		}
+		printf("\n");
+	}
+	I2C::simulate(prev);
+	SimI2C::setRealtime(true);
+	return ok;
+}
+
+// bringing up the two default boards on a simulated 400kHz bus (the wire time is real), each set up on its own twice
+// as they used to be, reprogrammed together, and left as they are when a previous run has already set them
+static bool benchStartup()
+{
+	uint32_t prev = I2C::simulating();
+	I2C::simulate(400000);
+
+	double t1 = nowNs();
+	for (int address : { 0x40, 0x41 }) {
+		adafruitss b(6, address);
+		b.setPWMFreq(60);
+	}
+	double t2 = nowNs();
+	printf("startup: one board at a time %.1f ms\n", (t2 - t1) / 1e6);
+
+	bool ok = true;
+	for (bool fast : { false, true }) {
+		Servo servo;
+		servo.setFastStart(fast);
+		servo.open(ServoBackend::PCA9685);
+		const Servo::StartupTiming& t = servo.startupTiming();
+		printf("startup: %-19s %.1f ms, %d of %d boards reprogrammed, open %.2f ms, program %.2f ms, oscillator %.2f ms\n",
+			fast ? "already set" : "together", t.open_ms + t.program_ms + t.settle_ms + t.enable_ms, t.reprogrammed, t.boards,
+			t.open_ms, t.program_ms, t.settle_ms);
+		if(t.reprogrammed != (fast ? 0 : 2) || (fast && servo.pwmEpoch() != 0)) ok = false;
+	}
+	I2C::simulate(prev);
+	return ok;
+}
+
+// a 250Hz loop of 300us ticks, scheduled the way Timed used to (a relative usleep of the period less the tick) and
+// on absolute deadlines with and without a spin
+static bool benchTimed()
+{
+	const float hz = 250;
+	const uint32_t nticks = 300;
+	auto work = []() { int64_t t = Timed::nanos() + 300000; while(Timed::nanos() < t) {} };
+
+	int64_t t1 = Timed::nanos();
+	for (uint32_t j = 0; j < nticks; ++j) {
+		int64_t s = Timed::nanos();
+		work();
+		int64_t took = (Timed::nanos() - s) / 1000;
+		if(took < 1e6 / hz) usleep(1e6 / hz - took);
+	}
+	float rate = nticks * 1e9F / (Timed::nanos() - t1);
+	printf("timed: relative usleep %7.2f Hz, %+.2f%% off\n", rate, (rate / hz - 1) * 100);
+
+	bool ok = true;
+	for (int spin : { 0, 200 }) {
+		Timed timed(hz);
+		timed.setSpin(spin * 1000);
+		timed.run(nticks, [&](uint32_t) { work(); });
+		Timed::Stats st = timed.getStats();
+		printf("timed: deadlines, %3d us spin %7.2f Hz, %+.2f%% off, %u overran, wakeup %.1f/%.1f/%.1f us min/mean/max, %.1f us sd\n",
+			spin, st.rate, (st.rate / hz - 1) * 100, st.overruns, st.min_us, st.mean_us, st.max_us, st.sd_us);
+		// without an overrun the deadlines don't drift, an overrun loses the time it ran over
+		if(st.ticks != nticks || st.rate > hz * 1.002F || (st.overruns == 0 && st.rate < hz * 0.998F)) ok = false;
+	}
+	return ok;
+}
+
+// the same loop with every 20th tick taking 10ms, 2.5 periods, under each overrun policy. They all have to make every
+// step, drop and catch up in the time the schedule says
+static bool benchOverrun()
+{
+	const float hz = 250;
+	const uint32_t nsteps = 300;
+	const float ideal_ms = nsteps * 1e3F / hz;
+
+	bool ok = true;
+	for (Timed::Overrun o : { Timed::Overrun::STRETCH, Timed::Overrun::DROP, Timed::Overrun::CATCH_UP }) {
+		Timed timed(hz);
+		timed.setOverrun(o);
+		uint32_t n = 0, steps = 0;
+		int64_t t1 = Timed::nanos();
+		timed.run(nsteps, [&](uint32_t s) {
+			int64_t t = Timed::nanos() + (++n % 20 == 0 ? 10000000 : 300000);
+			while(Timed::nanos() < t) {}
+			steps += s;
+		});
+		float ms = (Timed::nanos() - t1) / 1e6F;
+		Timed::Stats st = timed.getStats();
+		printf("overrun: %-8s %u ticks made %u steps in %6.1f ms (schedule %1.0f ms, %+5.1f%%), %u overran, %u dropped\n",
+			Timed::overrunName(o), st.ticks, steps, ms, ideal_ms, (ms / ideal_ms - 1) * 100, st.overruns, st.dropped);
+		printf("overrun: %-8s ", Timed::overrunName(o));
+		timed.printHistograms(stdout);
+
+		if(steps != nsteps || timed.execHistogram().total() != st.ticks || timed.overrunHistogram().total() != st.overruns) ok = false;
+		if(o == Timed::Overrun::STRETCH ? ms < ideal_ms * 1.05F : fabsf(ms / ideal_ms - 1) > 0.02F) ok = false;
+		if(o == Timed::Overrun::DROP ? st.ticks + st.dropped != nsteps : st.ticks != nsteps) ok = false;
+	}
+	return ok;
+}
+
+// a wave gait cycle of raise, move and lower through Timed at 1kHz, the move sets built per step and captured by
+// value the way the gaits do. Neither the ticks nor the steps around them may allocate, the same step through a
+// std::function holding a std::vector shows what it used to cost
+static bool benchAlloc()
+{
+	DryLegs dry;
+	Body body(dry.legs);
+	for(auto& l : dry.legs) l.home();
+	Timed timed(1000);
+	const uint32_t iterations = 20;
+	const float slice = 1.0F / iterations;
+
+	uint64_t a = RealTime::allocations();
+	bool ok = true;
+	for (int s = 0; s < Robot::NLEGS; ++s) {
+		MoveSet raise {Pos3(s, 0, 0, 10)}, lower {Pos3(s, 0, 0, -10)}, step;
+		step.push_back(Pos3(s, 10, 0, 0));
+		for (int l = 0; l < Robot::NLEGS; ++l) {
+			if(l != s) step.push_back(Pos3(l, -2, 0, 0));
+		}
+		for(const MoveSet *m : { &raise, &step, &lower }) {
+			MoveSet moves = *m;
+			timed.run(iterations, [moves, slice, &body, &ok](uint32_t steps) {
+				ok = body.commit(moves, slice * steps).ok() && ok;
+			});
+		}
+	}
+	uint64_t cycle = RealTime::allocations() - a;
+	Timed::Stats st = timed.getStats();
+
+	a = RealTime::allocations();
+	for (int s = 0; s < Robot::NLEGS; ++s) {
+		std::vector<Pos3> moves;
+		for (int l = 0; l < Robot::NLEGS; ++l) moves.push_back(Pos3(l, 0, 0, 0));
+		std::function<void(uint32_t)> fnc = [moves, slice](uint32_t) {};
+		fnc(1);
+	}
+	uint64_t old = RealTime::allocations() - a;
+
+	// the counting operator new still calls the new handler before it gives up, and nothrow new still returns null
+	static int handled;
+	handled = 0;
+	std::set_new_handler([]() { ++handled; std::set_new_handler(nullptr); });
+	bool threw = false;
+	const size_t huge = std::numeric_limits<size_t>::max() / 2;
+	try {
+		operator delete(operator new(huge));
+	} catch(std::bad_alloc&) {
+		threw = true;
+	}
+	ok = ok && threw && handled == 1 && operator new(huge, std::nothrow) == nullptr;
+
+	printf("alloc: %u ticks, %u allocations in the ticks, %llu in the whole cycle, wakeup %1.0f/%1.0f us mean/max (a std::function of a std::vector made %llu), new handler %s\n",
+		st.ticks, st.allocations, (unsigned long long)cycle, st.mean_us, st.max_us, (unsigned long long)old, threw && handled == 1 ? "called" : "skipped");
+	return ok && st.allocations == 0 && cycle == 0;
+}
+
+// a producer and a consumer through the ring, every value must arrive once and in order. Then a walk of out and back
+// segments at 500Hz with the planner taking 3ms over each, run as it is planned and queued ahead to the executor,
+// which has to keep to the schedule and not stop between them. Then a turn that fails on the executor
+static bool benchTrajectory()
+{
+	SpscRing<uint32_t, 16> ring;
+	const uint32_t nvalues = 2000000;
+	uint32_t bad = 0, full = 0;
+	double t1 = nowNs();
+	std::thread consumer([&]() {
+		uint32_t v, want = 0;
+		while(want < nvalues) {
+			if(!ring.pop(v)) {
+				std::this_thread::yield();
+				continue;
+			}
+			if(v != want) ++bad;
+			want = v + 1;
+		}
+	});
+	for (uint32_t v = 0; v < nvalues; ++v) {
+		while(!ring.push(v)) {
+			++full;
+			std::this_thread::yield();
+		}
+	}
+	consumer.join();
+	double t2 = nowNs();
+	printf("trajectory: ring %u values, %1.1f ns each, %u out of order, %u pushes found it full\n", nvalues, (t2 - t1) / nvalues, bad, full);
+
+	const float hz = 500;
+	const int nsegments = 20;
+	const uint32_t ticks = 20;
+	const float schedule_ms = nsegments * ticks * 1e3F / hz;
+	DryLegs dry;
+	Body body(dry.legs);
+	bool ok = bad == 0;
+	for (int depth : { 0, 4 }) {
+		for(auto& l : dry.legs) l.home();
+		Timed timed(hz);
+		Trajectory trajectory(body, dry.legs, timed);
+		if(depth > 0) trajectory.start(depth);
+		t1 = nowNs();
+		for (int s = 0; s < nsegments; ++s) {
+			usleep(3000); // planning it
+			Segment seg;
+			seg.ticks = ticks;
+			for (int l = 0; l < Robot::NLEGS; ++l) seg.moves.push_back(Pos3(l, s & 1 ? -10 : 10, 0, 0));
+			trajectory.run(seg);
+		}
+		trajectory.stop();
+		float ms = (nowNs() - t1) / 1e6F;
+		Timed::Stats st = timed.getStats();
+		float x = std::get<0>(dry.legs[0].getPosition()), hx = std::get<0>(dry.legs[0].getHomeCoordinates());
+
+		if(depth == 0) {
+			printf("trajectory: as planned,   %u ticks in %6.1f ms (schedule %1.0f ms, %+5.1f%%)\n", st.ticks, ms, schedule_ms, (ms / schedule_ms - 1) * 100);
+		}else{
+			const Trajectory::Stats& ts = trajectory.getStats();
+			printf("trajectory: %d ahead,      %u ticks in %6.1f ms (schedule %1.0f ms, %+5.1f%%), %u segments, started %u times, planner waited %u times\n",
+				depth, st.ticks, ms, schedule_ms, (ms / schedule_ms - 1) * 100, ts.segments, ts.starts, ts.waits);
+			// the executor never ran dry, so it kept to the schedule whatever the wall clock of a loaded machine says
+			if(ts.segments != nsegments || ts.starts != 1) ok = false;
+		}
+		if(st.ticks != nsegments * ticks || fabsf(x - hx) > 0.01F) ok = false;
+	}
+
+	// a turn the legs can't make fails on the executor without writing them, and the drain hands it back once
+	{
+		for(auto& l : dry.legs) l.home();
+		Timed timed(hz);
+		Trajectory trajectory(body, dry.legs, timed);
+		trajectory.start(4);
+		Segment turn;
+		turn.kind = Segment::ROTATE;
+		turn.ticks = 2;
+		for (int l = 0; l < Robot::NLEGS; ++l) turn.rotate[l] = 90;
+		turn.rotating = (1 << Robot::NLEGS) - 1;
+		trajectory.run(turn);
+		MoveResult r = trajectory.drain();
+		bool again = trajectory.drain().ok();
+		trajectory.stop();
+		float x = std::get<0>(dry.legs[0].getPosition()), hx = std::get<0>(dry.legs[0].getHomeCoordinates());
+		bool handed = r.status == MoveStatus::OUT_OF_RANGE && again && fabsf(x - hx) < 0.01F;
+		printf("trajectory: a turn out of reach on the executor %s\n", handed ? "was handed back with the legs untouched" : "was not handed back");
+		ok = ok && handed;
+	}
+	return ok;
+}
+
+// a fast writer and a slow reader through the triple buffer, the reader must only ever see whole frames and in order
+static bool benchTripleBuffer()
+{
+	struct Frame { uint32_t seq; float angle[Robot::NSERVOS]; };
+	TripleBuffer<Frame> tb;
+	const uint32_t nframes = 2000000;
+	std::atomic<bool> done {false};
+	uint32_t overwritten = 0;
+
+	double t1 = nowNs();
+	std::thread writer([&]() {
+		for (uint32_t seq = 1; seq <= nframes; ++seq) {
+			Frame& f = tb.writeBuffer();
+			f.seq = seq;
+			for (int i = 0; i < Robot::NSERVOS; ++i) f.angle[i] = seq;
+			if(tb.publish()) ++overwritten;
+		}
+		done = true;
+	});
+
+	uint32_t reads = 0, last = 0, torn = 0, backwards = 0;
+	while(true) {
+		// done has to be read before the last update so the final frame is not missed
+		bool finished = done;
+		if(tb.update()) {
+			const Frame& f = tb.readBuffer();
+			for (int i = 0; i < Robot::NSERVOS; ++i) {
+				if(f.angle[i] != (float)f.seq) ++torn;
+			}
+			if(f.seq <= last) ++backwards;
+			last = f.seq;
+			++reads;
+		} else if(finished) {
+			break;
+		}
+	}
+	writer.join();
+	double t2 = nowNs();
+
+	printf("triplebuffer: %u frames published, %u read, %u dropped, last %u, %u torn, %u out of order, %.1f ns/frame\n",
+		nframes, reads, overwritten, last, torn, backwards, (t2 - t1) / nframes);
+	return torn == 0 && backwards == 0 && last == nframes && reads + overwritten == nframes;
+}
+
+// what happens to the frames of a loop against a PWM that runs at 57.5Hz, in simulated time
+struct PwmSim {
+	const double period = 1e9 / 57.5;
+	const double epoch = 1234567;
+	int64_t last_cycle = -1;
+	int lost = 0, stalled = 0, frames = 0;
+	float wait_min = 1e9F, wait_max = 0;
+
+	// a frame written at done goes out at the start of the next cycle
+	void written(int64_t done, bool count)
+	{
+		int64_t cycle = ceil((done - epoch) / period);
+		if(count) {
+			++frames;
+			if(cycle == last_cycle) ++lost; // replaced before it went out
+			else if(cycle > last_cycle + 1) stalled += cycle - last_cycle - 1; // cycles with no new frame
+			float w = (epoch + cycle * period - done) / 1000;
+			wait_min = std::min(wait_min, w);
+			wait_max = std::max(wait_max, w);
+		}
+		last_cycle = cycle;
+	}
+	void print(const char *name) const
+	{
+		printf("phaselock: %-18s %5d frames, %4d lost, %4d cycles without a frame, write to output %4.0f to %5.0f us\n",
+			name, frames, lost, stalled, wait_min, wait_max);
+	}
+};
+
+// the locked loop against one running at a fixed 61.5Hz, with 0.8 to 1.6ms ticks and the sync edges
+// seen 10 to 60us late
+static bool benchPhaseLock()
+{
+	const int nticks = 20000, settle = 200;
+
+	PwmSim locked;
+	PhaseLock pl(60, 0);
+	double edge = locked.epoch;
+	int64_t t = 0;
+	for (int i = 0; i < nticks; ++i) {
+		int64_t b = pl.slot(t);
+		int64_t start = std::max(t, b - pl.getLead());
+		for (; edge <= start; edge += locked.period) pl.edge(edge + frand(10000, 60000));
+		int64_t done = start + frand(800000, 1600000);
+		pl.record(start, done, b);
+		locked.written(done, i >= settle);
+		t = done;
+	}
+	PhaseLock::Stats st = pl.getStats();
+
+	PwmSim fixed;
+	t = 0;
+	for (int i = 0; i < nticks; ++i) {
+		int64_t done = t + frand(800000, 1600000);
+		fixed.written(done, i >= settle);
+		// Timed sleeps off the rest of the period
+		t += 1e9 / 61.5;
+	}
+
+	locked.print("phase locked:");
+	fixed.print("fixed 61.5Hz:");
+	printf("phaselock: locked at %.3f Hz, %u late, %u skipped, phase error %.0f/%.0f/%.0f us, lead %.0f us, %u resyncs\n",
+		pl.frequency(), st.late, st.skipped, st.min_us, st.mean_us, st.max_us, pl.getLead() / 1000.0F, st.resyncs);
+	return locked.lost == 0 && locked.stalled == 0 && std::abs(pl.frequency() - 57.5F) < 0.01F;
+}
+
+// the servo angle for a joint angle without calibration, as Servo works it out
+static float referenceAngle(int ch, float rads)
+{
+	rads = rads * Robot::reverse[ch] + (float)M_PI_2;
+	while (rads > 2 * (float)M_PI) rads -= 2 * (float)M_PI;
+	while (rads < 0) rads += 2 * (float)M_PI;
+	float degrees = rads * (180.0F / (float)M_PI) + Robot::trim[ch];
+	return degrees < 0 ? 0 : degrees;
+}
+
+// and the ticks adafruitss gives that for a type 1 servo
+static uint16_t referenceTicks(int ch, float rads, float ticks_per_ms)
+{
+	return roundf(ticks_per_ms * 0.6F + ticks_per_ms * referenceAngle(ch, rads) / 100);
+}
+
+// a calibration captured from the uncalibrated mapping has to give the same ticks, and the time per channel of both
+static bool benchCalibration()
+{
+	const float ticks_per_ms = 4096 * 60 / 1000.0F;
+	Calibration cal;
+	for (int ch = 0; ch < Robot::NSERVOS; ++ch) {
+		for (int deg = -75; deg <= 75; deg += 25) {
+			cal.addPoint(ch, deg, 600 + 10 * referenceAngle(ch, deg * (float)M_PI / 180));
+		}
+	}
+	cal.compile(ticks_per_ms);
+
+	const int n = 100000;
+	std::vector<float> rads(n * Robot::NSERVOS);
+	for(float& r : rads) r = frand(-75, 75) * (float)M_PI / 180;
+
+	int maxdiff = 0;
+	for (int i = 0; i < n * Robot::NSERVOS; ++i) {
+		int ch = i % Robot::NSERVOS;
+		maxdiff = std::max(maxdiff, std::abs(cal.ticks(ch, rads[i]) - referenceTicks(ch, rads[i], ticks_per_ms)));
+	}
+
+	std::vector<uint16_t> out(n * Robot::NSERVOS);
+	double t1 = nowNs();
+	for (int i = 0; i < n * Robot::NSERVOS; ++i) out[i] = referenceTicks(i % Robot::NSERVOS, rads[i], ticks_per_ms);
+	double t2 = nowNs();
+	for (int i = 0; i < n * Robot::NSERVOS; ++i) out[i] += cal.ticks(i % Robot::NSERVOS, rads[i]);
+	double t3 = nowNs();
+	long sum = 0;
+	for(uint16_t t : out) sum += t;
+
+	printf("calibration: %d channels, max %d ticks from the uncalibrated mapping, %.1f ns/channel uncalibrated, %.1f ns/channel calibrated (%ld)\n",
+		Robot::NSERVOS, maxdiff, (t2 - t1) / (n * Robot::NSERVOS), (t3 - t2) / (n * Robot::NSERVOS), sum);
+	return cal.calibratedMask() == (1UL << Robot::NSERVOS) - 1 && maxdiff <= 1;
+}
+
+// true if leg can put its foot at x, y, z (leg coordinates) with every servo in range
+static bool legReaches(int leg, float x, float y, float z)
+{
+	float h, k, a;
+	std::tie(h, k, a) = Leg::inverseKinematics(x, y, z);
+	return ReachMap::inRange(leg, h, k, a);
+}
+
+// generating the reachability map on one thread and on all of them, and checking the map and the limits it gives
+static bool benchReach()
+{
+	const float spacing = 2;
+	const char *fn1 = "/tmp/hexapod-reach1.bin", *fn = "/tmp/hexapod-reach.bin";
+	double t1 = nowNs();
+	bool ok = ReachMap::generate(fn1, spacing, 1);
+	double t2 = nowNs();
+	ok = ok && ReachMap::generate(fn, spacing);
+	double t3 = nowNs();
+
+	// both have to be the same bits
+	bool same = false;
+	FILE *f1 = fopen(fn1, "rb"), *f2 = fopen(fn, "rb");
+	if(f1 != nullptr && f2 != nullptr) {
+		int c1, c2;
+		do {
+			c1 = fgetc(f1);
+			c2 = fgetc(f2);
+		} while(c1 == c2 && c1 != EOF);
+		same = c1 == c2;
+	}
+	if(f1 != nullptr) fclose(f1);
+	if(f2 != nullptr) fclose(f2);
+	remove(fn1);
+
+	ReachMap map;
+	ok = ok && same && map.load(fn);
+	remove(fn);
+	if(!ok) {
+		printf("reach: generate or load failed\n");
+		return false;
+	}
+
+	// everywhere the map says is reachable has to be, it may miss a little of the boundary
+	const int npoints = 200000;
+	const float reach = Robot::COXA + Robot::FEMUR + Robot::TIBIA;
+	int inside = 0, wrong = 0;
+	for (int i = 0; i < npoints; ++i) {
+		int l = rand() % Robot::NLEGS;
+		float x = frand(-reach, reach), y = frand(-reach, reach), z = frand(-Robot::FEMUR - Robot::TIBIA, Robot::FEMUR + Robot::TIBIA);
+		if(!map.reachable(l, x, y, z)) continue;
+		++inside;
+		if(!legReaches(l, x, y, z)) ++wrong;
+	}
+
+	// every leg has to be able to step the whole stride the map allows, in any direction and at any height it allows
+	float zlo = 0, zhi = 0;
+	int steps = 0, bad_steps = 0;
+	bool height_ok = map.heightRange(MAX_RAISE, zlo, zhi);
+	for (int i = 0; i < 200 && height_ok; ++i) {
+		float dir = frand(-M_PI, M_PI), z = frand(zlo, zhi);
+		float stride = map.maxStride(dir, z, MAX_RAISE);
+		for (int l = 0; l < Robot::NLEGS; ++l) {
+			const float (*m)[2] = Robot::legs[l].mat;
+			float dx = cosf(dir) * m[0][0] + sinf(dir) * m[1][0];
+			float dy = cosf(dir) * m[0][1] + sinf(dir) * m[1][1];
+			for (int s = -10; s <= 10; ++s) {
+				float d = stride / 2 * s / 10;
+				float x = Robot::COXA + Robot::FEMUR + d * dx, y = d * dy;
+				++steps;
+				if(!legReaches(l, x, y, z) || !legReaches(l, x, y, z + MAX_RAISE)) ++bad_steps;
+			}
+		}
+	}
+
+	float sum = 0;
+	const int nq = 1000000;
+	double t4 = nowNs();
+	for (int i = 0; i < nq; ++i) sum += map.maxStride(i * 0.001F, -Robot::TIBIA - 10, MAX_RAISE);
+	double t5 = nowNs();
+
+	printf("reach: %gmm map generated in %.0f ms on 1 thread, %.0f ms on %u, %.3f%% of %d reachable points wrong, %d of %d stride steps out of range\n",
+		spacing, (t2 - t1) / 1e6, (t3 - t2) / 1e6, std::thread::hardware_concurrency(), inside ? 100.0F * wrong / inside : 0, inside, bad_steps, steps);
+	float zmid = (zlo + zhi) / 2;
+	printf("reach: feet from z %g to %g, at z %g stride %.1f mm forward %.1f mm sideways, rotation %.1f°, %.1f ns/query (%g)\n",
+		zlo, zhi, zmid, map.maxStride(0, zmid, MAX_RAISE), map.maxStride(M_PI_2, zmid, MAX_RAISE),
+		DEGREES(map.maxRotation(zmid, MAX_RAISE)), (t5 - t4) / nq, sum);
+	return height_ok && wrong <= inside / 1000 && bad_steps <= steps / 1000;
+}
+
+// error against double precision libm and ns/call for one accuracy tier
+template<int Tier>
+static void benchMathTier()
+{
+	typedef FastMath<Tier> M;
+	const int n = 100000;
+	std::vector<float> a(n), b(n), c(n), d(n);
+	for (int i = 0; i < n; ++i) {
+		a[i] = frand(-2 * M_PI, 2 * M_PI);
+		b[i] = frand(-150, 150);
+		c[i] = frand(-1, 1);
+		d[i] = frand(0, 20000);
+	}
+
+	double esin = 0, ecos = 0, eatan = 0, eacos = 0, esqrt = 0;
+	for (int i = 0; i < n; ++i) {
+		esin = std::max(esin, std::abs(M::sin(a[i]) - sin((double)a[i])));
+		ecos = std::max(ecos, std::abs(M::cos(a[i]) - cos((double)a[i])));
+		eatan = std::max(eatan, std::abs(M::atan2(b[i], b[n - 1 - i]) - atan2((double)b[i], (double)b[n - 1 - i])));
+		eacos = std::max(eacos, std::abs(M::acos(c[i]) - acos((double)c[i])));
+		esqrt = std::max(esqrt, std::abs(M::sqrt(d[i]) - sqrt((double)d[i])) / sqrt((double)d[i]));
+	}
+
+	// results go to memory rather than a running sum so this measures throughput not latency
+	std::vector<float> r(n);
+	double t[6];
+	t[0] = nowNs();
+	for (int i = 0; i < n; ++i) r[i] = M::sin(a[i]);
+	t[1] = nowNs();
+	for (int i = 0; i < n; ++i) r[i] += M::cos(a[i]);
+	t[2] = nowNs();
+	for (int i = 0; i < n; ++i) r[i] += M::atan2(b[i], b[n - 1 - i]);
+	t[3] = nowNs();
+	for (int i = 0; i < n; ++i) r[i] += M::acos(c[i]);
+	t[4] = nowNs();
+	for (int i = 0; i < n; ++i) r[i] += M::sqrt(d[i]);
+	t[5] = nowNs();
+	float sum = 0;
+	for(float f : r) sum += f;
+
+	printf("math %-8s sin %.2e %4.1fns, cos %.2e %4.1fns, atan2 %.2e %4.1fns, acos %.2e %4.1fns, sqrt %.2e(rel) %4.1fns (%g)\n", M::name(),
+		esin, (t[1] - t[0]) / n, ecos, (t[2] - t[1]) / n, eatan, (t[3] - t[2]) / n, eacos, (t[4] - t[3]) / n, esqrt, (t[5] - t[4]) / n, sum);
+}
+
+// error of the batch kernels, which use this build's tier, over the ranges the kinematics give them
+static bool benchBatchMath()
+{
+	const int n = 100000 / SIMD_WIDTH * SIMD_WIDTH;
+	std::vector<float> a(n), b(n), c(n), r(n);
+	for (int i = 0; i < n; ++i) {
+		a[i] = frand(-M_PI, M_PI);
+		b[i] = frand(-150, 150);
+		c[i] = frand(-1, 1);
+	}
+
+	double esin = 0, ecos = 0, eatan = 0, eacos = 0;
+	for (int i = 0; i < n; i += SIMD_WIDTH) {
+		vstore(&r[i], vsin(vload(&a[i])));
+		for (int j = i; j < i + SIMD_WIDTH; ++j) esin = std::max(esin, std::abs(r[j] - sin((double)a[j])));
+		vstore(&r[i], vcos(vload(&a[i])));
+		for (int j = i; j < i + SIMD_WIDTH; ++j) ecos = std::max(ecos, std::abs(r[j] - cos((double)a[j])));
+		vstore(&r[i], vatan2(vload(&b[i]), vload(&b[n - SIMD_WIDTH - i])));
+		for (int j = i; j < i + SIMD_WIDTH; ++j) eatan = std::max(eatan, std::abs(r[j] - atan2((double)b[j], (double)b[n - SIMD_WIDTH - i + j - i])));
+		vstore(&r[i], vacos(vload(&c[i])));
+		for (int j = i; j < i + SIMD_WIDTH; ++j) eacos = std::max(eacos, std::abs(r[j] - acos((double)c[j])));
+	}
+
+	printf("math batch x%d sin %.2e, cos %.2e, atan2 %.2e, acos %.2e\n", SIMD_WIDTH, esin, ecos, eatan, eacos);
+	// each tier's own bound, libm's batch is the precise polynomials
+	double bound = MATH_TIER == MATH_FAST ? 1e-3 : 1e-5;
+	return esin < bound && ecos < bound && eatan < bound && eacos < bound;
+}
+
+static bool benchMath()
+{
+	benchMathTier<MATH_LIBM>();
+	benchMathTier<MATH_PRECISE>();
+	benchMathTier<MATH_FAST>();
+	printf("math: this build uses %s\n", FMath::name());
+	return benchBatchMath();
+}
+
+int runBenchmark(const char *name)
+{
+	struct {
+		const char *name;
+		bool (*fnc)();
+	} benches[] = {
+		{ "ik", benchIK },
+		{ "fk", benchFK },
+		{ "iktable", benchIKTable },
+		{ "evaluate", benchEvaluate },
+		{ "commit", benchCommit },
+		{ "pose", benchPose },
+		{ "incremental", benchIncremental },
+		{ "reach", benchReach },
+		{ "triplebuffer", benchTripleBuffer },
+		{ "phaselock", benchPhaseLock },
+		{ "frame", benchFrame },
+		{ "i2c", benchI2C },
+		{ "backend", benchBackend },
+		{ "startup", benchStartup },
+		{ "timed", benchTimed },
+		{ "overrun", benchOverrun },
+		{ "alloc", benchAlloc },
+		{ "trajectory", benchTrajectory },
+		{ "calibration", benchCalibration },
+		{ "math", benchMath },
+	};
+
+	bool found = false, failed = false;
+	for(auto& b : benches) {
+		if(strcmp(name, "all") == 0 || strcmp(name, b.name) == 0) {
+			if(!b.fnc()) {
+				fprintf(stderr, "FAILED: %s\n", b.name);
+				failed = true;
+			}
+			found = true;
+		}
+	}
+
+	if(!found) {
+		fprintf(stderr, "Unknown benchmark: %s\n", name);
+		return 1;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+/**
+	Polynomial approximations of the trig and sqrt used in the kinematics and gaits.
+	The accuracy tier is a template parameter so each call site folds to straight line code,
+	FMath is the tier the build uses for one value at a time and the batch kernels in simd.h evaluate the same tier's
+	polynomials on vectors, pick it with -DMATH_TIER=n (see -K math for the error and speed of each).
+
+	MATH_LIBM    plain libm, the batch kernels use the precise polynomials as libm has no vector form
+	MATH_PRECISE libm for single values, which no polynomial beats, and cephes polynomials, about 1e-7 radians, in
+	             the batch kernels
+	MATH_FAST    low order polynomials, about 1e-4 radians, well under a PWM tick of servo movement
+*/
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#define MATH_LIBM 0
+#define MATH_PRECISE 1
+#define MATH_FAST 2
+
+#ifndef MATH_TIER
+#define MATH_TIER MATH_PRECISE
+#endif
+
+// what the polynomials below are evaluated with, O::V is a float here and a vector in simd.h. Selects rather than
+// branches so the same code does every lane
+struct ScalarOps
+{
+	typedef float V;
+	typedef bool M;
+	static V k(float f) { return f; }
+	static V abs(V v) { return std::abs(v); }
+	static V min(V a, V b) { return std::min(a, b); }
+	static V max(V a, V b) { return std::max(a, b); }
+	static V sqrt(V v) { return sqrtf(v); }
+	static M gt(V a, V b) { return a > b; }
+	static M lt(V a, V b) { return a < b; }
+	static V select(M m, V a, V b) { return m ? a : b; }
+};
+
+// range folding shared by the polynomial tiers, T supplies the polynomials on the folded ranges
+template<class T> struct MathPolyBase
+{
+	// over [-3pi/2, 3pi/2], folded into [-pi/2, pi/2] for T::sinFolded
+	template<class O> static typename O::V sin(typename O::V x)
+	{
+		x = O::select(O::gt(x, O::k(M_PI_2)), O::k(M_PI) - x, x);
+		x = O::select(O::lt(x, O::k(-M_PI_2)), O::k(-M_PI) - x, x);
+		return T::template sinFolded<O>(x);
+	}
+
+	// over [-pi, 2pi]
+	template<class O> static typename O::V cos(typename O::V x) { return sin<O>(O::k(M_PI_2) - x); }
+
+	// T::atanUnit takes min/max of the two, which is [0, 1], then the octant is folded back in
+	template<class O> static typename O::V atan2(typename O::V y, typename O::V x)
+	{
+		typedef typename O::V V;
+		const V zero = O::k(0);
+		V ax = O::abs(x), ay = O::abs(y);
+		V r = T::template atanUnit<O>(O::min(ax, ay) / O::max(O::max(ax, ay), O::k(1e-30F)));
+		r = O::select(O::gt(ay, ax), O::k(M_PI_2) - r, r);
+		r = O::select(O::lt(x, zero), O::k(M_PI) - r, r);
+		return O::select(O::lt(y, zero), zero - r, r);
+	}
+};
+
+// the polynomials of each tier
+template<int Tier> struct MathPoly;
+
+// cephes, about 1e-7 radians
+template<> struct MathPoly<MATH_PRECISE> : MathPolyBase<MathPoly<MATH_PRECISE>>
+{
+	// degree 11 Taylor series
+	template<class O> static typename O::V sinFolded(typename O::V x)
+	{
+		typename O::V z = x * x;
+		return ((((O::k(-2.5052108e-8F) * z + O::k(2.7557319e-6F)) * z - O::k(1.9841270e-4F)) * z + O::k(8.3333333e-3F)) * z - O::k(1.6666667e-1F)) * z * x + x;
+	}
+
+	// atanf, reduced to t <= tan(pi/8)
+	template<class O> static typename O::V atanUnit(typename O::V t)
+	{
+		typedef typename O::V V;
+		auto big = O::gt(t, O::k(0.41421356F));
+		t = O::select(big, (t - O::k(1)) / (t + O::k(1)), t);
+		V z = t * t;
+		V p = ((O::k(8.05374449538e-2F) * z - O::k(1.38776856032e-1F)) * z + O::k(1.99777106478e-1F)) * z - O::k(3.33329491539e-1F);
+		return p * z * t + t + O::select(big, O::k(M_PI_4), O::k(0));
+	}
+
+	// asinf based, x must be in [-1, 1]. For |x| > 0.5 it is asin(sqrt((1-|x|)/2)) to keep the precision near ±1
+	template<class O> static typename O::V acos(typename O::V x)
+	{
+		typedef typename O::V V;
+		const V zero = O::k(0);
+		const V half = O::k(0.5F);
+		V ax = O::abs(x);
+		auto big = O::gt(ax, half);
+		V zb = half * (O::k(1) - ax);
+		V s = O::select(big, O::sqrt(zb), ax);
+		V z = O::select(big, zb, ax * ax);
+		V p = ((((O::k(4.2163199048e-2F) * z + O::k(2.4181311049e-2F)) * z + O::k(4.5470025998e-2F)) * z + O::k(7.4953002686e-2F)) * z + O::k(1.6666752422e-1F)) * z * s + s;
+		auto neg = O::lt(x, zero);
+		V small_r = O::k(M_PI_2) - O::select(neg, zero - p, p);
+		V big_r = O::select(neg, O::k(M_PI) - (p + p), p + p);
+		return O::select(big, big_r, small_r);
+	}
+};
+
+// libm has no vector form, a batch in a libm build uses the precise polynomials
+template<> struct MathPoly<MATH_LIBM> : MathPoly<MATH_PRECISE> {};
+
+template<> struct MathPoly<MATH_FAST> : MathPolyBase<MathPoly<MATH_FAST>>
+{
+	template<class O> static typename O::V sinFolded(typename O::V x)
+	{
+		typename O::V z = x * x;
+		return (O::k(7.61e-3F) * z - O::k(1.6605e-1F)) * z * x + x;
+	}
+
+	// Abramowitz and Stegun 4.4.47
+	template<class O> static typename O::V atanUnit(typename O::V t)
+	{
+		typename O::V z = t * t;
+		return ((((O::k(0.0208351F) * z - O::k(0.0851330F)) * z + O::k(0.1801410F)) * z - O::k(0.3302995F)) * z + O::k(0.9998660F)) * t;
+	}
+
+	// Abramowitz and Stegun 4.4.45, x must be in [-1, 1]
+	template<class O> static typename O::V acos(typename O::V x)
+	{
+		typedef typename O::V V;
+		V ax = O::abs(x);
+		V r = (((O::k(-0.0187293F) * ax + O::k(0.0742610F)) * ax - O::k(0.2121144F)) * ax + O::k(1.5707288F)) * O::sqrt(O::k(1) - ax);
+		return O::select(O::lt(x, O::k(0)), O::k(M_PI) - r, r);
+	}
+};
+
+template<int Tier> struct FastMath;
+
+template<> struct FastMath<MATH_LIBM>
+{
+	static const char *name() { return "libm"; }
+	static float sin(float x) { return sinf(x); }
+	static float cos(float x) { return cosf(x); }
+	static float atan2(float y, float x) { return atan2f(y, x); }
+	static float acos(float x) { return acosf(x); }
+	static float sqrt(float x) { return sqrtf(x); }
+};
+
+// the cephes polynomials measured slower than libm one value at a time, they only pay off in the batch kernels
+template<> struct FastMath<MATH_PRECISE> : FastMath<MATH_LIBM>
+{
+	static const char *name() { return "precise"; }
+};
+
+template<> struct FastMath<MATH_FAST>
+{
+	typedef MathPoly<MATH_FAST> P;
+
+	static const char *name() { return "fast"; }
+
+	static float sin(float x)
+	{
+		// reduce to [-pi, pi] for the polynomial's folding
+		const float tau = 2 * M_PI;
+		int k = (int)(x * (1 / tau) + (x >= 0 ? 0.5F : -0.5F));
+		return P::sin<ScalarOps>(x - k * tau);
+	}
+
+	static float cos(float x) { return sin(x + (float)M_PI_2); }
+	static float atan2(float y, float x) { return P::atan2<ScalarOps>(y, x); }
+
+	// NAN outside [-1, 1] like acosf
+	static float acos(float x)
+	{
+		if(std::abs(x) > 1) return NAN;
+		return P::acos<ScalarOps>(x);
+	}
+
+	// bit trick reciprocal sqrt with two newton steps
+	static float sqrt(float x)
+	{
+		if(x <= 0) return x == 0 ? 0 : NAN;
+		int32_t i;
+		float y;
+		memcpy(&i, &x, 4);
+		i = 0x5f3759df - (i >> 1);
+		memcpy(&y, &i, 4);
+		float hx = 0.5F * x;
+		y = y * (1.5F - hx * y * y);
+		y = y * (1.5F - hx * y * y);
+		return x * y;
+	}
+};
+
+using FMath = FastMath<MATH_TIER>;
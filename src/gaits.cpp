@@ -1,6 +1,8 @@
 #include "Servo.h"
 #include "Leg.h"
+#include "Body.h"
 #include "Timed.h"
+#include "Trajectory.h"
 #include "helpers.h"
 
 #include <unistd.h>
@@ -16,33 +18,33 @@
 #define RADIANS(a) ((a) * M_PI / 180.0F)
 #define DEGREES(r) ((r) * 180.0F / M_PI)
 
-using Pos3 = std::tuple<int, float, float, float>;
-using Pos2 = std::tuple<int, float, float>;
-
 // defined in main.cpp
 extern float MAX_RAISE;
 extern std::vector<Leg> legs;
-extern void interpolatedMoves(std::vector<Pos3> pos, float time, bool relative = true);
+extern MoveResult interpolatedMoves(const MoveSet& pos, float time, bool relative = true);
+extern void checkMove(const MoveResult& r);
 extern float update_frequency;
-extern Timed timed;
-
-void raiseLeg(int leg, bool lift = true, int raise = 16, float speed = 60)
-{
-	legs[leg].setOnGround(!lift);
-	float time = raise / speed;
-	interpolatedMoves({Pos3(leg, 0, 0, lift ? raise : -raise)}, time, true);
-}
+extern Trajectory trajectory;
 
-void raiseLegs(std::vector<int> legn, bool lift = true, int raise = 16, float speed = 60)
+// the legs leave or touch the ground as the move starts, which may be after this returns when they are queued
+// a move that failed ends the gait step, with -n that may be one queued before this
+void raiseLegs(std::initializer_list<int> legn, bool lift = true, int raise = 16, float speed = 60)
 {
-	std::vector<Pos3> v;
+	Segment seg;
 	for(int leg : legn) {
-		legs[leg].setOnGround(!lift);
-		v.push_back(Pos3(leg, 0, 0, lift ? raise : -raise));
+		if(lift) seg.lift |= 1 << leg;
+		else seg.lower |= 1 << leg;
+		seg.moves.push_back(Pos3(leg, 0, 0, lift ? raise : -raise));
 	}
 
 	float time = raise / speed;
-	interpolatedMoves(v, time, true);
+	seg.ticks = roundf(time * update_frequency);
+	checkMove(trajectory.run(seg));
+}
+
+void raiseLeg(int leg, bool lift = true, int raise = 16, float speed = 60)
+{
+	raiseLegs({leg}, lift, raise, speed);
 }
 
 // initialize legs to the specified positions
@@ -59,6 +61,8 @@ void initLegs(std::vector<Pos2> pos, bool relative = true)
 		//printf("move leg: %d, x: %f, y: %f relative %d\n", leg, x, y, relative);
 		//printf("Raise leg %d\n", leg);
 		raiseLeg(leg, true, raise, raise_speed);
+		// it is placed directly, once it is up
+		checkMove(trajectory.drain());
 		if(relative)
 			legs[leg].moveBy(x, y, 0);
 		else
@@ -88,6 +92,7 @@ void rotateWaveGait(int reps, float angle, float speed, bool init)
 			raiseLeg(l, true, raise, raise_speed);
 			float x, y;
 			std::tie(x, y, std::ignore) = legs[l].getHomeCoordinates();
+			checkMove(trajectory.drain());
 			legs[l].move(x, y);
 			float a = half_angle - (rotate_inc * l);
 			legs[l].rotateBy(RADIANS(-a));
@@ -102,7 +107,7 @@ void rotateWaveGait(int reps, float angle, float speed, bool init)
 	float x, y, tx, ty;
 	std::tie(x, y, std::ignore) = legs[0].getHomeCoordinates();
 	std::tie(tx, ty, std::ignore) = legs[0].calcRotation(rad, true); // all legs seem to move the same
-	float dist = sqrtf(powf(x - tx, 2) + powf(y - ty, 2)); // the distance angle° moves the leg
+	float dist = FMath::sqrt((x - tx) * (x - tx) + (y - ty) * (y - ty)); // the distance angle° moves the leg
 
 	int iterations = roundf((dist * update_frequency) / speed); // number of iterations
 	float da = rotate_inc / iterations; // delta angle to move each step
@@ -113,15 +118,15 @@ void rotateWaveGait(int reps, float angle, float speed, bool init)
 	for (int i = 0; i < reps; ++i) {
 		for (int s = 0; s < 6; ++s) { // foreach step
 			raiseLeg(s, true, raise, raise_speed);
-			// execute the lambda iterations times at the specified frequency for timed
-			timed.run(iterations, [s, da, ra]() {
-				for (int l = 0; l < 6; ++l) {
-					if(l != s)
-						legs[l].rotateBy(RADIANS(-da));
-					else
-						legs[l].rotateBy(RADIANS(ra));
-				}
-			});
+			// rotate the others back and the raised one forward, spread over iterations ticks
+			Segment seg;
+			seg.kind = Segment::ROTATE;
+			seg.ticks = iterations;
+			for (int l = 0; l < 6; ++l) {
+				seg.rotate[l] = l != s ? -da : ra;
+				seg.rotating |= 1 << l;
+			}
+			checkMove(trajectory.run(seg));
 
 			raiseLeg(s, false, raise, raise_speed);
 		}
@@ -144,6 +149,7 @@ void rotateTripodGait(int reps, float angle, float speed, bool init)
 	if(init) {
 		for (int i = 0; i < 2; ++i) {
 			raiseLegs({legorder[i][0], legorder[i][1], legorder[i][2]}, true, raise, raise_speed);
+			checkMove(trajectory.drain());
 			for (int j = 0; j < 3; ++j) {
 				uint8_t l = legorder[i][j];
 				float r = (i == 0) ? RADIANS(-half_angle) : RADIANS(half_angle);
@@ -163,7 +169,7 @@ void rotateTripodGait(int reps, float angle, float speed, bool init)
 	float x, y;
 	std::tie(x, y, std::ignore) = legs[0].getHomeCoordinates();
 	std::tie(tx, ty, std::ignore) = legs[0].calcRotation(rad, true); // all legs seem to move the same
-	float dist = sqrtf(powf(x - tx, 2) + powf(y - ty, 2)); // the distance angle° moves the leg
+	float dist = FMath::sqrt((x - tx) * (x - tx) + (y - ty) * (y - ty)); // the distance angle° moves the leg
 
 	int iterations = roundf((dist * update_frequency) / speed); // number of iterations
 	float da = angle / iterations; // delta angle to move each iteration
@@ -182,13 +188,16 @@ void rotateTripodGait(int reps, float angle, float speed, bool init)
 		for (int s = 0; s < 2; ++s) {
 			raiseLegs({legorder[s][0], legorder[s][1], legorder[s][2]}, true, raise, raise_speed);
 			int s1 = (s == 0) ? 1 : 0;
-			// execute the lambda iterations times at the specified frequency for timed
-			timed.run(iterations, [legorder, s, s1, da, dca]() {
-				for (int j = 0; j < 3; ++j) {
-					legs[legorder[s][j]].rotateBy(RADIANS(da - dca));
-					legs[legorder[s1][j]].rotateBy(RADIANS(-da + dca));
-				}
-			});
+			// rotate the raised legs forward and the others back, spread over iterations ticks
+			Segment seg;
+			seg.kind = Segment::ROTATE;
+			seg.ticks = iterations;
+			for (int j = 0; j < 3; ++j) {
+				seg.rotate[legorder[s][j]] = da - dca;
+				seg.rotate[legorder[s1][j]] = -da + dca;
+				seg.rotating |= (1 << legorder[s][j]) | (1 << legorder[s1][j]);
+			}
+			checkMove(trajectory.run(seg));
 			raiseLegs({legorder[s][0], legorder[s][1], legorder[s][2]}, false, raise, raise_speed);
 			dca = 0; // only will adjust on first phase
 		}
@@ -212,6 +221,7 @@ void tripodGait(int reps, float stridex, float stridey, float speed, bool init)
 		// should not matter where legs actually are
 		for (int i = 0; i < 2; ++i) {
 			raiseLegs({legorder[i][0], legorder[i][1], legorder[i][2]}, true, raise, raise_speed);
+			checkMove(trajectory.drain());
 			for (int j = 0; j < 3; ++j) {
 				uint8_t l = legorder[i][j];
 				float x, y;
@@ -228,7 +238,7 @@ void tripodGait(int reps, float stridex, float stridey, float speed, bool init)
 	}
 
 	// calculate time this move should take, based on the amount the body will move over the ground
-	float dist = sqrtf(powf(stridex, 2) + powf(stridey, 2)); // distance over the ground
+	float dist = FMath::sqrt(stridex * stridex + stridey * stridey); // distance over the ground
 	float time = dist / speed; // the time it will take to move that distance at the given speed (mm/sec)
 
 	float dx = 0, dy = 0;
@@ -247,7 +257,7 @@ void tripodGait(int reps, float stridex, float stridey, float speed, bool init)
 		// this is two strides we need to move each stride in the calculated time
 		// execute step state 1
 		raiseLegs({legorder[0][0], legorder[0][1], legorder[0][2]}, true, raise, raise_speed);
-		interpolatedMoves({
+		checkMove(interpolatedMoves({
 			Pos3(legorder[0][0],  stridex - dx,  stridey - dy, 0),
 			Pos3(legorder[0][1],  stridex - dx,  stridey - dy, 0),
 			Pos3(legorder[0][2],  stridex - dx,  stridey - dy, 0),
@@ -255,12 +265,12 @@ void tripodGait(int reps, float stridex, float stridey, float speed, bool init)
 			Pos3(legorder[1][1], -stridex + dx, -stridey + dy, 0),
 			Pos3(legorder[1][2], -stridex + dx, -stridey + dy, 0)
 		},
-		time, true);
+		time, true));
 		raiseLegs({legorder[0][0], legorder[0][1], legorder[0][2]}, false, raise, raise_speed);
 
 		// execute step state 2
 		raiseLegs({legorder[1][0], legorder[1][1], legorder[1][2]}, true, raise, raise_speed);
-		interpolatedMoves({
+		checkMove(interpolatedMoves({
 			Pos3(legorder[1][0],  stridex,  stridey, 0),
 			Pos3(legorder[1][1],  stridex,  stridey, 0),
 			Pos3(legorder[1][2],  stridex,  stridey, 0),
@@ -268,7 +278,7 @@ void tripodGait(int reps, float stridex, float stridey, float speed, bool init)
 			Pos3(legorder[0][1], -stridex, -stridey, 0),
 			Pos3(legorder[0][2], -stridex, -stridey, 0)
 		},
-		time, true);
+		time, true));
 		raiseLegs({legorder[1][0], legorder[1][1], legorder[1][2]}, false, raise, raise_speed);
 	}
 }
@@ -303,7 +313,7 @@ void waveGait(int reps, float stridex, float stridey, float speed, bool init)
 	}
 
 	// calculate time this move should take, based on the amount the body will move over the ground
-	float dist = sqrtf(powf(stridex, 2) + powf(stridey, 2)); // distance over the ground
+	float dist = FMath::sqrt(stridex * stridex + stridey * stridey); // distance over the ground
 	float time = dist / speed; // the time it will take to move that distance at the given speed (mm/sec)
 
 	// need to check if stride has changed since last full step at the start of the step phase
@@ -322,7 +332,7 @@ void waveGait(int reps, float stridex, float stridey, float speed, bool init)
 
 		for (int s = 0; s < 6; ++s) { // foreach step
 			uint8_t leg = legorder[s];
-			std::vector<Pos3> v;
+			MoveSet v;
 
 			// reset the current leg
 			v.push_back(Pos3(leg, stridex - dx, stridey - dy, 0));
@@ -339,7 +349,7 @@ void waveGait(int reps, float stridex, float stridey, float speed, bool init)
 
 			// execute actual step
 			raiseLeg(leg, true, raise, raise_speed);
-			interpolatedMoves(v, time / 6, true); // each step should take 1/6 of the time calculated for the total move
+			checkMove(interpolatedMoves(v, time / 6, true)); // each step should take 1/6 of the time calculated for the total move
 			raiseLeg(leg, false, raise, raise_speed);
 			// only adjust first phase of step
 			dx = dy = dxi = dyi = 0;
@@ -0,0 +1,151 @@
+#include "kinematics.h"
+#include "simd.h"
+
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+template<class RobotT>
+uint32_t batchInverseKinematics(const LegTargets& t, LegAngles& a, int n)
+{
+	const vfloat zero = vset1(0);
+	const vfloat one = vset1(1);
+	const vfloat nan = vset1(NAN);
+	const vfloat coxa = vset1(RobotT::COXA);
+	const vfloat femur = vset1(RobotT::FEMUR);
+	const vfloat tibia = vset1(RobotT::TIBIA);
+	const vfloat max_reach = vset1(RobotT::FEMUR + RobotT::TIBIA);
+	const vfloat min_reach = vset1(std::abs(RobotT::TIBIA - RobotT::FEMUR));
+
+	uint32_t ok = 0;
+	for (int i = 0; i < n; i += SIMD_WIDTH) {
+		vfloat x = vload(&t.x[i]);
+		vfloat y = vload(&t.y[i]);
+		vfloat z = vload(&t.z[i]);
+
+		vfloat f = vsqrt(x * x + y * y) - coxa;
+		vfloat d2 = f * f + z * z;
+		vfloat d = vsqrt(d2);
+
+		// same conditions as the range check and solveTriangle in Leg
+		vmask valid = vand(vle(d, max_reach), vge(d, min_reach));
+
+		// law of cosines for the angle between femur and d, and between femur and tibia
+		vfloat ck = (femur * femur + d2 - tibia * tibia) / (vset1(2) * femur * vmax(d, vset1(1e-6F)));
+		vfloat ca = (femur * femur + tibia * tibia - d2) / (vset1(2) * femur * tibia);
+		ck = vmax(vmin(ck, one), zero - one);
+		ca = vmax(vmin(ca, one), zero - one);
+
+		vfloat hip = vatan2(y, x);
+		vfloat knee = vacos(ck) - vatan2(zero - z, f);
+		vfloat ankle = vacos(ca) - vset1(M_PI_2);
+
+		vstore(&a.hip[i], vselect(valid, hip, nan));
+		vstore(&a.knee[i], vselect(valid, knee, nan));
+		vstore(&a.ankle[i], vselect(valid, ankle, nan));
+		ok |= vmovemask(valid) << i;
+	}
+
+	return ok & ((1U << n) - 1);
+}
+
+template<class RobotT>
+void batchForwardKinematics(const LegAngles& a, LegTargets& t, int n)
+{
+	const vfloat coxa = vset1(RobotT::COXA);
+	const vfloat femur = vset1(RobotT::FEMUR);
+	const vfloat tibia = vset1(RobotT::TIBIA);
+
+	for (int i = 0; i < n; i += SIMD_WIDTH) {
+		vfloat h = vload(&a.hip[i]);
+		vfloat k = vload(&a.knee[i]);
+		vfloat ka = k + vload(&a.ankle[i]);
+
+		// same chain as Leg::forwardKinematics
+		vfloat r = femur * vcos(k) + tibia * vsin(ka) + coxa;
+		vstore(&t.x[i], r * vcos(h));
+		vstore(&t.y[i], r * vsin(h));
+		vstore(&t.z[i], femur * vsin(k) - tibia * vcos(ka));
+	}
+}
+
+template<class RobotT>
+void jointLimits(int leg, int joint, float& lo, float& hi)
+{
+	// the inverse of Servo::move
+	uint8_t ch = RobotT::legs[leg].joint[joint];
+	float a = (RobotT::SERVO_MIN - 90 - RobotT::trim[ch]) * (float)M_PI / 180.0F;
+	float b = (RobotT::SERVO_MAX - 90 - RobotT::trim[ch]) * (float)M_PI / 180.0F;
+	lo = RobotT::reverse[ch] > 0 ? a : -b;
+	hi = RobotT::reverse[ch] > 0 ? b : -a;
+}
+
+// points i0 to i1 of evaluateInverseKinematics, KIN_LANES at a time
+template<class RobotT>
+static size_t evaluateRange(int leg, const float *x, const float *y, const float *z, size_t i0, size_t i1,
+	float *hip, float *knee, float *ankle, uint8_t *reachable)
+{
+	const float (*m)[2] = RobotT::legs[leg].mat;
+	float lo[3], hi[3];
+	for (int j = 0; j < 3; ++j) jointLimits<RobotT>(leg, j, lo[j], hi[j]);
+
+	size_t count = 0;
+	LegTargets t = {};
+	LegAngles a;
+	for (size_t i = i0; i < i1; i += KIN_LANES) {
+		int n = std::min<size_t>(KIN_LANES, i1 - i);
+		for (int l = 0; l < n; ++l) {
+			// into leg coordinates, same as Leg::toLegFrame
+			t.x[l] = x[i + l] * m[0][0] + y[i + l] * m[1][0];
+			t.y[l] = x[i + l] * m[0][1] + y[i + l] * m[1][1];
+			t.z[l] = z[i + l];
+		}
+		batchInverseKinematics<RobotT>(t, a, n);
+
+		for (int l = 0; l < n; ++l) {
+			// NAN fails the compares so out of reach is never in range
+			bool ok = a.ankle[l] >= lo[0] && a.ankle[l] <= hi[0] && a.knee[l] >= lo[1] && a.knee[l] <= hi[1] &&
+				a.hip[l] >= lo[2] && a.hip[l] <= hi[2];
+			if(hip != nullptr) hip[i + l] = a.hip[l];
+			if(knee != nullptr) knee[i + l] = a.knee[l];
+			if(ankle != nullptr) ankle[i + l] = a.ankle[l];
+			if(reachable != nullptr) reachable[i + l] = ok;
+			count += ok;
+		}
+	}
+	return count;
+}
+
+template<class RobotT>
+size_t evaluateInverseKinematics(int leg, const float *x, const float *y, const float *z, size_t n,
+	float *hip, float *knee, float *ankle, uint8_t *reachable, int nthreads)
+{
+	if(leg < 0 || leg >= RobotT::NLEGS) return 0;
+
+	if(nthreads <= 0) nthreads = std::max(1U, std::thread::hardware_concurrency());
+	if(n < KIN_PARALLEL_MIN || nthreads == 1) return evaluateRange<RobotT>(leg, x, y, z, 0, n, hip, knee, ankle, reachable);
+
+	// whole KIN_LANES blocks per thread, each thread writes its own part of the outputs
+	size_t blocks = (n + KIN_LANES - 1) / KIN_LANES;
+	nthreads = std::min<size_t>(nthreads, blocks);
+	std::vector<size_t> counts(nthreads, 0);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < nthreads; ++i) {
+		size_t i0 = std::min(n, blocks * i / nthreads * KIN_LANES);
+		size_t i1 = std::min(n, blocks * (i + 1) / nthreads * KIN_LANES);
+		threads.emplace_back([=, &counts]() { counts[i] = evaluateRange<RobotT>(leg, x, y, z, i0, i1, hip, knee, ankle, reachable); });
+	}
+	size_t count = 0;
+	for (int i = 0; i < nthreads; ++i) {
+		threads[i].join();
+		count += counts[i];
+	}
+	return count;
+}
+
+template uint32_t batchInverseKinematics<Robot>(const LegTargets& t, LegAngles& a, int n);
+template void batchForwardKinematics<Robot>(const LegAngles& a, LegTargets& t, int n);
+template void jointLimits<Robot>(int leg, int joint, float& lo, float& hi);
+template size_t evaluateInverseKinematics<Robot>(int leg, const float *x, const float *y, const float *z, size_t n,
+	float *hip, float *knee, float *ankle, uint8_t *reachable, int nthreads);
@@ -0,0 +1,53 @@
+/**
+	Batch kinematics for all the legs at once.
+	The legs are held in structure of arrays form so one SIMD pass solves every leg,
+	the arrays are padded to KIN_LANES so a full register can always be loaded (unaligned loads are used so
+	these can live in std::vector, which does not honour over alignment in C++11).
+*/
+
+#pragma once
+
+#include "Robot.h"
+
+#include <cstdint>
+#include <cstddef>
+
+#define KIN_LANES 8
+// evaluateInverseKinematics batches at least this big are split over threads
+#define KIN_PARALLEL_MIN 4096
+
+// foot targets in leg coordinates (ie already transformed by the legs position on the body)
+struct LegTargets {
+	float x[KIN_LANES];
+	float y[KIN_LANES];
+	float z[KIN_LANES];
+};
+
+// joint angles in radians, same convention as Leg::inverseKinematics
+struct LegAngles {
+	float hip[KIN_LANES];
+	float knee[KIN_LANES];
+	float ankle[KIN_LANES];
+};
+
+// solve the IK for the first n legs, returns a bit mask of the legs that are reachable
+// unreachable legs get NAN angles just like Leg::inverseKinematics
+template<class RobotT = Robot>
+uint32_t batchInverseKinematics(const LegTargets& t, LegAngles& a, int n);
+
+// the inverse of batchInverseKinematics, joint angles for the first n legs back to leg coordinates
+template<class RobotT = Robot>
+void batchForwardKinematics(const LegAngles& a, LegTargets& t, int n);
+
+// the joint range in radians that keeps the servo inside SERVO_MIN..SERVO_MAX after trim, joint is 0 ankle, 1 knee, 2 hip
+template<class RobotT = Robot>
+void jointLimits(int leg, int joint, float& lo, float& hi);
+
+// pure IK for n candidate foot positions of one leg, for planners and foothold search. nothing is moved and no leg
+// state is touched. x, y, z are relative to the hip in robot orientation like Leg::move, the angles are written to
+// hip, knee and ankle (NAN if out of reach) and reachable[i] to 1 if every joint is also inside its servo range,
+// any of the outputs can be null. large batches are split over nthreads (0 uses every core).
+// returns how many of the points are reachable
+template<class RobotT = Robot>
+size_t evaluateInverseKinematics(int leg, const float *x, const float *y, const float *z, size_t n,
+	float *hip, float *knee, float *ankle, uint8_t *reachable, int nthreads = 0);
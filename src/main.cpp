@@ -1,10 +1,19 @@
 #include "Servo.h"
 #include "Leg.h"
+#include "Body.h"
+#include "IKTable.h"
+#include "ReachMap.h"
 #include "Timed.h"
+#include "PhaseLock.h"
+#include "I2C.h"
+#include "RealTime.h"
+#include "Trajectory.h"
+#include "SpscRing.h"
 #include "helpers.h"
 
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <cmath>
 #include <functional>
 #include <vector>
@@ -51,15 +60,37 @@ extern void raiseLeg(int leg, bool lift = true, int raise = 16, float speed = 60
 
 */
 
-using Pos3 = std::tuple<int, float, float, float>;
-using Pos2 = std::tuple<int, float, float>;
-
-float update_frequency = 61.5; // 60Hz update frequency we need to be a little faster to make up for overhead
+float update_frequency = 60; // 60Hz update frequency
 Timed timed(update_frequency); // timer that repeats a given function at the given frequency (also provides micros())
 float MAX_RAISE = 30; // 35 is safe too
 
 // array of legs
 std::vector<Leg> legs;
+// batch operations on all the legs
+Body body(legs);
+// the timed moves, run as they are made or queued ahead to their own thread
+Trajectory trajectory(body, legs, timed);
+// optional IK lookup table for the single leg moves, selected with -i or the K MQTT command
+static IKTable ik_table;
+static float ik_table_spacing = 2; // mm
+static float ik_table_error = 0.1; // degrees
+// what to do when a move goes out of reach, set to clamp with -C
+static MoveMode move_mode = MoveMode::STRICT;
+// optional lock of the ticks to the PWM cycle of the first board, with -k
+static PhaseLock phase_lock;
+static bool phase_locked = false;
+static int sync_pin = -1; // GPIO wired to a servo signal of the first board
+
+static const char *i2c_record_file = nullptr; // where the simulated I2C transactions go at exit
+static const char *servo_record_file = nullptr; // where the record backend's writes go at exit
+static const char *tick_histogram_file = nullptr; // where the Timed tick histograms go at exit
+static int rt_priority = 0; // SCHED_FIFO priority of the control thread with -q, 0 is off
+static int rt_cpu = -1;
+static int plan_ahead = 0; // segments the gaits queue ahead of the executor with -n, 0 runs them as they are made
+
+// optional reachability map, stride, rotation and height are scaled to its limits when loaded with -g
+static ReachMap reach_map;
+static float reach_map_spacing = 2; // mm
 
 // used locally only
 
@@ -78,50 +109,198 @@ static std::atomic<float> current_y {0};
 static std::atomic<float> current_stride {optimal_stride};
 static std::atomic<float> current_angle {optimal_angle};
 static std::atomic<float> current_rotate {0};
-static std::atomic<float> body_height {TIBIA}; // Body height.
+static std::atomic<float> body_height {Robot::TIBIA}; // Body height.
+// requested body pose roll, pitch, yaw in degrees then x, y, z in mm, set with the B MQTT command
+static std::atomic<float> body_pose[6];
 
 static volatile bool doSafeHome= false;
 static volatile bool doIdlePosition= false;
 static volatile bool doStandUp= false;
+// joint angles set with the A MQTT command, queued from the MQTT thread for the control thread to make in order
+struct ServoRequest {
+	int channel;
+	float angle;
+};
+static SpscRing<ServoRequest, 16> servo_requests;
+
+// how long the frame flushes took on each bus and over all of them
+static void printBusTiming()
+{
+	if(!servo.frameWrites()) return;
+	for (int i = 0; i < servo.numBuses(); ++i) {
+		const ServoBus& b = servo.getBus(i);
+		const ServoBus::Timing& t = b.getTiming();
+		printf("I2C bus %d: %u boards, %u flushes, %1.0f us mean, %1.0f us max%s\n",
+			b.getBus(), (unsigned)b.getBoards().size(), t.flushes, t.mean(), t.max_us, b.hasWorker() ? ", own thread" : "");
+	}
+	const ServoBus::Timing& t = servo.flushTiming();
+	printf("I2C flush: %u frames, %1.0f us mean, %1.0f us max for all the buses\n", t.flushes, t.mean(), t.max_us);
+}
+
+// a move the legs could not make ends whatever was moving them, the way a leg that can't reach throws
+void checkMove(const MoveResult& r)
+{
+	if(!r.ok()) throw std::range_error("move");
+}
 
 // Interpolate a list of moves within the given time in seconds and issue to servos at the update rate
-void interpolatedMoves(std::vector<Pos3> pos, float time, bool relative = true)
+// with -n the result is that of an earlier queued move, if one failed, as this one has not run yet
+MoveResult interpolatedMoves(const MoveSet& pos, float time, bool relative = true)
+{
+	Segment seg;
+	seg.moves = pos;
+	seg.relative = relative;
+	seg.ticks = roundf(time * update_frequency);
+	MoveResult r = trajectory.run(seg);
+	if(debug_verbose && !trajectory.running()) {
+		BusStats st = servo.busStats();
+		printf("bus: %u frames, %u transactions, %u bytes, last frame %u transactions %u bytes, %u writes issued, %u suppressed\n",
+			st.frames, st.transactions, st.bytes, st.last_transactions, st.last_bytes, st.issued, st.suppressed);
+		printBusTiming();
+	}
+	return r;
+}
+
+// the gaits plan ahead through the trajectory queue with -n, anything else moves the legs directly so it waits for
+// the queue to run out and the executor to stop first
+static void planAhead(bool on)
+{
+	if(on && plan_ahead > 0) trajectory.start(plan_ahead);
+	else trajectory.stop();
+}
+
+static void printTrajectory()
+{
+	const Trajectory::Stats& st = trajectory.getStats();
+	if(st.segments == 0) return;
+	printf("Trajectory: %u segments in %u ticks, queued up to %u ahead (of %d), the executor started %u times from empty, the planner waited %u times for room\n",
+		st.segments, st.ticks, st.max_depth, plan_ahead, st.starts, st.waits);
+}
+
+// lock the servo writes to the PWM cycle of the first board, hz is its measured frequency or 0 for what it is set to
+static bool startPhaseLock(float hz)
 {
-	std::vector<Pos3> moves;
-
-	if(!relative) {
-		// get the delta moves for each leg, we need deltas so we can interpolate them over time
-		for(auto &l : pos) {
-			int leg;
-			float x, y, z;
-			float cx, cy, cz;
-			std::tie(leg, x, y, z) = l;
-			std::tie(cx, cy, cz) = legs[leg].getPosition();
-			moves.push_back(Pos3(leg, x-cx, y-cy, z-cz));
+	phase_lock.reset(hz > 0 ? hz : servo.pwmFrequency(), servo.pwmEpoch());
+	if(servo.pwmEpoch() == 0 && sync_pin < 0 && servo.getBackend() != ServoBackend::DUMMY) {
+		printf("WARNING: the boards were left running so the PWM phase is unknown, use -p or -r\n");
+	}
+	if(sync_pin >= 0) {
+		if(!phase_lock.attachSync(sync_pin)) {
+			fprintf(stderr, "Unable to use GPIO %d for the PWM sync\n", sync_pin);
+			return false;
 		}
+		// a few cycles to lock on before anything is written
+		for (int i = 0; i < 50 && !phase_lock.synced(); ++i) usleep(10000);
+		if(!phase_lock.synced()) printf("WARNING: no PWM sync on GPIO %d, running from the board period\n", sync_pin);
+	}
 
-	} else {
-		moves = pos;
+	// one tick per PWM cycle, the gaits work out their steps from this
+	update_frequency = phase_lock.frequency();
+	timed.setFrequency(update_frequency);
+	if(servo.outputRunning()) {
+		// the output thread does the writes so it is the one that gets locked, it can only be given the lock
+		// while it is stopped
+		servo.stopOutput();
+		servo.setPhaseLock(&phase_lock);
+		servo.startOutput();
+	}else{
+		servo.setPhaseLock(&phase_lock);
+		timed.setPhaseLock(&phase_lock);
 	}
+	phase_locked = true;
+	printf("Phase locked to %1.3f Hz PWM%s\n", phase_lock.frequency(), phase_lock.synced() ? " with sync" : "");
+	return true;
+}
 
-	// calculate iterations and the amount to slice each move
-	uint32_t iterations = roundf(time * update_frequency);
-	if(iterations == 0) return;
-
-	float slice = 1.0F / iterations; // the fraction amount each move makes
-	//printf("time: %f secs, iterations= %lu\n", time, iterations);
-	//uint32_t s = timed.micros();
-	// execute the lambda iterations times at the specified frequency for timed
-	timed.run(iterations, [moves, slice]() {
-		for(auto &p : moves) {
-			float x, y, z;
-			int leg;
-			std::tie(leg, x, y, z) = p;
-			legs[leg].moveBy(x * slice, y * slice, z * slice);
-		}
-	});
-	//uint32_t e = timed.micros();
-	//printf("update rate %lu us for %d iterations= %fHz\n", e - s, iterations, iterations * 1000000.0F / (e - s));
+// the bus time the ticks took on each simulated bus, and the fastest rate it could keep up with
+static void printI2CSim()
+{
+	for(auto b : SimI2C::all()) {
+		SimI2C::Stats st = b->getStats();
+		if(st.ticks == 0) continue;
+		printf("I2C sim bus %d at %u kHz: %u transactions, %llu bytes, %u ticks, bus time per tick %1.0f/%1.0f us mean/max, occupancy %1.1f/%1.1f%% mean/max, keeps up to %1.0f Hz (%1.0f Hz on the worst tick)\n",
+			b->getBus(), b->getHz() / 1000, st.transactions, (unsigned long long)st.bytes, st.ticks, st.busy_mean_us, st.busy_max_us,
+			st.occupancy_mean * 100, st.occupancy_max * 100, 1e6F / st.busy_mean_us, 1e6F / st.busy_max_us);
+	}
+}
+
+// how long setting up the servo boards took
+static void printStartup(const char *what)
+{
+	const Servo::StartupTiming& t = servo.startupTiming();
+	printf("Servo %s: %s, %d boards (%d reprogrammed), open %1.1f ms, program %1.1f ms, oscillator %1.1f ms, enable pin %1.1f ms, %1.1f ms in all\n",
+		what, backendName(servo.getBackend()), t.boards, t.reprogrammed, t.open_ms, t.program_ms, t.settle_ms, t.enable_ms,
+		t.open_ms + t.program_ms + t.settle_ms + t.enable_ms);
+}
+
+// the rate the timed loops kept and how late their ticks woke up
+static void printTimed()
+{
+	Timed::Stats st = timed.getStats();
+	if(st.ticks == 0) return;
+	printf("Timed: %u ticks at %1.2f Hz (last set to %1.2f Hz), %u overran, %u steps dropped, wakeup %1.0f/%1.0f/%1.0f us min/mean/max, %1.0f us sd, %u allocations\n",
+		st.ticks, st.rate, update_frequency, st.overruns, st.dropped, st.min_us, st.mean_us, st.max_us, st.sd_us, st.allocations);
+	timed.printHistograms(stdout);
+	if(tick_histogram_file != nullptr) timed.saveHistograms(tick_histogram_file);
+}
+
+// ticks of a move out and back through the same Body::commit the control loop makes, on a servo with the record
+// backend so nothing moves, returns the allocations they made
+static uint64_t checkHotPath(int nticks)
+{
+	Servo dry;
+	dry.open(ServoBackend::RECORD);
+	dry.setFrameWrites(servo.frameWrites());
+	std::vector<Leg> dry_legs;
+	dry_legs.reserve(Robot::NLEGS);
+	for (int i = 0; i < Robot::NLEGS; ++i) dry_legs.emplace_back(i, dry);
+	Body dry_body(dry_legs);
+	dry_body.setIncremental(body.isIncremental());
+	for(auto& l : dry_legs) l.home();
+
+	MoveSet out, back;
+	for (int l = 0; l < Robot::NLEGS; ++l) {
+		out.push_back(Pos3(l, 0, 20, 10));
+		back.push_back(Pos3(l, 0, -20, -10));
+	}
+	float slice = 2.0F / nticks;
+	uint64_t a = RealTime::allocations();
+	for (int i = 0; i < nticks; ++i) dry_body.commit(i < nticks / 2 ? out : back, slice, move_mode);
+	return RealTime::allocations() - a;
+}
+
+// the control thread to SCHED_FIFO with locked memory, before the bus and output threads are started
+static bool startRealTime()
+{
+	if(!RealTime::enter(rt_priority, rt_cpu)) return false;
+	return RealTime::lockMemory(256 * 1024, 8 * 1024 * 1024);
+}
+
+// with -q, check the tick path doesn't allocate and how late a 1ms sleep wakes up. once, just before the first
+// control loop so the options that change the tick path (-F, -N, -C) are the ones it runs with
+static void checkRealTime()
+{
+	static bool checked = false;
+	if(rt_priority == 0 || checked) return;
+	checked = true;
+
+	const int nticks = 240;
+	uint64_t allocs = checkHotPath(nticks);
+	Timed probe(1000);
+	probe.run(500, [](uint32_t) {});
+	Timed::Stats st = probe.getStats();
+	printf("Real time: SCHED_FIFO priority %d", rt_priority);
+	if(rt_cpu >= 0) printf(" on cpu %d", rt_cpu);
+	printf(", memory locked, %llu allocations in %d ticks of the hot path, wakeup latency %1.0f/%1.0f us mean/max over %u 1ms sleeps\n",
+		(unsigned long long)allocs, nticks, st.mean_us, st.max_us, st.ticks);
+	if(allocs > 0) printf("WARNING: the hot path allocates, it can stall on the heap lock or a page fault\n");
+}
+
+static void printPhaseLock()
+{
+	PhaseLock::Stats st = phase_lock.getStats();
+	printf("Phase lock: %1.3f Hz, %u ticks, %u late, %u cycles skipped, phase error %1.0f/%1.0f/%1.0f us min/mean/max, lead %1.0f us, %u sync edges, %u resyncs\n",
+		phase_lock.frequency(), st.ticks, st.late, st.skipped, st.min_us, st.mean_us, st.max_us, phase_lock.getLead() / 1000.0F, st.edges, st.resyncs);
 }
 
 void home(int8_t l = -1)
@@ -145,11 +324,21 @@ void safeHome()
 		int l= legorder[i];
 		float x, y, z;
 		std::tie(x, y, z) = legs[l].getHomeCoordinates();
-		interpolatedMoves({Pos3(l, x, y, z + MAX_RAISE)}, time, false);
-		interpolatedMoves({Pos3(l, x, y, z)}, time, false);
+		checkMove(interpolatedMoves({Pos3(l, x, y, z + MAX_RAISE)}, time, false));
+		checkMove(interpolatedMoves({Pos3(l, x, y, z)}, time, false));
 	}
 }
 
+// true if we know where every leg is, so moves can start from there instead of forcing a known position first
+static bool positionsKnown()
+{
+	if(!servo.isEnabled()) return false;
+	for(auto& l : legs) {
+		if(!l.positionKnown()) return false;
+	}
+	return true;
+}
+
 // set the legs to a known initial position after powerup or after servos are disabled
 void initialPosition()
 {
@@ -167,7 +356,7 @@ void initialPosition()
 // NOTE presumes we know where the legs are, cannot use after powerup
 void idlePosition()
 {
-	if(!servo.isEnabled()) {
+	if(!positionsKnown()) {
 		// after powerup or disabled servos we don't know where the legs are so set them to a known position
 		initialPosition();
 		// allow time for that to happen
@@ -175,7 +364,7 @@ void idlePosition()
 	}
 
 	// now move slowly into a lower position
-	std::vector<Pos3> v;
+	MoveSet v;
 	for (int l = 0; l < 6; ++l) { // for each leg
 		float x, y, z;
 		std::tie(x, y, z) = legs[l].getCoordinates(112.7, 0.0, 30.5); // gets idle coordinates with knee up 45°
@@ -197,13 +386,15 @@ void standUp()
 	float x, y, z;
 	// for each leg move knee joint up and angle at 90°
 	// TODO enable each servo as we go.
-	initialPosition();
+	if(!positionsKnown()) {
+		initialPosition();
 
-	// allow time for that to happen
-	usleep(500000);
+		// allow time for that to happen
+		usleep(500000);
+	}
 
 	// now move slowly into a low position hopefully standing up
-	std::vector<Pos3> v;
+	MoveSet v;
 	for (int l = 0; l < 6; ++l) { // for each leg
 		std::tie(x, y, z) = legs[l].getCoordinates(58, 0, -41); // gets idle coordinates with knee up 45°
 		v.push_back(Pos3(l, x, y, z));
@@ -226,11 +417,45 @@ void standUp()
 // raises or lowers the body height by a delta
 void changeBodyHeight(float dz)
 {
-	std::vector<Pos3> v;
+	MoveSet v;
 	for (int i = 0; i < 6; ++i) {
 		v.push_back(Pos3(i, 0, 0, -dz)); // negative delta as z is actually foot position so heigher body is lower leg
 	}
-	interpolatedMoves(v, 0.1); // relative move
+	checkMove(interpolatedMoves(v, 0.1)); // relative move
+}
+
+// moves the body to a new pose over the feet, the pose is interpolated and every leg re-solved each tick
+void changeBodyPose(const BodyPose& target, float time)
+{
+	uint32_t iterations = roundf(time * update_frequency);
+	if(iterations == 0) iterations = 1;
+
+	MoveSet v;
+	for (int i = 0; i < Robot::NLEGS; ++i) {
+		v.push_back(Pos3(i, 0, 0, 0));
+	}
+
+	const BodyPose from = body.getPose();
+	uint32_t n = 0;
+	bool failed = false;
+	timed.run(iterations, [&](uint32_t steps) {
+		if(failed) return;
+		n += steps;
+		float f = (float)n / iterations;
+		BodyPose p {
+			from.roll + (target.roll - from.roll) * f, from.pitch + (target.pitch - from.pitch) * f, from.yaw + (target.yaw - from.yaw) * f,
+			from.x + (target.x - from.x) * f, from.y + (target.y - from.y) * f, from.z + (target.z - from.z) * f
+		};
+		BodyPose last = body.getPose();
+		body.setPose(p);
+		MoveResult r = body.commit(v, 0, move_mode);
+		if(!r.ok()) {
+			// stay at the last pose the legs could reach
+			body.setPose(last);
+			fprintf(stderr, "pose out of range: legs 0x%02X\n", r.legs);
+			failed = true;
+		}
+	});
 }
 
 volatile bool doabort= false;
@@ -252,11 +477,13 @@ void joystickControl()
 	bool first_time= true;
 	bool gait_changed = false;
 	float last_body_height = body_height;
+	float last_body_pose[6] = {0, 0, 0, 0, 0, 0};
 
 	// register signal and signal handler
 	signal(SIGTERM, signalHandler);
 	signal(SIGHUP, signalHandler);
 
+	checkRealTime();
 	printf("Remote joystick control...\n");
 
 	while(running) {
@@ -267,38 +494,73 @@ void joystickControl()
 				idlePosition();
 			}
 
+			// every pass, the A commands made since the last
+			ServoRequest req;
+			while(servo_requests.pop(req)) {
+				// set it through the leg so the legs position follows the joint
+				int leg, joint;
+				planAhead(false);
+				if(channelToJoint<Robot>(req.channel, leg, joint)) legs[leg].setJoint(joint, servo.toRads(req.channel, req.angle));
+			}
+
 			if(doIdlePosition) {
 				doIdlePosition= false;
+				planAhead(false);
 				idlePosition();
 				continue;
 			}
 			if(doSafeHome) {
 				doSafeHome= false;
+				planAhead(false);
 				safeHome();
 				continue;
 			}
 			if(doStandUp) {
 				doStandUp= false;
+				planAhead(false);
 				standUp();
 				continue;
 			}
 
+			// a new pose takes effect between steps, and is then used by every move of the gait
+			{
+				float p[6];
+				bool changed = false;
+				for (int i = 0; i < 6; ++i) {
+					p[i] = body_pose[i];
+					changed = changed || p[i] != last_body_pose[i];
+				}
+				if(changed) {
+					planAhead(false);
+					changeBodyPose(BodyPose {(float)RADIANS(p[0]), (float)RADIANS(p[1]), (float)RADIANS(p[2]), p[3], p[4], p[5]}, 0.2F);
+					for (int i = 0; i < 6; ++i) last_body_pose[i] = p[i];
+				}
+			}
+
 			gait_changed = (gait_changed || gait != last_gait);
 			last_gait = gait;
 
 			if(gait != NONE && gait <  WAVE_ROTATE && (std::abs(current_x) > 0.0001F || std::abs(current_y) > 0.0001F))  {
 				// current_x and current_y are speed percentage in that direction
 				// calculate the vector of movement in percentage
-				float d = sqrtf(powf(current_x, 2) + powf(current_y, 2)); // vector size
-
-				float x = current_stride * current_x / d; // normalize for proportion move in X, this is stride in mm in X
-				float y = current_stride * current_y / d; // normalize for proportion move in Y, this is stride in mm in Y
+				float cx = current_x, cy = current_y;
+				float d = FMath::sqrt(cx * cx + cy * cy); // vector size
+
+				float stride = current_stride;
+				if(reach_map.isLoaded()) {
+					// the same percentage of the largest stride the legs can make in this direction at this height. The
+					// height is the one last commanded, the legs positions belong to the executor while it runs
+					stride = reach_map.maxStride(atan2f(cy, cx), -last_body_height, MAX_RAISE) * current_stride / max_stride;
+				}
+				float x = stride * current_x / d; // normalize for proportion move in X, this is stride in mm in X
+				float y = stride * current_y / d; // normalize for proportion move in Y, this is stride in mm in Y
 
 				float speed = max_speed * (d / 100.0F); // adjust speed based on size of movement vector
 				if(speed < 20) speed = 20;
 				//printf("x: %f, y: %f, d: %f, speed: %f\n", x, y, d, speed);
 
 				// execute one entire step which will move body over the ground by current_stride mm
+				planAhead(true);
 				switch(gait) {
 					case WAVE:
 						waveGait(1, x, y, speed, gait_changed);
@@ -313,8 +575,12 @@ void joystickControl()
 				float speed = max_speed * std::abs(current_rotate) / 100.0F ;
 				if(speed < 10) speed = 10;
 				float a = current_angle;
+				if(reach_map.isLoaded()) {
+					a = DEGREES(reach_map.maxRotation(-last_body_height, MAX_RAISE)) * current_angle / max_angle;
+				}
 				if(current_rotate < 0) a = -a; // direction of rotate
 
+				planAhead(true);
 				switch(gait) {
 					case WAVE_ROTATE:
 						rotateWaveGait(1, a, speed, gait_changed);
@@ -326,7 +592,14 @@ void joystickControl()
 				gait_changed = false;
 
 			} else {
+				float lo, hi;
+				if(reach_map.heightRange(MAX_RAISE, lo, hi)) {
+					// the feet are at -body_height, keep it where the legs can still step
+					if(body_height < -hi) body_height = -hi;
+					else if(body_height > -lo) body_height = -lo;
+				}
 				if(body_height != last_body_height) {
+					planAhead(false);
 					changeBodyHeight(body_height - last_body_height);
 					last_body_height = body_height;
 				}
@@ -341,11 +614,28 @@ void joystickControl()
 
 		if(doabort) running= false;
 	}
+	planAhead(false);
 
+	if(body.isIncremental()) {
+		const IncrementalIK::Stats& st = body.incrementalStats();
+		printf("Incremental IK: %u solves, %u fell back (cold %u, step %u, reach %u, drift %u, singular %u, aged %u)\n",
+			st.solves, st.fallbacks(), st.cold, st.step, st.reach, st.drift, st.singular, st.aged);
+	}
+	{
+		BusStats st = servo.busStats();
+		printf("Servo bus: %u frames, %u transactions, %u bytes, %u writes issued, %u suppressed as the same PWM count\n",
+			st.frames, st.transactions, st.bytes, st.issued, st.suppressed);
+	}
+	printTimed();
+	printTrajectory();
+	printBusTiming();
+	printI2CSim();
+	if(phase_locked) printPhaseLock();
 	printf("Exited joystick control\n");
 }
 
 extern int mqtt_start(const char *, std::function<bool(const char *)>);
+extern int runBenchmark(const char *name);
 
 // handle a request from MQTT
 bool handle_request(const char *req)
@@ -418,7 +708,7 @@ bool handle_request(const char *req)
 			} else if(v < 0) {
 				body_height = body_height - 1;
 			}else {
-				body_height = TIBIA;
+				body_height = Robot::TIBIA;
 			}
 			debug_printf("Set body height to %f\n", body_height.load());
 			break;
@@ -441,18 +731,55 @@ bool handle_request(const char *req)
 
 		case 'H': // up or down -100% to 100%
 			v = std::stoi(cmd, &p1);
-			body_height = TIBIA * (100 + v) / 100.0;
+			body_height = Robot::TIBIA * (100 + v) / 100.0;
 			debug_printf("Set body height to %f\n", body_height.load());
 			break;
 
+		case 'B':
+			// set the body pose - parameters: roll pitch yaw in degrees, x y z in mm, missing ones are 0
+			p1 = 0;
+			for (int i = 0; i < 6; ++i) {
+				float f = 0;
+				if(p1 < cmd.size() && cmd.find_first_not_of(' ', p1) != std::string::npos) {
+					f = std::stof(cmd.substr(p1), &p2);
+					p1 += p2;
+				}
+				body_pose[i] = f;
+			}
+			debug_printf("Set body pose to roll %f, pitch %f, yaw %f, x %f, y %f, z %f\n",
+				body_pose[0].load(), body_pose[1].load(), body_pose[2].load(), body_pose[3].load(), body_pose[4].load(), body_pose[5].load());
+			break;
+
 		case 'A':
 			// set servos to given Angle - parameters: servo angle
 			v = std::stoi(cmd, &p1);
 			x = std::stof(cmd.substr(p1), &p2);
-			servo.updateServo(v, x);
+			{
+				int leg, joint;
+				// a leg joint is queued for the control thread, it is the one moving the legs. Nothing else moves the
+				// other channels
+				if(!channelToJoint<Robot>(v, leg, joint)) {
+					servo.updateServo(v, x);
+				}else if(!servo_requests.push(ServoRequest {v, x})) {
+					printf("Servo queue full, dropped servo %d\n", v);
+					break;
+				}
+			}
 			debug_printf("Set Servo %d to %f°\n", v, x);
 			break;
 
+		case 'K':
+			// select IK solver 0 analytic, 1 lookup table for the single leg moves, 2 incremental for the body moves
+			v = std::stoi(cmd, &p1);
+			if(v == 1 && !ik_table.isBuilt()) {
+				printf("IK table has not been built, use -i\n");
+				break;
+			}
+			Leg::setIKTable(v == 1 ? &ik_table : nullptr);
+			body.setIncremental(v == 2);
+			debug_printf("IK solver set to %s\n", v == 1 ? "table" : v == 2 ? "incremental" : "analytic");
+			break;
+
 		case 'E':
 			// enable or disable servos
 			v = std::stoi(cmd, &p1);
@@ -460,6 +787,12 @@ bool handle_request(const char *req)
 			debug_printf("Servos %s\n", v == 1 ? "Enabled" : "Disabled");
 			break;
 
+		case 'Q':
+			// query how the ticks are doing so far
+			timed.printHistograms(stdout);
+			if(trajectory.running()) printf("Trajectory: %u segments queued\n", (unsigned)trajectory.depth());
+			break;
+
 		default: printf("Unknown MQTT command: %c\n", c);
 	}
 
@@ -489,8 +822,48 @@ void rawMove(int leg, int joint, float x, float y, float z, bool absol = false)
 		if(absol) legs[leg].move(x, y, z);
 		else legs[leg].moveBy(x, y, z);
 	} else if(leg >= 0 && joint >= 0) {
-		servo.move((leg * 3) + joint, (x * M_PI / 180.0) - M_PI_2);
+		legs[leg].setJoint(joint, (x * M_PI / 180.0) - M_PI_2);
+	}
+}
+
+// capture a calibration for the joints of leg (all the legs if -1), each joint is jogged in us until it is at
+// a set of angles and the pulse that got it there is recorded, the points are merged into fn
+static bool captureCalibration(const char *fn, int leg)
+{
+	static const float targets[] = { -60, -30, 0, 30, 60 }; // degrees
+	Calibration cal;
+	if(access(fn, F_OK) == 0 && !cal.load(fn)) return false;
+
+	printf("Jog each joint to the angle asked for, +n or -n moves n us, enter records it, s skips the angle, n the joint, q saves and stops\n");
+	char line[64];
+	bool quit = false;
+	for (int l = 0; l < Robot::NLEGS && !quit; ++l) {
+		if(leg >= 0 && l != leg) continue;
+		for (int j = 0; j < 3 && !quit; ++j) {
+			int ch = Robot::legs[l].joint[j];
+			bool next = false;
+			for (float deg : targets) {
+				if(next || quit) break;
+				// start from what the points so far give, or the uncalibrated pulse
+				float us = roundf(cal.numPoints(ch) >= 2 ? cal.pulseAt(ch, deg) : servo.defaultPulse(ch, RADIANS(deg)));
+				while(true) {
+					servo.setPulse(ch, us);
+					printf("leg %d joint %d (channel %d) at %g°, %1.0f us > ", l, j, ch, deg, us);
+					fflush(stdout);
+					if(fgets(line, sizeof(line), stdin) == nullptr) { quit = true; break; }
+					if(line[0] == '\n') { cal.addPoint(ch, deg, us); break; }
+					if(line[0] == 's') break;
+					if(line[0] == 'n') { next = true; break; }
+					if(line[0] == 'q') { quit = true; break; }
+					us += atof(line);
+				}
+			}
+		}
 	}
+
+	if(!cal.save(fn)) return false;
+	printf("Calibration saved to %s\n", fn);
+	return true;
 }
 
 int main(int argc, char *argv[])
@@ -506,16 +879,54 @@ int main(int argc, char *argv[])
 	bool do_test = false;
 
 	// setup an array of legs, using this as they are not copyable.
-	//  position angle, home angle, ankle, knee, hip
-	legs.emplace_back("front left",    60,  -60,  0,  1,  2, servo); // front left
-	legs.emplace_back("middle left",    0,    0,  3,  4,  5, servo); // middle left
-	legs.emplace_back("back left",    -60,   60,  6,  7,  8, servo); // back left
-	legs.emplace_back("back right",  -120,  120,  9, 10, 11, servo); // back right
-	legs.emplace_back("middle right", 180,  180, 12, 13, 14, servo); // middle right
-	legs.emplace_back("front right",  120, -120, 15, 16, 17, servo); // front right
+	// where each leg is mounted and its servos are in the robot description (Robot.h)
+	for (int i = 0; i < Robot::NLEGS; ++i) {
+		legs.emplace_back(i, servo);
+	}
 
+	const char *options = "hH:RDaAmMc:l:j:f:x:y:z:s:S:TIL:W:JP:vE:b:B:K:i:e:CNG:g:FOQ:u:U:k:p:t:X:Y:o:rw:q:d:Z:n:";
 	try{
-	while ((c = getopt (argc, argv, "hH:RDaAmMc:l:j:f:x:y:z:s:S:TIL:W:JP:vE:b:B:")) != -1) {
+	// the servo backend and the simulated buses are set up before the other options use the servos
+	ServoBackend backend = ServoBackend::PCA9685;
+	const char *bench = nullptr;
+	opterr = 0;
+	while ((c = getopt (argc, argv, options)) != -1) {
+		if(c == 'o') {
+			char *file = strchr(optarg, ':');
+			if(file != nullptr) *file++ = '\0';
+			if(!parseBackend(optarg, backend)) {
+				fprintf(stderr, "Unknown servo backend: %s\n", optarg);
+				return 1;
+			}
+			if(backend == ServoBackend::RECORD) servo_record_file = file;
+			RecordBoard::setRecording(servo_record_file != nullptr);
+		}else if(c == 'X') {
+			I2C::simulate(atoi(optarg));
+		}else if(c == 'Y') {
+			// before the buses are opened
+			i2c_record_file = optarg;
+			SimI2C::setRecording(true);
+		}else if(c == 'K') {
+			bench = optarg;
+		}else if(c == 'r') {
+			servo.setFastStart(false);
+		}else if(c == 'q') {
+			if(sscanf(optarg, "%d,%d", &rt_priority, &rt_cpu) < 1 || rt_priority < 1 || rt_priority > 99) {
+				fprintf(stderr, "Bad real time priority: %s\n", optarg);
+				return 1;
+			}
+		}
+	}
+	opterr = 1;
+	optind = 1;
+	// the bus and output threads started from here on inherit the real time policy
+	if(rt_priority > 0 && !startRealTime()) return 1;
+	// the benchmarks bring their own servos, so the robot's are never opened for them
+	if(bench != nullptr) return runBenchmark(bench);
+	servo.open(backend);
+	printStartup("startup");
+
+	while ((c = getopt (argc, argv, options)) != -1) {
 		switch (c) {
 			case 'h':
 				printf("Usage:\n");
@@ -531,6 +942,11 @@ int main(int argc, char *argv[])
 				printf(" -b n Set leg left delta to n\n");
 				printf(" -B n Set body height to n\n");
 				printf(" -f n Set frequency to n Hz\n");
+				printf(" -q prio[,cpu] real time mode, the control thread at SCHED_FIFO priority prio (pinned to cpu) with the memory locked\n");
+				printf(" -w us spin the last us before each tick instead of sleeping, for a more precise wakeup\n");
+				printf(" -d policy when a tick overruns, stretch the move (default), drop steps to keep to the schedule or catchup\n");
+				printf(" -Z file write the tick time histograms to file at exit\n");
+				printf(" -n n let the gaits plan up to n (1-16) moves ahead of a thread that runs them, so they don't stop between moves\n");
 				printf(" -c n Set cycle count to n\n");
 				printf(" -S n Set servo n to angle x\n");
 				printf(" -H host set MQTT host\n");
@@ -543,6 +959,25 @@ int main(int argc, char *argv[])
 				printf(" -P m pause m milliseconds\n");
 				printf(" -E n enable or disable servos\n");
 				printf(" -T run test\n");
+				printf(" -K name run benchmark name (or all)\n");
+				printf(" -e n Set IK table max error to n degrees\n");
+				printf(" -i file use the IK lookup table for single leg moves, loaded from or cached in file (the gaits always use the batch IK)\n");
+				printf(" -C clamp moves that are out of reach to the workspace instead of skipping them\n");
+				printf(" -N use the incremental IK for interpolated moves\n");
+				printf(" -F write each tick to the servo boards as one auto increment frame per board\n");
+				printf(" -O write the servos from their own thread at the PWM frequency\n");
+				printf(" -Q n don't write a servo unless it moves more than n PWM counts\n");
+				printf(" -G file generate the reachability map into file\n");
+				printf(" -g file use the reachability map in file to limit stride, rotation and height\n");
+				printf(" -o name servo output backend, pca9685 (default), gpio (channels from 16 on the GPIO PWM), dummy or record[:file] to keep every write, saved to file at exit\n");
+				printf(" -r reprogram the servo boards at startup even if they already run at the PWM frequency\n");
+				printf(" -X hz simulate the I2C buses at hz (eg 100000, 400000, 1000000) instead of using the hardware\n");
+				printf(" -Y file write every simulated I2C transaction to file at exit\n");
+				printf(" -t file use the servo board topology in file, lines of channel bus address port (before -u and -Q)\n");
+				printf(" -u file use the servo calibration in file\n");
+				printf(" -k hz lock the servo writes to the PWM cycle, hz is the measured PWM frequency or 0 for the set one\n");
+				printf(" -p pin GPIO wired to a servo signal of the first board to keep the -k lock in phase (before -k)\n");
+				printf(" -U file capture a servo calibration for leg (all if no -l) into file\n");
 				printf(" -v verbose debug\n");
 				return 1;
 
@@ -551,11 +986,29 @@ int main(int argc, char *argv[])
 
 			case 'D': printf("Hit any key...\n"); getchar(); return 0;
 
-			case 'S': servo.updateServo(atoi(optarg), x); break;
+			case 'S': {
+				int ch = atoi(optarg), l, j;
+				if(channelToJoint<Robot>(ch, l, j)) legs[l].setJoint(j, servo.toRads(ch, x));
+				else servo.updateServo(ch, x);
+			} break;
 			case 'P': usleep(atoi(optarg) * 1000); break;
 			case 'E': servo.enableServos(atoi(optarg) == 1); break;
 
-			case 'f': update_frequency = atof(optarg); break;
+			case 'f':
+				update_frequency = atof(optarg);
+				timed.setFrequency(update_frequency);
+				break;
+			case 'w': timed.setSpin(atoi(optarg) * 1000); break;
+			case 'd': {
+				Timed::Overrun o;
+				if(!Timed::parseOverrun(optarg, o)) {
+					fprintf(stderr, "Unknown overrun policy: %s\n", optarg);
+					return 1;
+				}
+				timed.setOverrun(o);
+			} break;
+			case 'Z': tick_histogram_file = optarg; break;
+			case 'n': plan_ahead = atoi(optarg); break;
 
 			case 'a': absol = true; break;
 			case 'b': MAX_RAISE = atof(optarg); break;
@@ -599,6 +1052,53 @@ int main(int argc, char *argv[])
 				do_test = true;
 				break;
 
+			case 'C':
+				move_mode = MoveMode::CLAMP;
+				trajectory.setMoveMode(move_mode);
+				break;
+			case 'N': body.setIncremental(true); break;
+			case 'F': servo.setFrameWrites(true); break;
+			case 'O':
+				// with a phase lock the output thread takes it over from the control loop
+				timed.setPhaseLock(nullptr);
+				servo.startOutput();
+				break;
+			case 'k':
+				if(!startPhaseLock(atof(optarg))) return 1;
+				break;
+			case 'p': sync_pin = atoi(optarg); break;
+			case 'Q':
+				for (int ch = 0; ch < Robot::NSERVOS; ++ch) servo.setHysteresis(ch, atoi(optarg));
+				break;
+			case 'e': ik_table_error = atof(optarg); break;
+			case 'i':
+				ik_table.init(optarg, ik_table_spacing, RADIANS(ik_table_error));
+				printf("IK table %.1f%% coverage\n", ik_table.coverage() * 100);
+				Leg::setIKTable(&ik_table);
+				break;
+
+			case 'G': {
+				uint64_t t = timed.micros();
+				if(!ReachMap::generate(optarg, reach_map_spacing)) return 1;
+				printf("Reachability map generated in %1.3f secs\n", (timed.micros() - t) / 1e6F);
+			}
+			break;
+			case 'g':
+				if(!reach_map.load(optarg)) return 1;
+				break;
+
+			case 'o': case 'X': case 'Y': case 'K': case 'r': case 'q': break; // before the rest
+			case 't':
+				if(!servo.loadTopology(optarg)) return 1;
+				printStartup("topology");
+				break;
+			case 'u':
+				if(!servo.loadCalibration(optarg)) return 1;
+				break;
+			case 'U':
+				if(!captureCalibration(optarg, leg)) return 1;
+				break;
+
 			case 'I':
 				//interpolatedMoves({Pos3(leg, x, y, z)}, speed, !abs);
 				for (int i = 0; i <= reps; ++i) {
@@ -626,6 +1126,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if(do_test || do_walk) checkRealTime();
 	if(do_test) {
 		waveGait(1, x, y, speed, true);
 
@@ -633,6 +1134,7 @@ int main(int argc, char *argv[])
 		waveGait(1, x, y, speed, false);
 
 	} else if(do_walk) {
+		planAhead(true);
 		switch(gait) {
 			case 0: waveGait(reps, x, y, speed, true); break;
 			case 1: tripodGait(reps, x, y, speed, true); break;
@@ -640,11 +1142,26 @@ int main(int argc, char *argv[])
 			case 3: rotateTripodGait(reps, x, speed, true); break;
 			default: printf("Unknown Gait %d\n", gait);
 		}
+		planAhead(false);
 	}
 
 	}catch(...) {
 		fprintf(stderr, "Caught unhandled exception... Exiting\n");
 	}
+
+	if(servo.outputRunning()) {
+		servo.stopOutput();
+		Servo::OutputStats st = servo.outputStats();
+		printf("Servo output: %u frames published, %u overwritten, %u written, %u idle periods, %u late periods\n",
+			st.published, st.overwritten, st.written, st.idle, st.late);
+	}
+	printTimed();
+	printTrajectory();
+	printBusTiming();
+	printI2CSim();
+	if(i2c_record_file != nullptr) SimI2C::save(i2c_record_file);
+	if(servo_record_file != nullptr) RecordBoard::save(servo_record_file);
+	if(phase_locked) printPhaseLock();
 	return 0;
 }
 
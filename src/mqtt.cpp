@@ -4,6 +4,8 @@
 
 #include <mosquitto.h>
 
+#include "RealTime.h"
+
 static std::function<bool(const char *)> cb;
 
 void my_message_callback(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message)
@@ -32,6 +34,9 @@ void my_message_callback(struct mosquitto *mosq, void *userdata, const struct mo
 
 void my_connect_callback(struct mosquitto *mosq, void *userdata, int result)
 {
+	// this is the network thread, which must not hold up the control thread
+	RealTime::background();
+
 	if(!result){
 		/* Subscribe to broker information topics on successful connect. */
 		mosquitto_subscribe(mosq, NULL, "quadruped/commands", 2);
@@ -0,0 +1,104 @@
+/**
+	Thin wrapper over the SSE/AVX intrinsics so the batch kernels can be written once.
+	AVX2 is used when compiled for the host with -march=native, SSE on the Edison with -march=core2,
+	and a plain float if neither is available.
+	Arithmetic uses the normal operators (gcc vector extensions), masks are only combined with the helpers below.
+*/
+
+#pragma once
+
+#include "fastmath.h"
+
+#include <cstdint>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define SIMD_WIDTH 8
+typedef __m256 vfloat;
+typedef __m256 vmask;
+
+static inline vfloat vset1(float f) { return _mm256_set1_ps(f); }
+static inline vfloat vload(const float *p) { return _mm256_loadu_ps(p); }
+static inline void vstore(float *p, vfloat v) { _mm256_storeu_ps(p, v); }
+static inline vfloat vsqrt(vfloat v) { return _mm256_sqrt_ps(v); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+static inline vfloat vabs(vfloat v) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0F), v); }
+static inline vmask vgt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vmask vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vmask vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline vmask vge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline vmask vand(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, m); }
+static inline uint32_t vmovemask(vmask m) { return _mm256_movemask_ps(m); }
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+#define SIMD_WIDTH 4
+typedef __m128 vfloat;
+typedef __m128 vmask;
+
+static inline vfloat vset1(float f) { return _mm_set1_ps(f); }
+static inline vfloat vload(const float *p) { return _mm_loadu_ps(p); }
+static inline void vstore(float *p, vfloat v) { _mm_storeu_ps(p, v); }
+static inline vfloat vsqrt(vfloat v) { return _mm_sqrt_ps(v); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+static inline vfloat vabs(vfloat v) { return _mm_andnot_ps(_mm_set1_ps(-0.0F), v); }
+static inline vmask vgt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+static inline vmask vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vmask vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+static inline vmask vge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+static inline vmask vand(vmask a, vmask b) { return _mm_and_ps(a, b); }
+// SSE3 has no blend, so do it with and/andnot
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+static inline uint32_t vmovemask(vmask m) { return _mm_movemask_ps(m); }
+
+#else
+#define SIMD_WIDTH 1
+typedef float vfloat;
+typedef bool vmask;
+
+static inline vfloat vset1(float f) { return f; }
+static inline vfloat vload(const float *p) { return *p; }
+static inline void vstore(float *p, vfloat v) { *p = v; }
+static inline vfloat vsqrt(vfloat v) { return sqrtf(v); }
+static inline vfloat vmin(vfloat a, vfloat b) { return a < b ? a : b; }
+static inline vfloat vmax(vfloat a, vfloat b) { return a > b ? a : b; }
+static inline vfloat vabs(vfloat v) { return fabsf(v); }
+static inline vmask vgt(vfloat a, vfloat b) { return a > b; }
+static inline vmask vlt(vfloat a, vfloat b) { return a < b; }
+static inline vmask vle(vfloat a, vfloat b) { return a <= b; }
+static inline vmask vge(vfloat a, vfloat b) { return a >= b; }
+static inline vmask vand(vmask a, vmask b) { return a && b; }
+static inline vfloat vselect(vmask m, vfloat a, vfloat b) { return m ? a : b; }
+static inline uint32_t vmovemask(vmask m) { return m ? 1 : 0; }
+#endif
+
+// the batch kernels evaluate the polynomials of the build's math tier on every lane
+struct VectorOps
+{
+	typedef vfloat V;
+	typedef vmask M;
+	static V k(float f) { return vset1(f); }
+	static V abs(V v) { return vabs(v); }
+	static V min(V a, V b) { return vmin(a, b); }
+	static V max(V a, V b) { return vmax(a, b); }
+	static V sqrt(V v) { return vsqrt(v); }
+	static M gt(V a, V b) { return vgt(a, b); }
+	static M lt(V a, V b) { return vlt(a, b); }
+	static V select(M m, V a, V b) { return vselect(m, a, b); }
+};
+
+typedef MathPoly<MATH_TIER> BatchMath;
+
+static inline vfloat vatan2(vfloat y, vfloat x) { return BatchMath::atan2<VectorOps>(y, x); }
+// x must already be clamped to [-1, 1]
+static inline vfloat vacos(vfloat x) { return BatchMath::acos<VectorOps>(x); }
+// sin over [-3pi/2, 3pi/2]
+static inline vfloat vsin(vfloat x) { return BatchMath::sin<VectorOps>(x); }
+// cos over [-pi, 2pi]
+static inline vfloat vcos(vfloat x) { return BatchMath::cos<VectorOps>(x); }